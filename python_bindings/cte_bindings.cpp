@@ -21,6 +21,7 @@
 #include "renderer.h"
 #include "transform.h"
 #include "path.h"
+#include "profiler.h"
 
 namespace py = pybind11;
 
@@ -91,6 +92,12 @@ std::array<float, 16> FormatMat4(const glm::mat4& matrix)
 	return out;
 }
 
+// The BSP accessors index the node pool directly, so ids coming from Python are checked first
+void CheckBSPNodeID(const BSP& bsp, uint32_t id)
+{
+	if (id >= bsp.GetNodeCount()) { throw py::index_error("BSP node id " + std::to_string(id) + " out of range"); }
+}
+
 void init_crashteameditor(py::module_& m)
 {
 	m.doc() = "Pybind11 bindings for CrashTeamEditor";
@@ -472,6 +479,12 @@ void init_crashteameditor(py::module_& m)
 		.value("Z", AxisSplit::Z)
 		.export_values();
 
+	py::enum_<BSPBuilder> bspBuilder(m, "BSPBuilder");
+	bspBuilder
+		.value("MIDPOINT", BSPBuilder::MIDPOINT)
+		.value("SAH", BSPBuilder::SAH)
+		.export_values();
+
 	py::class_<BSPFlags>(m, "BSPFlags")
 		.def_readonly_static("NONE", &BSPFlags::NONE)
 		.def_readonly_static("LEAF", &BSPFlags::LEAF)
@@ -485,50 +498,50 @@ void init_crashteameditor(py::module_& m)
 		.def_readonly_static("LEAF", &BSPID::LEAF)
 		.def_readonly_static("EMPTY", &BSPID::EMPTY);
 
+	m.attr("BSP_NODE_NONE") = BSP_NODE_NONE;
+
+	py::class_<BSPTreeNode>(m, "BSPTreeNode")
+		.def_readonly("bbox", &BSPTreeNode::bbox)
+		.def_readonly("parent", &BSPTreeNode::parent)
+		.def_readonly("left", &BSPTreeNode::left)
+		.def_readonly("right", &BSPTreeNode::right)
+		.def_readonly("first_quad", &BSPTreeNode::firstQuad)
+		.def_readonly("quad_count", &BSPTreeNode::quadCount)
+		.def_readonly("split", &BSPTreeNode::split)
+		.def_readonly("flags", &BSPTreeNode::flags)
+		.def_readonly("type", &BSPTreeNode::type)
+		.def_readonly("axis", &BSPTreeNode::axis)
+		.def("is_branch", &BSPTreeNode::IsBranch);
+
 	py::class_<BSP> bsp(m, "BSP");
 	bsp
 		.def(py::init<>())
-		.def(py::init([](BSPNode type, const std::vector<size_t>& quadblockIndexes, py::object parent, const std::vector<Quadblock>& quadblocks)
-			{
-				BSP* parentPtr = parent.is_none() ? nullptr : parent.cast<BSP*>();
-				return BSP(type, quadblockIndexes, parentPtr, quadblocks);
-			}),
-			py::arg("type"), py::arg("quadblock_indexes"), py::arg("parent") = py::none(), py::arg("quadblocks"))
-		.def("get_id", &BSP::GetId)
 		.def("is_empty", &BSP::IsEmpty)
 		.def("is_valid", &BSP::IsValid)
-		.def("is_branch", &BSP::IsBranch)
-		.def("flags", &BSP::GetFlags)
-		.def("type", &BSP::GetType)
-		.def("axis", &BSP::GetAxis)
+		.def("node_count", &BSP::GetNodeCount)
+		.def("node", [](const BSP& bsp, uint32_t id) {
+			CheckBSPNodeID(bsp, id);
+			return bsp.GetNode(id);
+		}, py::arg("id"))
+		.def("type", [](const BSP& bsp, uint32_t id) {
+			CheckBSPNodeID(bsp, id);
+			return bsp.GetType(id);
+		}, py::arg("id"))
+		.def("axis", [](const BSP& bsp, uint32_t id) {
+			CheckBSPNodeID(bsp, id);
+			return bsp.GetAxis(id);
+		}, py::arg("id"))
 		.def("bounding_box", &BSP::GetBoundingBox, py::return_value_policy::copy)
-		.def("quadblock_indexes", &BSP::GetQuadblockIndexes, py::return_value_policy::copy)
-		.def("left_child", &BSP::GetLeftChildren, py::return_value_policy::reference_internal)
-		.def("right_child", &BSP::GetRightChildren, py::return_value_policy::reference_internal)
-		.def("parent", &BSP::GetParent, py::return_value_policy::reference_internal)
-		.def("tree", [](BSP& bsp) {
-			py::list nodes;
-			const std::vector<const BSP*> tree = bsp.GetTree();
-			py::object owner = py::cast(&bsp);
-			for (const BSP* node : tree)
-			{
-				nodes.append(py::cast(const_cast<BSP*>(node), py::return_value_policy::reference_internal, owner));
-			}
-			return nodes;
-		})
-		.def("leaves", [](BSP& bsp) {
-			py::list nodes;
-			const std::vector<const BSP*> leaves = bsp.GetLeaves();
-			py::object owner = py::cast(&bsp);
-			for (const BSP* node : leaves)
-			{
-				nodes.append(py::cast(const_cast<BSP*>(node), py::return_value_policy::reference_internal, owner));
-			}
-			return nodes;
-		})
+		.def("quadblock_indexes", [](const BSP& bsp, uint32_t id) {
+			if (bsp.IsEmpty()) { return std::vector<size_t>(); }
+			CheckBSPNodeID(bsp, id);
+			std::span<const size_t> indexes = bsp.GetQuadblockIndexes(id);
+			return std::vector<size_t>(indexes.begin(), indexes.end());
+		}, py::arg("id") = 0)
+		.def("leaves", &BSP::GetLeaves, py::return_value_policy::copy)
 		.def("set_quadblock_indexes", &BSP::SetQuadblockIndexes)
 		.def("clear", &BSP::Clear)
-		.def("generate", &BSP::Generate, py::arg("quadblocks"), py::arg("max_quads_per_leaf"), py::arg("max_axis_length"));
+		.def("generate", &BSP::Generate, py::arg("quadblocks"), py::arg("max_quads_per_leaf"), py::arg("max_axis_length"), py::arg("builder") = BSPBuilder::MIDPOINT);
 
 	py::class_<Level> level(m, "Level");
 	level
@@ -567,6 +580,26 @@ void init_crashteameditor(py::module_& m)
 			}
 			return py::make_tuple(quadblockList, std::get<1>(selection));
 		});
+
+	py::class_<ProfilerTimer>(m, "ProfilerTimer")
+		.def_readonly("name", &ProfilerTimer::name)
+		.def_readonly("calls", &ProfilerTimer::calls)
+		.def_readonly("total_ms", &ProfilerTimer::totalMs)
+		.def_readonly("last_ms", &ProfilerTimer::lastMs)
+		.def_readonly("max_ms", &ProfilerTimer::maxMs)
+		.def_readonly("peak_memory", &ProfilerTimer::peakMemory);
+
+	py::class_<ProfilerCounter>(m, "ProfilerCounter")
+		.def_readonly("name", &ProfilerCounter::name)
+		.def_readonly("value", &ProfilerCounter::value);
+
+	py::class_<Profiler>(m, "Profiler")
+		.def_static("reset", &Profiler::Reset)
+		.def_static("timers", &Profiler::GetTimers)
+		.def_static("counters", &Profiler::GetCounters)
+		.def_static("current_memory", &Profiler::GetCurrentMemory)
+		.def_static("peak_memory", &Profiler::GetPeakMemory)
+		.def_static("to_json", []() { return Profiler::ToJson().dump(2); });
 }
 
 #if defined(CTE_EXTENSION_BUILD)
@@ -156,6 +156,7 @@ void App::InitUISettings()
 	if (json.contains("LastOpenedFolder")) { Settings::m_lastOpenedFolder = json["LastOpenedFolder"]; }
 	if (json.contains("LastOpenedScriptFolder")) { Settings::m_lastOpenedScriptFolder = json["LastOpenedScriptFolder"]; }
 	if (json.contains("Script")) { Settings::w_python = json["Script"]; }
+	if (json.contains("Profiler")) { Settings::w_profiler = json["Profiler"]; }
 	if (json.contains("CameraBindings"))
 	{
 		const nlohmann::json& bindings = json["CameraBindings"];
@@ -217,6 +218,7 @@ void App::SaveUISettings(bool useDefault)
 	json["LastOpenedFolder"] = Settings::m_lastOpenedFolder;
 	json["LastOpenedScriptFolder"] = Settings::m_lastOpenedScriptFolder;
 	json["Script"] = Settings::w_python;
+	json["Profiler"] = Settings::w_profiler;
 	json["CameraBindings"] = {
 		{"Forward", GuiRenderSettings::camKeyForward},
 		{"Back", GuiRenderSettings::camKeyBack},
@@ -0,0 +1,454 @@
+#include "cli.h"
+#include "level.h"
+#include "profiler.h"
+#include "vistree.h"
+#include "texture.h"
+
+#include <nlohmann/json.hpp>
+
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <atomic>
+#include <thread>
+#include <omp.h>
+
+static constexpr float BENCHMARK_MAX_QUAD_SIZE = 4.0f;
+static constexpr float BENCHMARK_FOOTPRINT = 1000.0f; // LEV vertices are int16 in 1/64 units, so everything has to fit in +-512
+static constexpr size_t BENCHMARK_MATERIAL_COUNT = 4;
+static constexpr size_t BENCHMARK_TUNNEL_SIDES = 8;
+static constexpr size_t BENCHMARK_TUNNEL_PITCH = 3; // distance between two tunnels, in quadblocks
+static constexpr size_t SELFTEST_SIZE = 1000;
+static constexpr float SELFTEST_VIS_RAISE = 8.0f; // height the vis update check pushes a quadblock up by
+static constexpr float PI = 3.14159265358979f;
+
+/*
+	Builds one quadblock spanning origin -> origin + u + v out of the four quads an OBJ import would produce,
+	so the benchmark goes through the same Quadblock constructor as the editor.
+*/
+static void AddQuadblock(std::vector<Quadblock>& quadblocks, const Vec3& origin, const Vec3& u, const Vec3& v, size_t material, uint16_t flags)
+{
+	Vec3 normal = u.Cross(v);
+	normal = normal / normal.Length();
+
+	std::array<Point, 9> points;
+	for (size_t row = 0; row < 3; row++)
+	{
+		for (size_t col = 0; col < 3; col++)
+		{
+			Point& point = points[row * 3 + col];
+			point.pos = origin + u * (static_cast<float>(col) * 0.5f) + v * (static_cast<float>(row) * 0.5f);
+			point.normal = normal;
+			point.color = Color(static_cast<unsigned char>(128), 128u, 128u);
+			point.uv = Vec2(static_cast<float>(col) * 0.5f, static_cast<float>(row) * 0.5f);
+		}
+	}
+
+	Quad q0 = Quad(points[0], points[1], points[4], points[3]);
+	Quad q1 = Quad(points[1], points[2], points[5], points[4]);
+	Quad q2 = Quad(points[3], points[4], points[7], points[6]);
+	Quad q3 = Quad(points[4], points[5], points[8], points[7]);
+	const std::string name = "bench_" + std::to_string(quadblocks.size());
+	quadblocks.emplace_back(name, q0, q1, q2, q3, normal, "bench_mat" + std::to_string(material), true, nullptr);
+
+	Quadblock& quadblock = quadblocks.back();
+	quadblock.SetFlag(flags);
+	quadblock.SetCheckpointStatus(true);
+	quadblock.SetCheckpointPathable((flags & QuadFlags::GROUND) != 0);
+	quadblock.SetVisTreeDirty(false);
+}
+
+/*
+	Square of quadblocks, centered on the origin and shrunk to fit the LEV coordinate range.
+	The ramp variant tilts it so that the far rows climb out of the near ones.
+	The path goes from the first row to the last one.
+*/
+static void GenerateGrid(std::vector<Quadblock>& quadblocks, size_t count, float slope, std::vector<size_t>& pathStart, std::vector<size_t>& pathEnd)
+{
+	const size_t side = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(count))));
+	const size_t rows = (count + side - 1) / side;
+	const float quadSize = std::min(BENCHMARK_MAX_QUAD_SIZE, BENCHMARK_FOOTPRINT / static_cast<float>(side));
+	const float half = (quadSize * static_cast<float>(side)) / 2.0f;
+	for (size_t i = 0; i < count; i++)
+	{
+		const size_t x = i % side;
+		const size_t z = i / side;
+		const float posZ = static_cast<float>(z) * quadSize - half;
+		const Vec3 origin = Vec3(static_cast<float>(x) * quadSize - half, posZ * slope, posZ);
+		AddQuadblock(quadblocks, origin, Vec3(quadSize, 0.0f, 0.0f), Vec3(0.0f, quadSize * slope, quadSize), (x + z) % BENCHMARK_MATERIAL_COUNT, QuadFlags::DEFAULT);
+		if (z == 0) { pathStart.push_back(i); }
+		if (z == rows - 1) { pathEnd.push_back(i); }
+	}
+}
+
+/*
+	Parallel octagonal tubes laid side by side: the bottom face of each ring is the road, the other ones are walls
+	facing inwards that block most of the rays. The path runs through every tube at once.
+*/
+static void GenerateTunnels(std::vector<Quadblock>& quadblocks, size_t count, std::vector<size_t>& pathStart, std::vector<size_t>& pathEnd)
+{
+	const size_t rings = (count + BENCHMARK_TUNNEL_SIDES - 1) / BENCHMARK_TUNNEL_SIDES;
+	const size_t tunnels = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(rings) / static_cast<double>(BENCHMARK_TUNNEL_PITCH))));
+	const size_t ringsPerTunnel = (rings + tunnels - 1) / tunnels;
+	const float quadSize = std::min(BENCHMARK_MAX_QUAD_SIZE, BENCHMARK_FOOTPRINT / static_cast<float>(std::max(ringsPerTunnel, tunnels * BENCHMARK_TUNNEL_PITCH)));
+	const float radius = quadSize / (2.0f * std::sin(PI / static_cast<float>(BENCHMARK_TUNNEL_SIDES)));
+	const float halfWidth = (quadSize * static_cast<float>(tunnels * BENCHMARK_TUNNEL_PITCH)) / 2.0f;
+	const float halfLength = (quadSize * static_cast<float>(ringsPerTunnel)) / 2.0f;
+	for (size_t i = 0; i < count; i++)
+	{
+		const size_t side = i % BENCHMARK_TUNNEL_SIDES;
+		const size_t ring = (i / BENCHMARK_TUNNEL_SIDES) % ringsPerTunnel;
+		const size_t tunnel = (i / BENCHMARK_TUNNEL_SIDES) / ringsPerTunnel;
+		const float angle0 = (2.0f * PI * static_cast<float>(side)) / static_cast<float>(BENCHMARK_TUNNEL_SIDES) - (PI / 2.0f) - (PI / static_cast<float>(BENCHMARK_TUNNEL_SIDES));
+		const float angle1 = angle0 + (2.0f * PI) / static_cast<float>(BENCHMARK_TUNNEL_SIDES);
+		const float centerX = static_cast<float>(tunnel * BENCHMARK_TUNNEL_PITCH) * quadSize - halfWidth;
+		const float z = static_cast<float>(ring) * quadSize - halfLength;
+		const Vec3 origin = Vec3(centerX + std::cos(angle0) * radius, std::sin(angle0) * radius, z);
+		const Vec3 end = Vec3(centerX + std::cos(angle1) * radius, std::sin(angle1) * radius, z);
+		const bool road = side == 0;
+		const uint16_t flags = road ? QuadFlags::DEFAULT : static_cast<uint16_t>(QuadFlags::WALL | QuadFlags::COLLISION_TRIGGER);
+		AddQuadblock(quadblocks, origin, Vec3(0.0f, 0.0f, quadSize), end - origin, (side + ring) % BENCHMARK_MATERIAL_COUNT, flags);
+		if (!road) { continue; }
+		const size_t tunnelRings = std::min(ringsPerTunnel, rings - tunnel * ringsPerTunnel);
+		if (ring == 0) { pathStart.push_back(i); }
+		if (ring == tunnelRings - 1 && tunnelRings > 1) { pathEnd.push_back(i); }
+	}
+}
+
+static void GenerateShape(std::vector<Quadblock>& quadblocks, const std::string& shape, size_t count, std::vector<size_t>& pathStart, std::vector<size_t>& pathEnd)
+{
+	quadblocks.reserve(count);
+	if (shape == "grid") { GenerateGrid(quadblocks, count, 0.0f, pathStart, pathEnd); }
+	else if (shape == "ramp") { GenerateGrid(quadblocks, count, 0.4f, pathStart, pathEnd); }
+	else { GenerateTunnels(quadblocks, count, pathStart, pathEnd); }
+}
+
+// Binary PPM, which stb_image reads like any other image. The color count grows with the index so both 4 and 8 bpp textures get packed.
+static bool WriteBenchmarkTexture(const std::filesystem::path& path, size_t index)
+{
+	constexpr int size = 64;
+	const size_t colorCount = static_cast<size_t>(4) << (index * 2);
+	std::ofstream file(path, std::ios::binary);
+	file << "P6\n" << size << " " << size << "\n255\n";
+	for (int y = 0; y < size; y++)
+	{
+		for (int x = 0; x < size; x++)
+		{
+			const size_t color = (static_cast<size_t>(x) * 7 + static_cast<size_t>(y) * 13 + static_cast<size_t>(x * y)) % colorCount;
+			const unsigned char rgb[3] = {
+				static_cast<unsigned char>((color * 53) & 0xFF),
+				static_cast<unsigned char>((color * 97 + index * 40) & 0xFF),
+				static_cast<unsigned char>((color * 31) >> 2)
+			};
+			file.write(reinterpret_cast<const char*>(rgb), sizeof(rgb));
+		}
+	}
+	return file.good();
+}
+
+/*
+	The process peak (ru_maxrss) only ever grows, so the peak of a single stage is taken
+	by sampling the current resident memory every millisecond on a background thread.
+*/
+class StageMemorySampler
+{
+public:
+	StageMemorySampler() : m_peak(Profiler::GetCurrentMemory()), m_running(true), m_thread([this]() { Sample(); }) {}
+	~StageMemorySampler() { Stop(); }
+	StageMemorySampler(const StageMemorySampler&) = delete;
+	StageMemorySampler& operator=(const StageMemorySampler&) = delete;
+
+	size_t Stop()
+	{
+		if (m_thread.joinable())
+		{
+			m_running = false;
+			m_thread.join();
+			m_peak = std::max(m_peak, Profiler::GetCurrentMemory());
+		}
+		return m_peak;
+	}
+
+private:
+	void Sample()
+	{
+		while (m_running)
+		{
+			m_peak = std::max(m_peak, Profiler::GetCurrentMemory());
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+
+private:
+	size_t m_peak;
+	std::atomic<bool> m_running;
+	std::thread m_thread;
+};
+
+static size_t GetProfilerTimerCalls(const std::string& name, double& lastMs)
+{
+	for (const ProfilerTimer& timer : Profiler::GetTimers())
+	{
+		if (timer.name == name) { lastMs = timer.lastMs; return timer.calls; }
+	}
+	lastMs = 0.0;
+	return 0;
+}
+
+static std::vector<std::string> SplitList(const std::string& value)
+{
+	std::vector<std::string> items;
+	std::stringstream stream(value);
+	std::string item;
+	while (std::getline(stream, item, ',')) { if (!item.empty()) { items.push_back(item); } }
+	return items;
+}
+
+int CLI::Benchmark(const std::vector<std::string>& args)
+{
+	std::vector<std::string> shapes = {"grid", "ramp", "tunnel"};
+	std::vector<size_t> sizes = {1000, 10000, 100000};
+	std::filesystem::path workDir = std::filesystem::temp_directory_path() / "cte_benchmark";
+	std::filesystem::path jsonPath;
+	size_t quadraticLimit = 10000;
+	int threadCount = 0;
+	for (size_t i = 0; i < args.size(); i++)
+	{
+		const std::string& arg = args[i];
+		const bool hasValue = i + 1 < args.size();
+		bool valid = true;
+		try
+		{
+			if (arg == "--shapes" && hasValue) { shapes = SplitList(args[++i]); }
+			else if (arg == "--sizes" && hasValue)
+			{
+				sizes.clear();
+				for (const std::string& size : SplitList(args[++i])) { sizes.push_back(static_cast<size_t>(std::stoul(size))); }
+			}
+			else if (arg == "--out" && hasValue) { workDir = args[++i]; }
+			else if (arg == "--json" && hasValue) { jsonPath = args[++i]; }
+			else if (arg == "--threads" && hasValue) { threadCount = std::stoi(args[++i]); valid = threadCount > 0; }
+			else if (arg == "--quadratic-limit" && hasValue) { quadraticLimit = static_cast<size_t>(std::stoul(args[++i])); }
+			else { valid = false; }
+		}
+		catch (const std::exception&) { valid = false; }
+
+		if (!valid) { printf("Invalid argument: %s\n\n", arg.c_str()); PrintUsage(); return 1; }
+	}
+	for (const std::string& shape : shapes)
+	{
+		if (shape != "grid" && shape != "ramp" && shape != "tunnel") { printf("Unknown shape: %s\n", shape.c_str()); return 1; }
+	}
+	for (size_t size : sizes)
+	{
+		if (size == 0) { printf("Invalid size: %zu\n", size); return 1; }
+	}
+	if (threadCount > 0) { omp_set_num_threads(threadCount); }
+
+	std::error_code error;
+	std::filesystem::create_directories(workDir, error);
+	std::vector<std::filesystem::path> texturePaths;
+	for (size_t i = 0; i < BENCHMARK_MATERIAL_COUNT; i++)
+	{
+		texturePaths.push_back(workDir / ("bench_tex" + std::to_string(i) + ".ppm"));
+		if (!WriteBenchmarkTexture(texturePaths.back(), i)) { printf("Could not write to %s\n", workDir.string().c_str()); return 1; }
+	}
+
+	using Clock = std::chrono::steady_clock;
+	constexpr double MEGABYTE = 1024.0 * 1024.0;
+	nlohmann::json json = nlohmann::json::array();
+	bool failed = false;
+	printf("%-8s %8s %-10s %12s %14s %14s\n", "shape", "quads", "stage", "ms", "quads/sec", "stage peak MB");
+	for (const std::string& shape : shapes)
+	{
+		for (size_t size : sizes)
+		{
+			// Level has no constructor, Clear is what puts the generation parameters at their defaults
+			Level level;
+			level.Clear(true);
+			level.m_name = shape + "_" + std::to_string(size);
+			nlohmann::json stages = nlohmann::json::array();
+			// excludedTimer names a profiler timer nested in the stage whose time is already reported by another stage
+			auto RunStage = [&](const char* stage, bool skip, const std::function<bool()>& run, const char* excludedTimer = nullptr)
+				{
+					if (skip)
+					{
+						printf("%-8s %8zu %-10s %12s\n", shape.c_str(), size, stage, "skipped");
+						stages.push_back({{"stage", stage}, {"skipped", true}});
+						return;
+					}
+					double lastExcludedMs = 0.0;
+					const size_t excludedCalls = excludedTimer ? GetProfilerTimerCalls(excludedTimer, lastExcludedMs) : 0;
+					StageMemorySampler memorySampler;
+					const Clock::time_point start = Clock::now();
+					const bool success = run();
+					double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+					const size_t peakMemory = memorySampler.Stop();
+					double excludedMs = 0.0;
+					if (excludedTimer && GetProfilerTimerCalls(excludedTimer, lastExcludedMs) > excludedCalls) { excludedMs = lastExcludedMs; }
+					ms = std::max(0.0, ms - excludedMs);
+					const double quadsPerSecond = ms > 0.0 ? static_cast<double>(size) / (ms / 1000.0) : 0.0;
+					printf("%-8s %8zu %-10s %12.2f %14.0f %14.1f%s\n", shape.c_str(), size, stage, ms, quadsPerSecond, static_cast<double>(peakMemory) / MEGABYTE, success ? "" : "  FAILED");
+					nlohmann::json result = {{"stage", stage}, {"ms", ms}, {"quadsPerSecond", quadsPerSecond}, {"stagePeakMemory", peakMemory}, {"success", success}};
+					if (excludedTimer) { result["excludedMs"] = excludedMs; }
+					stages.push_back(result);
+					if (!success) { failed = true; }
+				};
+
+			std::vector<size_t> pathStart;
+			std::vector<size_t> pathEnd;
+			RunStage("generate", false, [&]()
+				{
+					GenerateShape(level.m_quadblocks, shape, size, pathStart, pathEnd);
+
+					for (size_t i = 0; i < BENCHMARK_MATERIAL_COUNT; i++)
+					{
+						level.m_materialToTexture["bench_mat" + std::to_string(i)] = Texture(texturePaths[i]);
+					}
+					for (size_t i = 0; i < level.m_quadblocks.size(); i++)
+					{
+						Quadblock& quadblock = level.m_quadblocks[i];
+						quadblock.SetTexPath(level.m_materialToTexture[quadblock.GetMaterial()].GetPath());
+						level.m_materialToQuadblocks[quadblock.GetMaterial()].push_back(i);
+					}
+					return level.m_quadblocks.size() == size;
+				});
+
+			RunStage("bsp", false, [&]()
+				{
+					std::vector<size_t> quadIndexes(level.m_quadblocks.size());
+					for (size_t i = 0; i < quadIndexes.size(); i++) { quadIndexes[i] = i; }
+					level.m_bsp.Clear();
+					level.m_bsp.SetQuadblockIndexes(quadIndexes);
+					level.m_bsp.Generate(level.m_quadblocks, level.m_maxQuadPerLeaf, level.m_maxLeafAxisLength, level.m_bspBuilder);
+					return level.m_bsp.IsValid();
+				});
+
+			// Both the vis bake and the path generation compare every leaf/quadblock against the others
+			const bool skipQuadratic = size > quadraticLimit || !level.m_bsp.IsValid();
+			RunStage("vis", skipQuadratic, [&]()
+				{
+					VisTreeSettings settings = level.GetVisTreeSettings();
+					settings.threadCount = threadCount;
+					level.m_bspVis = GenerateVisTree(level.m_quadblocks, level.m_bsp, settings);
+					level.m_bspVisInfluence = ComputeVisLeafInfluence(level.m_quadblocks, level.m_bsp);
+					level.m_genVisTree = !level.m_bspVis.IsEmpty();
+					return level.m_genVisTree;
+				});
+
+			RunStage("path", skipQuadratic, [&]()
+				{
+					Path path;
+					path.GetStartIndexes() = pathStart;
+					path.GetEndIndexes() = pathEnd;
+					if (!path.IsReady()) { return false; }
+					level.m_checkpoints = path.GeneratePath(0, level.m_quadblocks);
+					return !level.m_checkpoints.empty();
+				});
+
+			RunStage("vrm", false, [&]()
+				{
+					std::vector<Texture*> textures;
+					for (auto& [material, texture] : level.m_materialToTexture) { textures.push_back(&texture); }
+					level.m_vrm = PackVRM(textures);
+					return !level.m_vrm.empty();
+				});
+
+			const std::filesystem::path levPath = workDir / (level.m_name + ".lev");
+			// SaveLEV packs the VRM again, which the vrm stage already timed
+			RunStage("save", !level.m_bsp.IsValid(), [&]() { return level.SaveLEV(workDir); }, "UpdateVRM");
+
+			RunStage("load", !std::filesystem::exists(levPath), [&]()
+				{
+					Level loaded;
+					return loaded.Load(levPath) && loaded.m_quadblocks.size() == size;
+				});
+
+			json.push_back({{"shape", shape}, {"quadblocks", size}, {"stages", stages}});
+		}
+	}
+
+	if (!jsonPath.empty())
+	{
+		std::ofstream jsonFile(jsonPath);
+		jsonFile << json.dump(2) << std::endl;
+	}
+	return failed ? 1 : 0;
+}
+
+/*
+	Raises a quadblock in the middle of the track, then checks that the incremental update
+	of a symmetric bake gives the same matrix as a full symmetric rebake.
+*/
+static bool CheckVisTreeUpdate(std::vector<Quadblock> quadblocks, BSP bsp, const VisTreeSettings& settings)
+{
+	BitMatrix visMatrix = GenerateVisTree(quadblocks, bsp, settings);
+	std::vector<BoundingBox> leafInfluence = ComputeVisLeafInfluence(quadblocks, bsp);
+
+	const size_t edited = quadblocks.size() / 2;
+	quadblocks[edited].Translate(SELFTEST_VIS_RAISE, Vec3(0.0f, 1.0f, 0.0f));
+	bsp.RefitBoundingBoxes(quadblocks);
+	std::vector<size_t> changedLeaves;
+	const std::vector<uint32_t>& leaves = bsp.GetLeaves();
+	for (size_t i = 0; i < leaves.size(); i++)
+	{
+		for (size_t index : bsp.GetQuadblockIndexes(leaves[i]))
+		{
+			if (index == edited) { changedLeaves.push_back(i); break; }
+		}
+	}
+	if (!UpdateVisTree(visMatrix, quadblocks, bsp, changedLeaves, leafInfluence, settings)) { return false; }
+
+	const BitMatrix rebake = GenerateVisTree(quadblocks, bsp, settings);
+	if (rebake.GetWidth() != visMatrix.GetWidth() || rebake.GetHeight() != visMatrix.GetHeight()) { return false; }
+	for (size_t i = 0; i < rebake.GetWidth(); i++)
+	{
+		if (std::memcmp(rebake.GetRow(i), visMatrix.GetRow(i), rebake.GetRowWords() * sizeof(uint64_t)) != 0)
+		{
+			printf("Vis check: leaf %zu differs between the incremental update and the full rebake.\n", i);
+			return false;
+		}
+	}
+	return true;
+}
+
+int CLI::SelfTest(const std::vector<std::string>& args)
+{
+	int threadCount = 0;
+	for (size_t i = 0; i < args.size(); i++)
+	{
+		bool valid = args[i] == "--threads" && i + 1 < args.size();
+		if (valid)
+		{
+			try { threadCount = std::stoi(args[++i]); valid = threadCount > 0; }
+			catch (const std::exception&) { valid = false; }
+		}
+		if (!valid) { printf("Invalid argument: %s\n\n", args[i].c_str()); PrintUsage(); return 1; }
+	}
+	if (threadCount > 0) { omp_set_num_threads(threadCount); }
+
+	bool failed = false;
+	for (const std::string shape : {"grid", "ramp", "tunnel"})
+	{
+		Level level;
+		level.Clear(true);
+		std::vector<size_t> pathStart;
+		std::vector<size_t> pathEnd;
+		GenerateShape(level.m_quadblocks, shape, SELFTEST_SIZE, pathStart, pathEnd);
+		std::vector<size_t> quadIndexes(level.m_quadblocks.size());
+		for (size_t i = 0; i < quadIndexes.size(); i++) { quadIndexes[i] = i; }
+		level.m_bsp.SetQuadblockIndexes(quadIndexes);
+		level.m_bsp.Generate(level.m_quadblocks, level.m_maxQuadPerLeaf, level.m_maxLeafAxisLength, level.m_bspBuilder);
+
+		VisTreeSettings settings = level.GetVisTreeSettings();
+		settings.threadCount = threadCount;
+		settings.symmetric = true;
+		const bool success = level.m_bsp.IsValid() && CheckVisTreeUpdate(level.m_quadblocks, level.m_bsp, settings);
+		printf("%-8s %8zu %-10s %s\n", shape.c_str(), SELFTEST_SIZE, "vis-update", success ? "ok" : "FAILED");
+		if (!success) { failed = true; }
+	}
+	return failed ? 1 : 0;
+}
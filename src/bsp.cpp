@@ -1,164 +1,69 @@
 #include "bsp.h"
+#include "profiler.h"
 #include "psx_types.h"
 
 #include <cstring>
+#include <algorithm>
+#include <bit>
+#include <future>
+#include <omp.h>
 
-static size_t g_id = 0;
+static_assert(sizeof(PSX::BSPBranch) == sizeof(PSX::BSPLeaf));
 
-BSP::BSP()
-{
-	m_parent = nullptr;
-	m_id = g_id++;
-	m_node = BSPNode::BRANCH;
-	m_axis = AxisSplit::NONE;
-	m_flags = BSPFlags::NONE;
-	m_left = nullptr;
-	m_right = nullptr;
-	m_bbox = BoundingBox();
-	m_quadblockIndexes = std::vector<size_t>();
-}
-
-BSP::BSP(BSPNode type, const std::vector<size_t>& quadblockIndexes, BSP* parent, const std::vector<Quadblock>& quadblocks)
-{
-	bool isLeaf = type == BSPNode::LEAF;
-	m_parent = parent;
-	m_id = g_id++;
-	m_node = type;
-	m_axis = AxisSplit::NONE;
-	m_flags = isLeaf ? BSPFlags::LEAF : BSPFlags::NONE;
-	m_left = nullptr;
-	m_right = nullptr;
-	m_bbox = BoundingBox();
-	m_quadblockIndexes = quadblockIndexes;
-	if (isLeaf)
-	{
-		for (size_t index : m_quadblockIndexes) { quadblocks[index].SetBSPID(m_id); }
-	}
-}
-
-void BSP::PopulateBranch(PSX::BSPBranch& branch, std::vector<BSP*>& bspArray, size_t global_id)
-{
-	g_id = global_id;
-	m_id = branch.id;
-	m_node = BSPNode::BRANCH;
-	if (branch.axis.x != 0) { m_axis = AxisSplit::X; }
-	else if (branch.axis.y != 0) { m_axis = AxisSplit::Y; }
-	else if (branch.axis.z != 0) { m_axis = AxisSplit::Z; }
-	else { m_axis = AxisSplit::NONE; }
-	m_flags = branch.flag;
-	if (branch.leftChild != BSPID::EMPTY)
-	{
-		uint16_t leftId = branch.leftChild & ~BSPID::LEAF;
-		if (leftId < bspArray.size())
-		{
-			m_left = bspArray[leftId];
-			m_left->SetParent(this);
-		}
-	}
-	if (branch.rightChild != BSPID::EMPTY)
-	{
-		uint16_t rightId = branch.rightChild & ~BSPID::LEAF;
-		if (rightId < bspArray.size())
-		{
-			m_right = bspArray[rightId];
-			m_right->SetParent(this);
-		}
-	}
-	m_bbox = BoundingBox();
-	m_bbox.min = ConvertPSXVec3(branch.bbox.min, FP_ONE_GEO);
-	m_bbox.max = ConvertPSXVec3(branch.bbox.max, FP_ONE_GEO);
-	m_quadblockIndexes = std::vector<size_t>(); // Need to be set later
-}
-
-void BSP::PopulateLeaf(PSX::BSPLeaf& leaf, std::vector<BSP*>& bspArray, const std::vector<Quadblock>& quadblocks, uint32_t offQuadblocks, size_t global_id)
-{
-	g_id = global_id; 
-	m_id = leaf.id;
-	m_node = BSPNode::LEAF;
-	m_axis = AxisSplit::NONE;
-	m_flags = leaf.flag;
-	m_left = nullptr; 
-	m_right = nullptr; 
-	m_bbox = BoundingBox();
-	m_bbox.min = ConvertPSXVec3(leaf.bbox.min, FP_ONE_GEO);
-	m_bbox.max = ConvertPSXVec3(leaf.bbox.max, FP_ONE_GEO);
-	m_quadblockIndexes = std::vector<size_t>();
-	for (size_t i = 0; i < leaf.numQuads; i++)
-	{
-		uint32_t relative_offset = leaf.offQuads - offQuadblocks;
-		m_quadblockIndexes.push_back(i + relative_offset/sizeof(PSX::Quadblock));
-	}
-	for (size_t i : m_quadblockIndexes)
-	{
-		if (i < quadblocks.size()) { quadblocks[i].SetBSPID(m_id); }
-	}
-}
-
-
-void BSP::PopulateBranchQuadIndexes()
+bool BSPTreeNode::IsBranch() const
 {
-	if (m_node == BSPNode::BRANCH)
-	{
-		m_quadblockIndexes.clear();
-		if (m_left != nullptr)
-		{
-			m_left->PopulateBranchQuadIndexes();
-			const std::vector<size_t>& leftIndexes = m_left->GetQuadblockIndexes();
-			m_quadblockIndexes.insert(m_quadblockIndexes.end(), leftIndexes.begin(), leftIndexes.end());
-		}
-		if (m_right != nullptr)
-		{
-			m_right->PopulateBranchQuadIndexes();
-			const std::vector<size_t>& rightIndexes = m_right->GetQuadblockIndexes();
-			m_quadblockIndexes.insert(m_quadblockIndexes.end(), rightIndexes.begin(), rightIndexes.end());
-		}
-	}
+	return type == BSPNode::BRANCH;
 }
 
-size_t BSP::GetId() const
+BSP::BSP()
 {
-	return m_id;
 }
 
 bool BSP::IsEmpty() const
 {
-	return m_quadblockIndexes.empty();
+	return m_nodes.empty();
 }
 
 bool BSP::IsValid() const
 {
-	for (const BSP* bsp : GetTree())
+	if (m_nodes.empty()) { return false; }
+	for (const BSPTreeNode& node : m_nodes)
 	{
-		if (bsp->m_node == BSPNode::BRANCH) { if (!bsp->m_right && !bsp->m_left) { return false; } }
-		else if (bsp->IsEmpty()) { return false; }
+		if (node.IsBranch()) { if (node.left == BSP_NODE_NONE && node.right == BSP_NODE_NONE) { return false; } }
+		else if (node.quadCount == 0) { return false; }
 	}
 	return true;
 }
 
-bool BSP::IsBranch() const
+size_t BSP::GetNodeCount() const
+{
+	return m_nodes.size();
+}
+
+const BSPTreeNode& BSP::GetNode(uint32_t id) const
 {
-	return m_node == BSPNode::BRANCH;
+	return m_nodes[id];
 }
 
-uint16_t BSP::GetFlags() const
+const std::vector<BSPTreeNode>& BSP::GetNodes() const
 {
-	return m_flags;
+	return m_nodes;
 }
 
-const std::string& BSP::GetType() const
+const std::string& BSP::GetType(uint32_t id) const
 {
 	const static std::string sBranch = "Branch";
 	const static std::string sLeaf = "Leaf";
-	return m_node == BSPNode::BRANCH ? sBranch : sLeaf;
+	return m_nodes[id].IsBranch() ? sBranch : sLeaf;
 }
 
-const std::string& BSP::GetAxis() const
+const std::string& BSP::GetAxis(uint32_t id) const
 {
 	static std::string sX = "X";
 	static std::string sY = "Y";
 	static std::string sZ = "Z";
 	static std::string sNone = "None";
-	switch (m_axis)
+	switch (m_nodes[id].axis)
 	{
 	case AxisSplit::X: return sX;
 	case AxisSplit::Y: return sY;
@@ -169,261 +74,609 @@ const std::string& BSP::GetAxis() const
 
 const BoundingBox& BSP::GetBoundingBox() const
 {
-	return m_bbox;
+	static const BoundingBox sEmpty = BoundingBox();
+	return m_nodes.empty() ? sEmpty : m_nodes.front().bbox;
 }
 
-const std::vector<size_t>& BSP::GetQuadblockIndexes() const
+std::span<const size_t> BSP::GetQuadblockIndexes(uint32_t id) const
 {
-	return m_quadblockIndexes;
+	const BSPTreeNode& node = m_nodes[id];
+	return std::span<const size_t>(m_quadblockIndexes.data() + node.firstQuad, node.quadCount);
 }
 
-const BSP* BSP::GetLeftChildren() const
+const std::vector<uint32_t>& BSP::GetLeaves() const
 {
-	return m_left;
+	return m_leaves;
 }
 
-const BSP* BSP::GetRightChildren() const
+void BSP::SetQuadblockIndexes(const std::vector<size_t>& quadblockIndexes)
 {
-	return m_right;
+	m_quadblockIndexes = quadblockIndexes;
 }
 
-const BSP* BSP::GetParent() const
+void BSP::Clear()
 {
-	return m_parent;
+	m_nodes.clear();
+	m_quadblockIndexes.clear();
+	m_leaves.clear();
 }
 
-const std::vector<const BSP*> BSP::GetTree() const
+/*
+	Every node works on a range of one shared index array, which gets partitioned in place
+	(stable, so the result matches a serial build). Nodes are appended in preorder; big subtrees
+	are built on their own thread into a separate pool, and spliced back in preorder once done.
+	Each path down the tree may only fork log2(thread count) times, which keeps the number of
+	threads running at once around the OpenMP thread count.
+*/
+static constexpr size_t BSP_PARALLEL_THRESHOLD = 1024;
+
+struct BSPPrimitive
+{
+	BoundingBox bbox;
+	Vec3 center;
+};
+
+static float GetAxisValue(const Vec3& v, int axis)
 {
-	size_t i = 0;
-	std::vector<const BSP*> bspNodes = {this};
-	while (i < bspNodes.size())
+	return axis == 0 ? v.x : axis == 1 ? v.y : v.z;
+}
+
+struct BSPBuildContext
+{
+	const std::vector<Quadblock>& quadblocks;
+	std::vector<BSPPrimitive> primitives;
+	std::vector<size_t> indexes;
+	BSPBuilder builder;
+	size_t maxQuadsPerLeaf;
+	float maxAxisLength;
+};
+
+// Same score as before: sum of the semi perimeters of both sides, with the X, Z, Y priority on ties
+static bool SplitMidpoint(BSPBuildContext& context, BSPTreeNode& node, size_t begin, size_t end, size_t& middle)
+{
+	struct Side
+	{
+		Vec3 min = Vec3(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+		Vec3 max = Vec3(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
+		size_t count = 0;
+	};
+
+	const Vec3 midpoint = node.bbox.Midpoint();
+	Side left[3], right[3];
+	for (size_t i = begin; i < end; i++)
 	{
-		const BSP* currNode = bspNodes[i++];
-		const BSP* leftNode = currNode->m_left;
-		if (leftNode) { bspNodes.push_back(leftNode); }
-		const BSP* rightNode = currNode->m_right;
-		if (rightNode) { bspNodes.push_back(rightNode); }
+		const BSPPrimitive& primitive = context.primitives[context.indexes[i]];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			Side& side = GetAxisValue(primitive.center, axis) < GetAxisValue(midpoint, axis) ? right[axis] : left[axis];
+			side.min.x = std::min(side.min.x, primitive.bbox.min.x); side.max.x = std::max(side.max.x, primitive.bbox.max.x);
+			side.min.y = std::min(side.min.y, primitive.bbox.min.y); side.max.y = std::max(side.max.y, primitive.bbox.max.y);
+			side.min.z = std::min(side.min.z, primitive.bbox.min.z); side.max.z = std::max(side.max.z, primitive.bbox.max.z);
+			side.count++;
+		}
 	}
-	return bspNodes;
+
+	float scores[3];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (left[axis].count == 0 || right[axis].count == 0) { scores[axis] = std::numeric_limits<float>::max(); continue; }
+		float perimeterLeft = BoundingBox{left[axis].min, left[axis].max}.SemiPerimeter();
+		float perimeterRight = BoundingBox{right[axis].min, right[axis].max}.SemiPerimeter();
+		scores[axis] = perimeterLeft + perimeterRight;
+	}
+	float bestScore = std::min(std::min(scores[0], scores[1]), scores[2]);
+	if (bestScore == std::numeric_limits<float>::max()) { return false; }
+
+	int bestAxis = bestScore == scores[0] ? 0 : bestScore == scores[2] ? 2 : 1;
+	node.axis = bestAxis == 0 ? AxisSplit::X : bestAxis == 1 ? AxisSplit::Y : AxisSplit::Z;
+	node.split = GetAxisValue(midpoint, bestAxis);
+	const float split = node.split;
+	middle = std::stable_partition(context.indexes.begin() + begin, context.indexes.begin() + end,
+		[&context, bestAxis, split](size_t index) { return !(GetAxisValue(context.primitives[index].center, bestAxis) < split); }) - context.indexes.begin();
+	return true;
 }
 
-std::vector<const BSP*> BSP::GetLeaves() const
+/*
+	Surface area heuristic over SAH_BIN_COUNT bins of the quad centers, on every axis.
+	Quads below the chosen plane go to the right child, like the midpoint split.
+*/
+static constexpr size_t SAH_BIN_COUNT = 32;
+
+struct SAHBin
 {
-	std::vector<const BSP*> ret;
-	const std::vector<const BSP*> tree = GetTree();
-	for (const BSP* bsp : tree)
+	Vec3 min = Vec3(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+	Vec3 max = Vec3(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
+	size_t count = 0;
+
+	void Grow(const Vec3& pmin, const Vec3& pmax)
 	{
-		if (bsp->IsBranch()) { continue; }
-		ret.push_back(bsp);
+		min.x = std::min(min.x, pmin.x); max.x = std::max(max.x, pmax.x);
+		min.y = std::min(min.y, pmin.y); max.y = std::max(max.y, pmax.y);
+		min.z = std::min(min.z, pmin.z); max.z = std::max(max.z, pmax.z);
 	}
-	return ret;
-}
 
-void BSP::SetQuadblockIndexes(const std::vector<size_t>& quadblockIndexes)
+	float HalfArea() const
+	{
+		if (count == 0) { return 0.0f; }
+		Vec3 dist = max - min;
+		return (dist.x * dist.y) + (dist.y * dist.z) + (dist.z * dist.x);
+	}
+};
+
+static size_t GetSAHBin(float value, float min, float scale)
 {
-	m_quadblockIndexes = quadblockIndexes;
+	return std::min(static_cast<size_t>((value - min) * scale), SAH_BIN_COUNT - 1);
 }
 
-void BSP::SetParent(BSP* parent)
+static bool SplitSAH(BSPBuildContext& context, BSPTreeNode& node, size_t begin, size_t end, size_t& middle)
 {
-	m_parent = parent;
+	Vec3 centerMin = Vec3(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+	Vec3 centerMax = Vec3(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
+	for (size_t i = begin; i < end; i++)
+	{
+		const Vec3& center = context.primitives[context.indexes[i]].center;
+		centerMin.x = std::min(centerMin.x, center.x); centerMax.x = std::max(centerMax.x, center.x);
+		centerMin.y = std::min(centerMin.y, center.y); centerMax.y = std::max(centerMax.y, center.y);
+		centerMin.z = std::min(centerMin.z, center.z); centerMax.z = std::max(centerMax.z, center.z);
+	}
+
+	SAHBin bins[3][SAH_BIN_COUNT];
+	float scales[3] = {};
+	for (int i = 0; i < 3; i++)
+	{
+		const float extent = GetAxisValue(centerMax, i) - GetAxisValue(centerMin, i);
+		scales[i] = extent > 0.0f ? static_cast<float>(SAH_BIN_COUNT) / extent : 0.0f;
+	}
+	for (size_t index = begin; index < end; index++)
+	{
+		const BSPPrimitive& primitive = context.primitives[context.indexes[index]];
+		for (int i = 0; i < 3; i++)
+		{
+			if (scales[i] == 0.0f) { continue; }
+			SAHBin& bin = bins[i][GetSAHBin(GetAxisValue(primitive.center, i), GetAxisValue(centerMin, i), scales[i])];
+			bin.Grow(primitive.bbox.min, primitive.bbox.max);
+			bin.count++;
+		}
+	}
+
+	const size_t count = end - begin;
+	int bestAxis = -1;
+	size_t bestPlane = 0;
+	float bestCost = std::numeric_limits<float>::max();
+	for (int i = 0; i < 3; i++)
+	{
+		if (scales[i] == 0.0f) { continue; }
+		// belowCost[p] holds the cost of bins [0, p)
+		float belowCost[SAH_BIN_COUNT] = {};
+		SAHBin below;
+		for (size_t p = 1; p < SAH_BIN_COUNT; p++)
+		{
+			const SAHBin& bin = bins[i][p - 1];
+			if (bin.count > 0) { below.Grow(bin.min, bin.max); }
+			below.count += bin.count;
+			belowCost[p] = below.HalfArea() * static_cast<float>(below.count);
+		}
+		SAHBin above;
+		for (size_t p = SAH_BIN_COUNT - 1; p > 0; p--)
+		{
+			const SAHBin& bin = bins[i][p];
+			if (bin.count > 0) { above.Grow(bin.min, bin.max); }
+			above.count += bin.count;
+			if (above.count == 0 || above.count == count) { continue; }
+			const float cost = belowCost[p] + (above.HalfArea() * static_cast<float>(above.count));
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = i;
+				bestPlane = p;
+			}
+		}
+	}
+	if (bestAxis == -1) { return false; }
+
+	const float min = GetAxisValue(centerMin, bestAxis);
+	const float scale = scales[bestAxis];
+	middle = std::stable_partition(context.indexes.begin() + begin, context.indexes.begin() + end,
+		[&context, bestAxis, min, scale, bestPlane](size_t index) { return GetSAHBin(GetAxisValue(context.primitives[index].center, bestAxis), min, scale) >= bestPlane; }) - context.indexes.begin();
+	node.axis = bestAxis == 0 ? AxisSplit::X : bestAxis == 1 ? AxisSplit::Y : AxisSplit::Z;
+	node.split = min + (static_cast<float>(bestPlane) / scale);
+	return true;
 }
 
-void BSP::Clear()
+static uint32_t BuildSubtree(BSPBuildContext& context, std::vector<BSPTreeNode>& nodes, uint32_t parent, BSPNode type, size_t begin, size_t end, size_t forksLeft);
+
+static uint32_t AppendSubtree(std::vector<BSPTreeNode>& nodes, const std::vector<BSPTreeNode>& subtree, uint32_t parent)
 {
-	std::vector<BSP*> vBSP = {this};
-	size_t currIndex = 0;
-	while (currIndex < vBSP.size())
+	const uint32_t offset = static_cast<uint32_t>(nodes.size());
+	for (BSPTreeNode node : subtree)
 	{
-		BSP* pBSP = vBSP[currIndex++];
-		if (pBSP->m_right) { vBSP.push_back(pBSP->m_right); }
-		if (pBSP->m_left) { vBSP.push_back(pBSP->m_left); }
+		node.parent = node.parent == BSP_NODE_NONE ? parent : node.parent + offset;
+		if (node.left != BSP_NODE_NONE) { node.left += offset; }
+		if (node.right != BSP_NODE_NONE) { node.right += offset; }
+		nodes.push_back(node);
 	}
-	for (size_t i = 1; i < vBSP.size(); i++) { delete vBSP[i]; }
-	m_right = nullptr;
-	m_left = nullptr;
-	m_axis = AxisSplit::NONE;
-	m_flags = BSPFlags::NONE;
-	m_quadblockIndexes.clear();
-	g_id = 1;
+	return offset;
 }
 
-void BSP::Generate(const std::vector<Quadblock>& quadblocks, const size_t maxQuadsPerLeaf, const float maxAxisLength)
+static void BuildOffspring(BSPBuildContext& context, std::vector<BSPTreeNode>& nodes, uint32_t index, size_t begin, size_t middle, size_t end, size_t forksLeft)
 {
-	m_bbox = ComputeBoundingBox(quadblocks, m_quadblockIndexes);
+	const size_t leftCount = middle - begin;
+	const size_t rightCount = end - middle;
+	const BSPNode leftType = leftCount <= context.maxQuadsPerLeaf ? BSPNode::LEAF : BSPNode::BRANCH;
+	const BSPNode rightType = rightCount <= context.maxQuadsPerLeaf ? BSPNode::LEAF : BSPNode::BRANCH;
 
-	bool isLeaf = !IsBranch();
-	if (isLeaf)
+	if (forksLeft > 0 && leftCount > 0 && rightCount > 0 && end - begin >= BSP_PARALLEL_THRESHOLD)
+	{
+		std::vector<BSPTreeNode> leftNodes;
+		std::future<void> leftTask = std::async(std::launch::async, [&context, &leftNodes, leftType, begin, middle, forksLeft]() { BuildSubtree(context, leftNodes, BSP_NODE_NONE, leftType, begin, middle, forksLeft - 1); });
+		std::vector<BSPTreeNode> rightNodes;
+		BuildSubtree(context, rightNodes, BSP_NODE_NONE, rightType, middle, end, forksLeft - 1);
+		leftTask.get();
+		nodes.reserve(nodes.size() + leftNodes.size() + rightNodes.size());
+		const uint32_t left = AppendSubtree(nodes, leftNodes, index);
+		const uint32_t right = AppendSubtree(nodes, rightNodes, index);
+		nodes[index].left = left;
+		nodes[index].right = right;
+		return;
+	}
+	if (leftCount > 0)
 	{
-		if (m_bbox.AxisLength() < maxAxisLength || m_quadblockIndexes.size() == 1) { return; }
-		m_node = BSPNode::BRANCH;
-		m_flags &= ~BSPFlags::LEAF;
+		const uint32_t left = BuildSubtree(context, nodes, index, leftType, begin, middle, forksLeft);
+		nodes[index].left = left;
 	}
+	if (rightCount > 0)
+	{
+		const uint32_t right = BuildSubtree(context, nodes, index, rightType, middle, end, forksLeft);
+		nodes[index].right = right;
+	}
+}
+
+static uint32_t BuildSubtree(BSPBuildContext& context, std::vector<BSPTreeNode>& nodes, uint32_t parent, BSPNode type, size_t begin, size_t end, size_t forksLeft)
+{
+	const size_t count = end - begin;
+	BSPTreeNode node = {};
+	node.parent = parent;
+	node.left = BSP_NODE_NONE;
+	node.right = BSP_NODE_NONE;
+	node.firstQuad = static_cast<uint32_t>(begin);
+	node.quadCount = static_cast<uint32_t>(count);
+	node.split = 0.0f;
+	node.flags = type == BSPNode::LEAF ? BSPFlags::LEAF : BSPFlags::NONE;
+	node.type = type;
+	node.axis = AxisSplit::NONE;
 
-	if (m_quadblockIndexes.size() == 1)
+	Vec3 min = Vec3(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+	Vec3 max = Vec3(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
+	for (size_t i = begin; i < end; i++)
 	{
-		std::vector<size_t> empty = {};
-		GenerateOffspring(m_quadblockIndexes, empty, quadblocks, maxQuadsPerLeaf, maxAxisLength);
-		return;
+		const BoundingBox& quadBbox = context.primitives[context.indexes[i]].bbox;
+		min.x = std::min(min.x, quadBbox.min.x); max.x = std::max(max.x, quadBbox.max.x);
+		min.y = std::min(min.y, quadBbox.min.y); max.y = std::max(max.y, quadBbox.max.y);
+		min.z = std::min(min.z, quadBbox.min.z); max.z = std::max(max.z, quadBbox.max.z);
 	}
+	node.bbox = count == 0 ? BoundingBox() : BoundingBox{min, max};
 
-	std::vector<size_t> x_right, x_left, y_right, y_left, z_right, z_left;
-	float x_score = Split(x_left, x_right, AxisSplit::X, quadblocks);
-	float y_score = Split(y_left, y_right, AxisSplit::Y, quadblocks);
-	float z_score = Split(z_left, z_right, AxisSplit::Z, quadblocks);
-	float bestScore = std::min(std::min(x_score, y_score), z_score);
-	if (bestScore == std::numeric_limits<float>::max())
+	const uint32_t index = static_cast<uint32_t>(nodes.size());
+	const bool isLeaf = type == BSPNode::LEAF;
+	if (isLeaf)
 	{
-		if (isLeaf)
+		if (node.bbox.AxisLength() < context.maxAxisLength || count == 1)
 		{
-			m_node = BSPNode::LEAF;
-			m_flags |= BSPFlags::LEAF;
+			nodes.push_back(node);
+			return index;
 		}
-		return;
+		node.type = BSPNode::BRANCH;
+		node.flags &= ~BSPFlags::LEAF;
 	}
-	if (bestScore == x_score)
-	{
-		m_axis = AxisSplit::X;
-		GenerateOffspring(x_left, x_right, quadblocks, maxQuadsPerLeaf, maxAxisLength);
-	}
-	else if (bestScore == z_score)
+
+	size_t middle = end;
+	if (count != 1)
 	{
-		m_axis = AxisSplit::Z;
-		GenerateOffspring(z_left, z_right, quadblocks, maxQuadsPerLeaf, maxAxisLength);
+		bool split = context.builder == BSPBuilder::SAH ? SplitSAH(context, node, begin, end, middle) : SplitMidpoint(context, node, begin, end, middle);
+		if (!split)
+		{
+			if (isLeaf)
+			{
+				node.type = BSPNode::LEAF;
+				node.flags |= BSPFlags::LEAF;
+			}
+			nodes.push_back(node);
+			return index;
+		}
 	}
-	else
+	nodes.push_back(node);
+	BuildOffspring(context, nodes, index, begin, middle, end, forksLeft);
+	return index;
+}
+
+void BSP::Generate(const std::vector<Quadblock>& quadblocks, const size_t maxQuadsPerLeaf, const float maxAxisLength, BSPBuilder builder)
+{
+	ScopedTimer timer("BSP/build");
+	BSPBuildContext context = {quadblocks, std::vector<BSPPrimitive>(quadblocks.size()), std::move(m_quadblockIndexes), builder, maxQuadsPerLeaf, maxAxisLength};
+	for (size_t i = 0; i < quadblocks.size(); i++)
 	{
-		m_axis = AxisSplit::Y;
-		GenerateOffspring(y_left, y_right, quadblocks, maxQuadsPerLeaf, maxAxisLength);
+		context.primitives[i].bbox = quadblocks[i].GetBoundingBox();
+		context.primitives[i].center = quadblocks[i].GetCenter();
 	}
+	m_nodes.clear();
+	const size_t forks = std::bit_width(static_cast<unsigned>(std::max(omp_get_max_threads(), 1) - 1)); // ceil(log2(threads))
+	BuildSubtree(context, m_nodes, BSP_NODE_NONE, BSPNode::BRANCH, 0, context.indexes.size(), forks);
+	m_quadblockIndexes = std::move(context.indexes);
+	Finalize(quadblocks);
 }
 
-std::vector<uint8_t> BSP::Serialize(size_t offQuads) const
+// Caches the leaves in breadth first order, which is the order of the vis matrix, and tags the quadblocks with their leaf
+void BSP::Finalize(const std::vector<Quadblock>& quadblocks)
 {
-	return m_node == BSPNode::BRANCH ? SerializeBranch() : SerializeLeaf(offQuads);
+	m_leaves.clear();
+	if (m_nodes.empty()) { return; }
+
+	std::vector<uint32_t> queue = {0};
+	queue.reserve(m_nodes.size());
+	for (size_t i = 0; i < queue.size(); i++)
+	{
+		const uint32_t id = queue[i];
+		const BSPTreeNode& node = m_nodes[id];
+		if (!node.IsBranch())
+		{
+			m_leaves.push_back(id);
+			for (size_t index : GetQuadblockIndexes(id)) { quadblocks[index].SetBSPID(id); }
+			continue;
+		}
+		if (node.left != BSP_NODE_NONE) { queue.push_back(node.left); }
+		if (node.right != BSP_NODE_NONE) { queue.push_back(node.right); }
+	}
 }
 
-float BSP::GetAxisMidpoint(const AxisSplit axis) const
+bool BSP::LoadPSX(std::span<const uint8_t> psxNodes, const std::vector<Quadblock>& quadblocks, uint32_t offQuadblocks)
 {
-	float midpoint = 0.0f;
-	switch (axis)
+	Clear();
+	std::vector<uint8_t> visited(psxNodes.size() / sizeof(PSX::BSPBranch), 0);
+	if (visited.empty() || !AppendPSXNode(psxNodes, 0, BSP_NODE_NONE, offQuadblocks, quadblocks.size(), visited))
 	{
-	case AxisSplit::X: return m_bbox.Midpoint().x;
-	case AxisSplit::Y: return m_bbox.Midpoint().y;
-	case AxisSplit::Z: return m_bbox.Midpoint().z;
+		Clear();
+		return false;
 	}
-	return midpoint;
+	Finalize(quadblocks);
+	return IsValid();
 }
 
-BoundingBox BSP::ComputeBoundingBox(const std::vector<Quadblock>& quadblocks, const std::vector<size_t>& quadblockIndexes) const
+// The game files may store the nodes in any order, so they're renumbered in preorder while walking the tree
+bool BSP::AppendPSXNode(std::span<const uint8_t> psxNodes, uint16_t psxId, uint32_t parent, uint32_t offQuadblocks, size_t quadblockCount, std::vector<uint8_t>& visited)
 {
-	if (quadblockIndexes.empty()) { return {}; }
+	if (psxId >= visited.size() || visited[psxId]) { return false; }
+	visited[psxId] = 1;
+
+	const uint8_t* data = psxNodes.data() + (static_cast<size_t>(psxId) * sizeof(PSX::BSPBranch));
+	uint16_t flag;
+	std::memcpy(&flag, data, sizeof(flag));
+
+	const uint32_t index = static_cast<uint32_t>(m_nodes.size());
+	BSPTreeNode node = {};
+	node.parent = parent;
+	node.left = BSP_NODE_NONE;
+	node.right = BSP_NODE_NONE;
+	node.firstQuad = static_cast<uint32_t>(m_quadblockIndexes.size());
+	node.flags = flag;
+	node.axis = AxisSplit::NONE;
+	if (flag & BSPFlags::LEAF)
+	{
+		PSX::BSPLeaf leaf = {};
+		std::memcpy(&leaf, data, sizeof(leaf));
+		if (leaf.offQuads < offQuadblocks) { return false; }
+		const size_t firstQuad = (leaf.offQuads - offQuadblocks) / sizeof(PSX::Quadblock);
+		if (firstQuad + leaf.numQuads > quadblockCount) { return false; }
+		for (size_t i = 0; i < leaf.numQuads; i++) { m_quadblockIndexes.push_back(firstQuad + i); }
+		node.type = BSPNode::LEAF;
+		node.split = 0.0f;
+		node.quadCount = leaf.numQuads;
+		node.bbox.min = ConvertPSXVec3(leaf.bbox.min, FP_ONE_GEO);
+		node.bbox.max = ConvertPSXVec3(leaf.bbox.max, FP_ONE_GEO);
+		m_nodes.push_back(node);
+		return true;
+	}
 
-	Vec3 min = Vec3(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
-	Vec3 max = Vec3(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
-	for (size_t index : quadblockIndexes)
+	PSX::BSPBranch branch = {};
+	std::memcpy(&branch, data, sizeof(branch));
+	node.type = BSPNode::BRANCH;
+	if (branch.axis.x != 0) { node.axis = AxisSplit::X; }
+	else if (branch.axis.y != 0) { node.axis = AxisSplit::Y; }
+	else if (branch.axis.z != 0) { node.axis = AxisSplit::Z; }
+	node.split = 2.0f * ConvertFP(branch.unk1, FP_ONE_GEO);
+	node.bbox.min = ConvertPSXVec3(branch.bbox.min, FP_ONE_GEO);
+	node.bbox.max = ConvertPSXVec3(branch.bbox.max, FP_ONE_GEO);
+	m_nodes.push_back(node);
+	if (branch.leftChild != BSPID::EMPTY)
 	{
-		const Quadblock& quad = quadblocks[index];
-		const BoundingBox& quadBbox = quad.GetBoundingBox();
-		min.x = std::min(min.x, quadBbox.min.x); max.x = std::max(max.x, quadBbox.max.x);
-		min.y = std::min(min.y, quadBbox.min.y); max.y = std::max(max.y, quadBbox.max.y);
-		min.z = std::min(min.z, quadBbox.min.z); max.z = std::max(max.z, quadBbox.max.z);
+		m_nodes[index].left = static_cast<uint32_t>(m_nodes.size());
+		if (!AppendPSXNode(psxNodes, branch.leftChild & ~BSPID::LEAF, index, offQuadblocks, quadblockCount, visited)) { return false; }
+	}
+	if (branch.rightChild != BSPID::EMPTY)
+	{
+		m_nodes[index].right = static_cast<uint32_t>(m_nodes.size());
+		if (!AppendPSXNode(psxNodes, branch.rightChild & ~BSPID::LEAF, index, offQuadblocks, quadblockCount, visited)) { return false; }
 	}
-	BoundingBox bbox = {min, max};
-	return bbox;
+	m_nodes[index].quadCount = static_cast<uint32_t>(m_quadblockIndexes.size()) - m_nodes[index].firstQuad;
+	return true;
 }
 
-float BSP::Split(std::vector<size_t>& left, std::vector<size_t>& right, const AxisSplit axis, const std::vector<Quadblock>& quadblocks) const
+// Children come after their parent in preorder, so a single backwards pass is enough
+void BSP::RefitBoundingBoxes(const std::vector<Quadblock>& quadblocks)
 {
-	float midpoint = GetAxisMidpoint(axis);
-	for (size_t index : m_quadblockIndexes)
+	for (size_t i = m_nodes.size(); i-- > 0;)
 	{
-		const Quadblock& quad = quadblocks[index];
-		switch (axis)
+		BSPTreeNode& node = m_nodes[i];
+		if (node.quadCount == 0) { node.bbox = BoundingBox(); continue; }
+
+		Vec3 min = Vec3(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+		Vec3 max = Vec3(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
+		auto grow = [&min, &max](const BoundingBox& bbox)
+			{
+				min.x = std::min(min.x, bbox.min.x); max.x = std::max(max.x, bbox.max.x);
+				min.y = std::min(min.y, bbox.min.y); max.y = std::max(max.y, bbox.max.y);
+				min.z = std::min(min.z, bbox.min.z); max.z = std::max(max.z, bbox.max.z);
+			};
+		if (node.IsBranch())
+		{
+			if (node.left != BSP_NODE_NONE) { grow(m_nodes[node.left].bbox); }
+			if (node.right != BSP_NODE_NONE) { grow(m_nodes[node.right].bbox); }
+		}
+		else
 		{
-		case AxisSplit::X:
-			if (quad.GetCenter().x < midpoint) { right.push_back(index); }
-			else { left.push_back(index); }
-			break;
-		case AxisSplit::Y:
-			if (quad.GetCenter().y < midpoint) { right.push_back(index); }
-			else { left.push_back(index); }
-			break;
-		case AxisSplit::Z:
-			if (quad.GetCenter().z < midpoint) { right.push_back(index); }
-			else { left.push_back(index); }
-			break;
+			for (size_t index : GetQuadblockIndexes(static_cast<uint32_t>(i))) { grow(quadblocks[index].GetBoundingBox()); }
 		}
+		node.bbox = {min, max};
 	}
-	if (left.empty() || right.empty()) { return std::numeric_limits<float>::max(); }
-	float perimeterLeft = ComputeBoundingBox(quadblocks, left).SemiPerimeter();
-	float perimeterRight = ComputeBoundingBox(quadblocks, right).SemiPerimeter();
-	return perimeterLeft + perimeterRight;
 }
 
-void BSP::GenerateOffspring(std::vector<size_t>& left, std::vector<size_t>& right, const std::vector<Quadblock>& quadblocks, const size_t maxQuadsPerLeaf, const float maxAxisLength)
+/*
+	Editor side copy of the tree: the node pool followed by the shared quadblock index array.
+	Bounding boxes are rebuilt from the quadblocks when loading.
+*/
+struct BSPLayoutNode
 {
-	if (left.size() <= maxQuadsPerLeaf) { if (!left.empty()) { m_left = new BSP(BSPNode::LEAF, left, this, quadblocks); } }
-	else { m_left = new BSP(BSPNode::BRANCH, left, this, quadblocks); }
-	if (m_left) { m_left->Generate(quadblocks, maxQuadsPerLeaf, maxAxisLength); }
+	uint32_t parent;
+	uint32_t left;
+	uint32_t right;
+	uint32_t firstQuad;
+	uint32_t quadCount;
+	float split;
+	uint16_t flags;
+	uint8_t node;
+	uint8_t axis;
+};
+
+void BSP::SerializeLayout(std::vector<uint8_t>& buffer) const
+{
+	const uint32_t nodeCount = static_cast<uint32_t>(m_nodes.size());
+	const uint32_t indexCount = static_cast<uint32_t>(m_quadblockIndexes.size());
+	size_t offset = buffer.size();
+	buffer.resize(offset + (2 * sizeof(uint32_t)) + (nodeCount * sizeof(BSPLayoutNode)) + (indexCount * sizeof(uint32_t)));
+	std::memcpy(buffer.data() + offset, &nodeCount, sizeof(nodeCount)); offset += sizeof(nodeCount);
+	std::memcpy(buffer.data() + offset, &indexCount, sizeof(indexCount)); offset += sizeof(indexCount);
+	for (const BSPTreeNode& node : m_nodes)
+	{
+		BSPLayoutNode layoutNode = {};
+		layoutNode.parent = node.parent;
+		layoutNode.left = node.left;
+		layoutNode.right = node.right;
+		layoutNode.firstQuad = node.firstQuad;
+		layoutNode.quadCount = node.quadCount;
+		layoutNode.split = node.split;
+		layoutNode.flags = node.flags;
+		layoutNode.node = static_cast<uint8_t>(node.type);
+		layoutNode.axis = static_cast<uint8_t>(node.axis);
+		std::memcpy(buffer.data() + offset, &layoutNode, sizeof(layoutNode));
+		offset += sizeof(layoutNode);
+	}
+	for (size_t index : m_quadblockIndexes)
+	{
+		const uint32_t value = static_cast<uint32_t>(index);
+		std::memcpy(buffer.data() + offset, &value, sizeof(value));
+		offset += sizeof(value);
+	}
+}
+
+bool BSP::DeserializeLayout(const std::vector<uint8_t>& buffer, size_t& offset, const std::vector<Quadblock>& quadblocks)
+{
+	Clear();
+	uint32_t nodeCount, indexCount;
+	if (offset + sizeof(nodeCount) + sizeof(indexCount) > buffer.size()) { return false; }
+	std::memcpy(&nodeCount, buffer.data() + offset, sizeof(nodeCount)); offset += sizeof(nodeCount);
+	std::memcpy(&indexCount, buffer.data() + offset, sizeof(indexCount)); offset += sizeof(indexCount);
+	const size_t size = (static_cast<size_t>(nodeCount) * sizeof(BSPLayoutNode)) + (static_cast<size_t>(indexCount) * sizeof(uint32_t));
+	if (offset + size > buffer.size()) { return false; }
+
+	m_nodes.resize(nodeCount);
+	for (uint32_t i = 0; i < nodeCount; i++)
+	{
+		BSPLayoutNode layoutNode;
+		std::memcpy(&layoutNode, buffer.data() + offset, sizeof(layoutNode));
+		offset += sizeof(layoutNode);
+		// Children always come after their parent, and have to point back at it
+		const bool badParent = i == 0 ? layoutNode.parent != BSP_NODE_NONE : layoutNode.parent >= i;
+		const bool badLeft = layoutNode.left != BSP_NODE_NONE && (layoutNode.left <= i || layoutNode.left >= nodeCount);
+		const bool badRight = layoutNode.right != BSP_NODE_NONE && (layoutNode.right <= i || layoutNode.right >= nodeCount);
+		const bool badRange = static_cast<size_t>(layoutNode.firstQuad) + layoutNode.quadCount > indexCount;
+		const bool badEnum = layoutNode.node > static_cast<uint8_t>(BSPNode::LEAF) || layoutNode.axis > static_cast<uint8_t>(AxisSplit::Z);
+		if (badParent || badLeft || badRight || badRange || badEnum) { Clear(); return false; }
+
+		BSPTreeNode& node = m_nodes[i];
+		node.parent = layoutNode.parent;
+		node.left = layoutNode.left;
+		node.right = layoutNode.right;
+		node.firstQuad = layoutNode.firstQuad;
+		node.quadCount = layoutNode.quadCount;
+		node.split = layoutNode.split;
+		node.flags = layoutNode.flags;
+		node.type = static_cast<BSPNode>(layoutNode.node);
+		node.axis = static_cast<AxisSplit>(layoutNode.axis);
+		if (i > 0 && m_nodes[node.parent].left != i && m_nodes[node.parent].right != i) { Clear(); return false; }
+	}
 
-	if (right.size() <= maxQuadsPerLeaf) { if (!right.empty()) { m_right = new BSP(BSPNode::LEAF, right, this, quadblocks); } }
-	else { m_right = new BSP(BSPNode::BRANCH, right, this, quadblocks); }
-	if (m_right) { m_right->Generate(quadblocks, maxQuadsPerLeaf, maxAxisLength); }
+	m_quadblockIndexes.resize(indexCount);
+	for (uint32_t i = 0; i < indexCount; i++)
+	{
+		uint32_t index;
+		std::memcpy(&index, buffer.data() + offset, sizeof(index));
+		offset += sizeof(index);
+		if (index >= quadblocks.size()) { Clear(); return false; }
+		m_quadblockIndexes[i] = index;
+	}
+	RefitBoundingBoxes(quadblocks);
+	Finalize(quadblocks);
+	return IsValid();
 }
 
-std::vector<uint8_t> BSP::SerializeBranch() const
+void BSP::Serialize(uint32_t id, size_t offQuads, uint8_t* dst) const
+{
+	const BSPTreeNode& node = m_nodes[id];
+	if (node.IsBranch()) { SerializeBranch(node, id, dst); }
+	else { SerializeLeaf(node, id, offQuads, dst); }
+}
+
+void BSP::SerializeBranch(const BSPTreeNode& node, uint32_t id, uint8_t* dst) const
 {
 	PSX::BSPBranch branch = {};
-	std::vector<uint8_t> buffer(sizeof(branch));
-	branch.flag = m_flags;
-	branch.id = static_cast<uint16_t>(m_id);
-	branch.bbox.min = ConvertVec3(m_bbox.min, FP_ONE_GEO);
-	branch.bbox.max = ConvertVec3(m_bbox.max, FP_ONE_GEO);
+	branch.flag = node.flags;
+	branch.id = static_cast<uint16_t>(id);
+	branch.bbox.min = ConvertVec3(node.bbox.min, FP_ONE_GEO);
+	branch.bbox.max = ConvertVec3(node.bbox.max, FP_ONE_GEO);
 	branch.axis = {0, 0, 0};
-	switch (m_axis)
+	switch (node.axis)
 	{
 	case AxisSplit::X: branch.axis.x = 0x1000; break;
 	case AxisSplit::Y: branch.axis.y = 0x1000; break;
 	case AxisSplit::Z: branch.axis.z = 0x1000; break;
 	}
-	if (m_left)
+	if (node.left != BSP_NODE_NONE)
 	{
-		branch.leftChild = static_cast<uint16_t>(m_left->m_id);
-		if (!m_left->IsBranch()) { branch.leftChild |= BSPID::LEAF; }
+		branch.leftChild = static_cast<uint16_t>(node.left);
+		if (!m_nodes[node.left].IsBranch()) { branch.leftChild |= BSPID::LEAF; }
 	}
 	else { branch.leftChild = BSPID::EMPTY; }
-	if (m_right)
+	if (node.right != BSP_NODE_NONE)
 	{
-		branch.rightChild = static_cast<uint16_t>(m_right->m_id);
-		if (!m_right->IsBranch()) { branch.rightChild |= BSPID::LEAF; }
+		branch.rightChild = static_cast<uint16_t>(node.right);
+		if (!m_nodes[node.right].IsBranch()) { branch.rightChild |= BSPID::LEAF; }
 	}
 	else { branch.rightChild = BSPID::EMPTY; }
-	branch.unk1 = 0x00;
-	switch (m_axis)
-	{
-	case AxisSplit::X: branch.unk1 = ConvertFloat((m_bbox.min.x + m_bbox.max.x) / 4, FP_ONE_GEO); break;
-	case AxisSplit::Y: branch.unk1 = ConvertFloat((m_bbox.min.y + m_bbox.max.y) / 4, FP_ONE_GEO); break;
-	case AxisSplit::Z: branch.unk1 = ConvertFloat((m_bbox.min.z + m_bbox.max.z) / 4, FP_ONE_GEO); break;
-	}
+	branch.unk1 = node.axis == AxisSplit::NONE ? 0x00 : ConvertFloat(node.split / 2, FP_ONE_GEO);
 	branch.unk2 = 0;
 	branch.unk3 = 0;
-	std::memcpy(buffer.data(), &branch, sizeof(branch));
-	return buffer;
+	std::memcpy(dst, &branch, sizeof(branch));
 }
 
-std::vector<uint8_t> BSP::SerializeLeaf(size_t offQuads) const
+void BSP::SerializeLeaf(const BSPTreeNode& node, uint32_t id, size_t offQuads, uint8_t* dst) const
 {
 	PSX::BSPLeaf leaf = {};
-	std::vector<uint8_t> buffer(sizeof(leaf));
-	leaf.flag = m_flags;
-	leaf.id = static_cast<uint16_t>(m_id);
-	leaf.bbox.min = ConvertVec3(m_bbox.min, FP_ONE_GEO);
-	leaf.bbox.max = ConvertVec3(m_bbox.max, FP_ONE_GEO);
+	leaf.flag = node.flags;
+	leaf.id = static_cast<uint16_t>(id);
+	leaf.bbox.min = ConvertVec3(node.bbox.min, FP_ONE_GEO);
+	leaf.bbox.max = ConvertVec3(node.bbox.max, FP_ONE_GEO);
 	leaf.offHitbox = 0;
-	leaf.numQuads = static_cast<uint32_t>(m_quadblockIndexes.size());
+	leaf.numQuads = node.quadCount;
 	leaf.offQuads = static_cast<uint32_t>(offQuads);
 	leaf.unk1 = 0;
-	std::memcpy(buffer.data(), &leaf, sizeof(leaf));
-	return buffer;
+	std::memcpy(dst, &leaf, sizeof(leaf));
 }
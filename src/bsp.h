@@ -2,7 +2,11 @@
 
 #include "geo.h"
 #include "quadblock.h"
+#include "psx_types.h"
 
+#include <cstdint>
+#include <limits>
+#include <span>
 #include <vector>
 
 enum class BSPNode
@@ -16,6 +20,11 @@ enum class AxisSplit
 	NONE, X, Y, Z
 };
 
+enum class BSPBuilder
+{
+	MIDPOINT, SAH
+};
+
 struct BSPFlags
 {
 	static constexpr uint16_t NONE = 0;
@@ -33,51 +42,64 @@ struct BSPID
 	static constexpr uint16_t EMPTY = 0xFFFF;
 };
 
+struct BSPBuildContext;
+
+static constexpr uint32_t BSP_NODE_NONE = std::numeric_limits<uint32_t>::max();
+
+/*
+	Node of the flat BSP pool. Nodes are stored in preorder, so the index of a node is also its id.
+	Each node owns the range [firstQuad, firstQuad + quadCount) of the shared quadblock index array,
+	the range of a branch being the union of the ranges of its children.
+*/
+struct BSPTreeNode
+{
+	BoundingBox bbox;
+	uint32_t parent;
+	uint32_t left;
+	uint32_t right;
+	uint32_t firstQuad;
+	uint32_t quadCount;
+	float split;
+	uint16_t flags;
+	BSPNode type;
+	AxisSplit axis;
+
+	bool IsBranch() const;
+};
+
 class BSP
 {
 public:
 	BSP();
-	BSP(BSPNode type, const std::vector<size_t>& quadblockIndexes, BSP* parent, const std::vector<Quadblock>& quadblocks);
-	void PopulateLeaf(PSX::BSPLeaf& leaf, std::vector<BSP*>& bspArray, const std::vector<Quadblock>& quadblocks, uint32_t offQuadblocks, size_t global_id);
-	void PopulateBranch(PSX::BSPBranch& branch, std::vector<BSP*>& bspArray, size_t global_id);
-	void PopulateBranchQuadIndexes();
-	size_t GetId() const;
 	bool IsEmpty() const;
 	bool IsValid() const;
-	bool IsBranch() const;
-	uint16_t GetFlags() const;
-	const std::string& GetType() const;
-	const std::string& GetAxis() const;
+	size_t GetNodeCount() const;
+	const BSPTreeNode& GetNode(uint32_t id) const;
+	const std::vector<BSPTreeNode>& GetNodes() const;
+	const std::string& GetType(uint32_t id) const;
+	const std::string& GetAxis(uint32_t id) const;
 	const BoundingBox& GetBoundingBox() const;
-	const std::vector<size_t>& GetQuadblockIndexes() const;
-	const BSP* GetLeftChildren() const;
-	const BSP* GetRightChildren() const;
-	const BSP* GetParent() const;
-	const std::vector<const BSP*> GetTree() const;
-	std::vector<const BSP*> GetLeaves() const;
+	std::span<const size_t> GetQuadblockIndexes(uint32_t id) const;
+	const std::vector<uint32_t>& GetLeaves() const;
 	void SetQuadblockIndexes(const std::vector<size_t>& quadblockIndexes);
-	void SetParent(BSP* parent);
 	void Clear();
-	void Generate(const std::vector<Quadblock>& quadblocks, const size_t maxQuadsPerLeaf, const float maxAxisLength);
-	std::vector<uint8_t> Serialize(size_t offQuads) const;
-	void RenderUI(const std::vector<Quadblock>& quadblocks);
+	void Generate(const std::vector<Quadblock>& quadblocks, const size_t maxQuadsPerLeaf, const float maxAxisLength, BSPBuilder builder = BSPBuilder::MIDPOINT);
+	bool LoadPSX(std::span<const uint8_t> psxNodes, const std::vector<Quadblock>& quadblocks, uint32_t offQuadblocks);
+	void RefitBoundingBoxes(const std::vector<Quadblock>& quadblocks);
+	void Serialize(uint32_t id, size_t offQuads, uint8_t* dst) const;
+	void SerializeLayout(std::vector<uint8_t>& buffer) const;
+	bool DeserializeLayout(const std::vector<uint8_t>& buffer, size_t& offset, const std::vector<Quadblock>& quadblocks);
+	void RenderUI(const std::vector<Quadblock>& quadblocks) const;
 
 private:
-	float GetAxisMidpoint(const AxisSplit axis) const;
-	BoundingBox ComputeBoundingBox(const std::vector<Quadblock>& quadblocks, const std::vector<size_t>& quadblockIndexes) const;
-	float Split(std::vector<size_t>& left, std::vector<size_t>& right, const AxisSplit axis, const std::vector<Quadblock>& quadblocks) const;
-	void GenerateOffspring(std::vector<size_t>& left, std::vector<size_t>& right, const std::vector<Quadblock>& quadblocks, const size_t maxQuadsPerLeaf, const float maxAxisLength);
-	std::vector<uint8_t> SerializeBranch() const;
-	std::vector<uint8_t> SerializeLeaf(size_t offQuads) const;
+	void RenderNodeUI(uint32_t id, const std::vector<Quadblock>& quadblocks) const;
+	bool AppendPSXNode(std::span<const uint8_t> psxNodes, uint16_t psxId, uint32_t parent, uint32_t offQuadblocks, size_t quadblockCount, std::vector<uint8_t>& visited);
+	void Finalize(const std::vector<Quadblock>& quadblocks);
+	void SerializeBranch(const BSPTreeNode& node, uint32_t id, uint8_t* dst) const;
+	void SerializeLeaf(const BSPTreeNode& node, uint32_t id, size_t offQuads, uint8_t* dst) const;
 
 private:
-	size_t m_id;
-	BSPNode m_node;
-	AxisSplit m_axis;
-	uint16_t m_flags;
-	BSP* m_left;
-	BSP* m_right;
-	BSP* m_parent;
-	BoundingBox m_bbox;
+	std::vector<BSPTreeNode> m_nodes;
 	std::vector<size_t> m_quadblockIndexes;
+	std::vector<uint32_t> m_leaves;
 };
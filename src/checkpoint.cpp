@@ -173,16 +173,14 @@ void Checkpoint::UpdateInvalidCheckpoints(const std::vector<int>& invalidIndexes
 	}
 }
 
-std::vector<uint8_t> Checkpoint::Serialize() const
+void Checkpoint::Serialize(uint8_t* dst) const
 {
-	PSX::Checkpoint checkpoint;
-	std::vector<uint8_t> buffer(sizeof(checkpoint));
+	PSX::Checkpoint checkpoint = {};
 	checkpoint.pos = ConvertVec3(m_pos, FP_ONE_GEO);
 	checkpoint.distToFinish = ConvertFloat(m_distToFinish, FP_ONE_CP);
 	checkpoint.linkUp = static_cast<uint8_t>(m_up);
 	checkpoint.linkDown = static_cast<uint8_t>(m_down);
 	checkpoint.linkLeft = static_cast<uint8_t>(m_left);
 	checkpoint.linkRight = static_cast<uint8_t>(m_right);
-	std::memcpy(buffer.data(), &checkpoint, sizeof(checkpoint));
-	return buffer;
+	std::memcpy(dst, &checkpoint, sizeof(checkpoint));
 }
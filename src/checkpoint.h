@@ -34,7 +34,7 @@ public:
 	bool GetDelete() const;
 	void RemoveInvalidCheckpoints(const std::vector<int>& invalidIndexes);
 	void UpdateInvalidCheckpoints(const std::vector<int>& invalidIndexes);
-	std::vector<uint8_t> Serialize() const;
+	void Serialize(uint8_t* dst) const;
 	void RenderUI(size_t numCheckpoints, const std::vector<Quadblock>& quadblocks);
 
 private:
@@ -0,0 +1,339 @@
+#include "cli.h"
+#include "level.h"
+#include "psx_types.h"
+#include "mapped_file.h"
+#include "profiler.h"
+
+#include <nlohmann/json.hpp>
+
+#include <fstream>
+#include <unordered_set>
+#include <unordered_map>
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <omp.h>
+
+int CLI::Run(int argc, char* argv[])
+{
+	if (argc < 2) { PrintUsage(); return 1; }
+	const std::string command = argv[1];
+	std::vector<std::string> args(argv + 2, argv + argc);
+	if (command == "inspect") { return Inspect(args); }
+	if (command == "build") { return Build(args); }
+	if (command == "benchmark") { return Benchmark(args); }
+	if (command == "selftest") { return SelfTest(args); }
+	PrintUsage();
+	return 1;
+}
+
+void CLI::PrintUsage()
+{
+	printf("Usage:\n");
+	printf("  CrashTeamEditor inspect <file.lev|directory>... [--threads N] [--json output.json]\n");
+	printf("      Loads every .lev (directories are searched recursively) and prints per-file stats.\n");
+	printf("  CrashTeamEditor build <file.obj> --out <directory> [--preset file.json]... [--threads N]\n");
+	printf("                        [--vis] [--simple] [--symmetric] [--near D] [--far D] [--camera-height H]\n");
+	printf("                        [--max-quads-per-leaf N] [--max-leaf-axis L] [--sah] [--profile output.json]\n");
+	printf("      Builds the .lev and .vrm from an .obj and its presets, timing every stage.\n");
+	printf("  CrashTeamEditor benchmark [--shapes grid,ramp,tunnel] [--sizes 1000,10000,100000] [--threads N]\n");
+	printf("                            [--quadratic-limit N] [--out directory] [--json output.json]\n");
+	printf("      Times every build stage on synthetic tracks and reports quadblocks/sec and peak memory.\n");
+	printf("  CrashTeamEditor selftest [--threads N]\n");
+	printf("      Checks on synthetic tracks that an incremental vis tree update matches a full rebake.\n");
+}
+
+static size_t ParseThreads(const std::string& value)
+{
+	try { return static_cast<size_t>(std::max(std::stoi(value), 1)); }
+	catch (const std::exception&) { return 0; }
+}
+
+static bool ParseFloat(const std::string& value, float& out)
+{
+	try { out = std::stof(value); return true; }
+	catch (const std::exception&) { return false; }
+}
+
+int CLI::Inspect(const std::vector<std::string>& args)
+{
+	std::vector<std::filesystem::path> files;
+	std::filesystem::path jsonPath;
+	size_t threadCount = 0;
+	for (size_t i = 0; i < args.size(); i++)
+	{
+		if (args[i] == "--threads" && i + 1 < args.size()) { threadCount = ParseThreads(args[++i]); continue; }
+		if (args[i] == "--json" && i + 1 < args.size()) { jsonPath = args[++i]; continue; }
+
+		const std::filesystem::path input = args[i];
+		std::error_code error;
+		if (std::filesystem::is_directory(input, error))
+		{
+			for (const auto& entry : std::filesystem::recursive_directory_iterator(input, error))
+			{
+				if (entry.is_regular_file() && entry.path().extension() == ".lev") { files.push_back(entry.path()); }
+			}
+		}
+		else { files.push_back(input); }
+	}
+	if (files.empty()) { PrintUsage(); return 1; }
+	std::sort(files.begin(), files.end());
+
+	// Files are independent, so they're spread over the workers; results are printed afterwards in path order
+	std::vector<LevInspection> results(files.size());
+	const int fileCount = static_cast<int>(files.size());
+	const int workers = threadCount > 0 ? static_cast<int>(threadCount) : omp_get_max_threads();
+	#pragma omp parallel for schedule(dynamic, 1) num_threads(workers)
+	for (int i = 0; i < fileCount; i++) { results[i] = InspectLEV(files[i]); }
+
+	size_t failed = 0;
+	printf("%-40s %8s %8s %7s %7s %9s %8s %6s %5s %9s %4s\n", "file", "quads", "verts", "nodes", "leaves", "texgroups", "vissets", "vis%", "cps", "cp-issues", "vrm");
+	nlohmann::json json = nlohmann::json::array();
+	for (const LevInspection& result : results)
+	{
+		const std::string name = result.path.string();
+		if (!result.loaded)
+		{
+			failed++;
+			printf("%-40s FAILED TO LOAD\n", name.c_str());
+			json.push_back({{"file", result.path.string()}, {"loaded", false}});
+			continue;
+		}
+		const size_t checkpointIssues = result.checkpointDanglingLinks + result.checkpointUnreachable;
+		printf("%-40s %8zu %8zu %7zu %7zu %9zu %8zu %6.1f %5zu %9zu %4s%s\n", name.c_str(), result.quadblocks, result.vertices,
+			result.bspNodes, result.bspLeaves, result.textureGroups, result.visibleSets, result.visDensity * 100.0f,
+			result.checkpoints, checkpointIssues, result.hasVRM ? "yes" : "no", result.bspValid ? "" : " (invalid bsp)");
+
+		json.push_back({
+			{"file", result.path.string()}, {"loaded", true}, {"fileSize", result.fileSize},
+			{"quadblocks", result.quadblocks}, {"vertices", result.vertices},
+			{"bspNodes", result.bspNodes}, {"bspLeaves", result.bspLeaves}, {"bspValid", result.bspValid},
+			{"textureGroups", result.textureGroups}, {"visibleSets", result.visibleSets}, {"visDensity", result.visDensity},
+			{"pointers", result.pointers}, {"checkpoints", result.checkpoints},
+			{"checkpointDanglingLinks", result.checkpointDanglingLinks}, {"checkpointUnreachable", result.checkpointUnreachable},
+			{"hasVRM", result.hasVRM}
+		});
+	}
+	printf("\n%zu files, %zu failed\n", results.size(), failed);
+
+	if (!jsonPath.empty())
+	{
+		std::ofstream jsonFile(jsonPath);
+		jsonFile << json.dump(2) << std::endl;
+	}
+	return failed == 0 ? 0 : 1;
+}
+
+LevInspection CLI::InspectLEV(const std::filesystem::path& path)
+{
+	LevInspection result;
+	result.path = path;
+
+	Level level;
+	if (!level.Load(path)) { return result; }
+	result.loaded = true;
+	result.quadblocks = level.m_quadblocks.size();
+	result.bspNodes = level.m_bsp.GetNodeCount();
+	result.bspLeaves = level.m_bsp.GetLeaves().size();
+	result.bspValid = level.m_bsp.IsValid();
+	result.hasVRM = std::filesystem::exists(std::filesystem::path(path).replace_extension(".vrm"));
+
+	// Every link has to point to an existing checkpoint, and the whole graph has to be reachable from the first one
+	const std::vector<Checkpoint>& checkpoints = level.m_checkpoints;
+	result.checkpoints = checkpoints.size();
+	std::vector<uint8_t> reached(checkpoints.size(), 0);
+	std::vector<size_t> queue;
+	if (!checkpoints.empty()) { reached[0] = 1; queue.push_back(0); }
+	for (size_t i = 0; i < checkpoints.size(); i++)
+	{
+		for (int link : {checkpoints[i].GetUp(), checkpoints[i].GetDown(), checkpoints[i].GetLeft(), checkpoints[i].GetRight()})
+		{
+			if (link != NONE_CHECKPOINT_INDEX && (link < 0 || static_cast<size_t>(link) >= checkpoints.size())) { result.checkpointDanglingLinks++; }
+		}
+	}
+	for (size_t head = 0; head < queue.size(); head++)
+	{
+		const Checkpoint& checkpoint = checkpoints[queue[head]];
+		for (int link : {checkpoint.GetUp(), checkpoint.GetDown(), checkpoint.GetLeft(), checkpoint.GetRight()})
+		{
+			if (link < 0 || static_cast<size_t>(link) >= checkpoints.size() || reached[link]) { continue; }
+			reached[link] = 1;
+			queue.push_back(static_cast<size_t>(link));
+		}
+	}
+	result.checkpointUnreachable = checkpoints.size() - queue.size();
+
+	// The rest only exists in the file, so it's read straight from the mapped bytes
+	MappedFile file;
+	if (!file.Open(path) || file.GetSize() < sizeof(uint32_t)) { return result; }
+	result.fileSize = file.GetSize();
+	uint32_t offPointerMap = 0;
+	std::memcpy(&offPointerMap, file.GetData(), sizeof(uint32_t));
+	const LevView levFileData = {file.GetData() + sizeof(uint32_t), file.GetSize() - sizeof(uint32_t)};
+	uint32_t pointerMapBytes = 0;
+	if (levFileData.Read(offPointerMap, pointerMapBytes)) { result.pointers = pointerMapBytes / sizeof(uint32_t); }
+
+	const LevView lev = {levFileData.data, std::min<size_t>(offPointerMap, levFileData.size)};
+	PSX::LevHeader header = {};
+	PSX::MeshInfo meshInfo = {};
+	if (!lev.Read(0, header) || !lev.Read(header.offMeshInfo, meshInfo)) { return result; }
+	result.vertices = meshInfo.numVertices;
+
+	const size_t visNodeWords = (meshInfo.numBSPNodes + 31) / 32;
+	std::unordered_set<uint32_t> textureGroups;
+	std::unordered_set<uint32_t> visibleSets;
+	std::unordered_map<uint32_t, size_t> visibleNodeCounts;
+	size_t visibleNodes = 0;
+	size_t quadsWithVis = 0;
+	for (uint32_t i = 0; i < meshInfo.numQuadblocks; i++)
+	{
+		PSX::Quadblock quadblock = {};
+		if (!lev.Read(meshInfo.offQuadblocks + i * sizeof(PSX::Quadblock), quadblock)) { break; }
+		for (uint32_t offTexture : quadblock.offMidTextures)
+		{
+			if (offTexture != 0 && !(offTexture & 1)) { textureGroups.insert(offTexture); }
+		}
+		if (quadblock.offLowTexture != 0) { textureGroups.insert(quadblock.offLowTexture); }
+
+		PSX::VisibleSet visibleSet = {};
+		if (quadblock.offVisibleSet == 0 || !lev.Read(quadblock.offVisibleSet, visibleSet)) { continue; }
+		visibleSets.insert(quadblock.offVisibleSet);
+		if (visibleSet.offVisibleBSPNodes == 0 || !lev.Contains<uint32_t>(visibleSet.offVisibleBSPNodes, visNodeWords)) { continue; }
+
+		auto it = visibleNodeCounts.find(visibleSet.offVisibleBSPNodes);
+		if (it == visibleNodeCounts.end())
+		{
+			size_t count = 0;
+			for (size_t word = 0; word < visNodeWords; word++)
+			{
+				uint32_t bits = 0;
+				lev.Read(visibleSet.offVisibleBSPNodes + word * sizeof(uint32_t), bits);
+				// Node bits start from the most significant one, anything past the last node is padding
+				const size_t usedBits = std::min<size_t>(meshInfo.numBSPNodes - word * 32, 32);
+				if (usedBits < 32) { bits &= ~(UINT32_MAX >> usedBits); }
+				count += std::popcount(bits);
+			}
+			it = visibleNodeCounts.emplace(visibleSet.offVisibleBSPNodes, count).first;
+		}
+		visibleNodes += it->second;
+		quadsWithVis++;
+	}
+	result.textureGroups = textureGroups.size();
+	result.visibleSets = visibleSets.size();
+	if (quadsWithVis > 0 && meshInfo.numBSPNodes > 0)
+	{
+		result.visDensity = static_cast<float>(visibleNodes) / static_cast<float>(quadsWithVis * meshInfo.numBSPNodes);
+	}
+	return result;
+}
+
+int CLI::Build(const std::vector<std::string>& args)
+{
+	std::filesystem::path objPath;
+	std::filesystem::path outDir;
+	std::filesystem::path profilePath;
+	std::vector<std::filesystem::path> presets;
+	size_t threadCount = 0;
+	bool genVisTree = false;
+	VisTreeSettings visSettings;
+	int maxQuadsPerLeaf = 31;
+	float maxLeafAxisLength = 64.0f;
+	BSPBuilder bspBuilder = BSPBuilder::MIDPOINT;
+	for (size_t i = 0; i < args.size(); i++)
+	{
+		const std::string& arg = args[i];
+		const bool hasValue = i + 1 < args.size();
+		bool valid = true;
+		if (arg == "--out" && hasValue) { outDir = args[++i]; }
+		else if (arg == "--preset" && hasValue) { presets.push_back(args[++i]); }
+		else if (arg == "--threads" && hasValue) { threadCount = ParseThreads(args[++i]); valid = threadCount > 0; }
+		else if (arg == "--vis") { genVisTree = true; }
+		else if (arg == "--simple") { visSettings.simple = true; }
+		else if (arg == "--symmetric") { visSettings.symmetric = true; }
+		else if (arg == "--near" && hasValue) { valid = ParseFloat(args[++i], visSettings.minDistance); }
+		else if (arg == "--far" && hasValue) { valid = ParseFloat(args[++i], visSettings.maxDistance); }
+		else if (arg == "--camera-height" && hasValue) { valid = ParseFloat(args[++i], visSettings.cameraHeight); }
+		else if (arg == "--max-quads-per-leaf" && hasValue) { maxQuadsPerLeaf = static_cast<int>(ParseThreads(args[++i])); valid = maxQuadsPerLeaf > 0; }
+		else if (arg == "--max-leaf-axis" && hasValue) { valid = ParseFloat(args[++i], maxLeafAxisLength); }
+		else if (arg == "--sah") { bspBuilder = BSPBuilder::SAH; }
+		else if (arg == "--profile" && hasValue) { profilePath = args[++i]; }
+		else if (objPath.empty() && arg.rfind("--", 0) != 0) { objPath = arg; }
+		else { valid = false; }
+
+		if (!valid) { printf("Invalid argument: %s\n\n", arg.c_str()); PrintUsage(); return 1; }
+	}
+	if (objPath.empty() || outDir.empty()) { PrintUsage(); return 1; }
+	if (threadCount > 0) { omp_set_num_threads(static_cast<int>(threadCount)); }
+
+	std::error_code error;
+	std::filesystem::create_directories(outDir, error);
+	if (!std::filesystem::is_directory(outDir)) { printf("Could not create output directory: %s\n", outDir.string().c_str()); return 1; }
+
+	using Clock = std::chrono::steady_clock;
+	Clock::time_point stageStart = Clock::now();
+	const Clock::time_point buildStart = stageStart;
+	auto EndStage = [&stageStart](const char* stage)
+		{
+			const Clock::time_point now = Clock::now();
+			printf("%-12s %10.1f ms\n", stage, std::chrono::duration<double, std::milli>(now - stageStart).count());
+			stageStart = now;
+		};
+	auto PrintLog = [](Level& level)
+		{
+			for (const auto& [quadblock, message] : level.m_invalidQuadblocks) { printf("  %s: %s\n", quadblock.c_str(), message.c_str()); }
+			if (!level.m_logMessage.empty()) { printf("%s\n", level.m_logMessage.c_str()); }
+			level.m_invalidQuadblocks.clear();
+			level.m_logMessage.clear();
+		};
+
+	// Level::Load would build a BSP with the default parameters, the build below uses the command line ones
+	Level level;
+	level.Clear(true);
+	const bool loaded = objPath.extension() == ".obj" && level.LoadOBJ(objPath, false);
+	PrintLog(level);
+	if (!loaded) { printf("Failed to load: %s\n", objPath.string().c_str()); return 1; }
+	EndStage("load");
+
+	for (const std::filesystem::path& preset : presets)
+	{
+		if (!std::filesystem::exists(preset) || !level.LoadPreset(preset)) { printf("Failed to load preset: %s\n", preset.string().c_str()); return 1; }
+	}
+	PrintLog(level);
+	EndStage("presets");
+
+	// Load resets the generation parameters, so they're only applied once the level and its presets are in
+	level.m_genVisTree = genVisTree;
+	level.m_simpleVisTree = visSettings.simple;
+	level.m_symmetricVisTree = visSettings.symmetric;
+	level.m_visTreeThreads = static_cast<int>(threadCount);
+	level.m_distanceNearClip = visSettings.minDistance;
+	level.m_distanceFarClip = visSettings.maxDistance;
+	level.m_visTreeCameraHeight = visSettings.cameraHeight;
+	level.m_maxQuadPerLeaf = maxQuadsPerLeaf;
+	level.m_maxLeafAxisLength = maxLeafAxisLength;
+	level.m_bspBuilder = bspBuilder;
+	if (!level.GenerateBSP()) { printf("Failed to generate the BSP tree.\n"); return 1; }
+	EndStage(genVisTree ? "bsp + vis" : "bsp");
+
+	if (!level.m_checkpointPaths.empty())
+	{
+		if (!level.GenerateCheckpoints()) { printf("Failed to generate checkpoints: every path needs a start and an end.\n"); return 1; }
+		EndStage("checkpoints");
+	}
+
+	// Saving also packs the VRM, so both files are covered by this stage
+	if (!level.SaveLEV(outDir)) { printf("Failed to save: %s\n", level.m_hotReloadLevPath.string().c_str()); return 1; }
+	EndStage("save");
+
+	printf("%-12s %10.1f ms\n", "total", std::chrono::duration<double, std::milli>(Clock::now() - buildStart).count());
+	printf("%zu quadblocks, %zu BSP nodes, %zu checkpoints, vrm %s\n", level.m_quadblocks.size(), level.m_bsp.GetNodeCount(),
+		level.m_checkpoints.size(), level.m_vrm.empty() ? "not generated" : level.m_hotReloadVRMPath.string().c_str());
+
+	if (!profilePath.empty())
+	{
+		std::ofstream profileFile(profilePath);
+		profileFile << Profiler::ToJson().dump(2) << std::endl;
+		if (!profileFile.good()) { printf("Failed to write the profile: %s\n", profilePath.string().c_str()); return 1; }
+	}
+	return 0;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+struct LevInspection
+{
+	std::filesystem::path path;
+	bool loaded = false;
+	size_t fileSize = 0;
+	size_t quadblocks = 0;
+	size_t vertices = 0;
+	size_t bspNodes = 0;
+	size_t bspLeaves = 0;
+	bool bspValid = false;
+	size_t textureGroups = 0;
+	size_t visibleSets = 0;
+	size_t pointers = 0;
+	float visDensity = 0.0f;
+	size_t checkpoints = 0;
+	size_t checkpointDanglingLinks = 0;
+	size_t checkpointUnreachable = 0;
+	bool hasVRM = false;
+};
+
+/*
+	Headless entry point: everything in here runs without creating a window,
+	an OpenGL context or any ImGui state, so it can be used on build servers.
+*/
+class CLI
+{
+public:
+	int Run(int argc, char* argv[]);
+
+private:
+	int Inspect(const std::vector<std::string>& args);
+	int Build(const std::vector<std::string>& args);
+	int Benchmark(const std::vector<std::string>& args);
+	int SelfTest(const std::vector<std::string>& args);
+	static LevInspection InspectLEV(const std::filesystem::path& path);
+	static void PrintUsage();
+};
@@ -5,6 +5,7 @@
 #include <vector>
 #include <string>
 #include <cstdint>
+#include <cstring>
 
 static constexpr size_t NUM_GRADIENT = 3;
 static constexpr size_t NUM_DRIVERS = 8;
@@ -43,6 +44,30 @@ struct Stars
     uint16_t zDepth;
 };
 
+/*
+	Bounds checked view over the data of a mapped .lev: offsets are relative to the word that
+	follows the pointer map offset, and every section has to end before the pointer map.
+*/
+struct LevView
+{
+	const uint8_t* data;
+	size_t size;
+
+	template<typename T>
+	inline bool Contains(size_t offset, size_t count = 1) const
+	{
+		return offset <= size && count <= (size - offset) / sizeof(T);
+	}
+
+	template<typename T>
+	inline bool Read(size_t offset, T& out) const
+	{
+		if (!Contains<T>(offset)) { return false; }
+		std::memcpy(&out, data + offset, sizeof(T));
+		return true;
+	}
+};
+
 static const std::vector<std::string> CTR_CHARACTERS = {
 	"Crash Bandicoot", "Dr. Neo Cortex", "Tiny Tiger", "Coco Bandicoot",
 	"N. Gin", "Dingodile", "Polar", "Pura", "Pinstripe", "Papu Papu",
@@ -8,11 +8,21 @@
 #include "renderer.h"
 #include "vistree.h"
 #include "text3d.h"
+#include "mapped_file.h"
+#include "profiler.h"
 
 #include <fstream>
 #include <unordered_set>
 #include <map>
 #include <algorithm>
+#include <bit>
+#include <span>
+#include <cstring>
+#include <charconv>
+#include <string_view>
+#include <array>
+#include <optional>
+#include <omp.h>
 
 bool Level::Load(const std::filesystem::path& filename)
 {
@@ -71,11 +81,16 @@ void Level::Clear(bool clearErrors)
 	m_rendererSelectedQuadblockIndexes.clear();
 	m_genVisTree = false;
 	m_simpleVisTree = false;
+	m_symmetricVisTree = false;
 	m_bspVis.Clear();
+	m_bspVisInfluence.clear();
 	m_maxQuadPerLeaf = 31;
+	m_bspBuilder = BSPBuilder::MIDPOINT;
+	m_visTreeThreads = 0;
 	m_maxLeafAxisLength = 64.0f;
 	m_distanceNearClip = -1.0f;
 	m_distanceFarClip = 1000.0f;
+	m_visTreeCameraHeight = 5.0f;
 	m_pythonConsole.clear();
 	m_saveScript = false;
 	m_vrm.clear();
@@ -181,23 +196,223 @@ Model* Level::GetFilterModel()
 
 bool Level::GenerateBSP()
 {
+	/* the vis tree of the previous BSP never matches the new one */
+	m_bspVis.Clear();
+	m_bspVisInfluence.clear();
+	if (LoadBakeCache())
+	{
+		GenerateRenderBspData();
+		return true;
+	}
+
 	std::vector<size_t> quadIndexes;
 	for (size_t i = 0; i < m_quadblocks.size(); i++) { quadIndexes.push_back(i); }
 	m_bsp.Clear();
 	m_bsp.SetQuadblockIndexes(quadIndexes);
-	m_bsp.Generate(m_quadblocks, m_maxQuadPerLeaf, m_maxLeafAxisLength);
+	m_bsp.Generate(m_quadblocks, m_maxQuadPerLeaf, m_maxLeafAxisLength, m_bspBuilder);
 	if (m_bsp.IsValid())
 	{
 		GenerateRenderBspData();
-		if (m_genVisTree) { m_bspVis = GenerateVisTree(m_quadblocks, &m_bsp, m_simpleVisTree, m_distanceNearClip, m_distanceFarClip); }
+		if (m_genVisTree)
+		{
+			m_bspVis = GenerateVisTree(m_quadblocks, m_bsp, GetVisTreeSettings());
+			m_bspVisInfluence = ComputeVisLeafInfluence(m_quadblocks, m_bsp);
+			ClearVisTreeDirty();
+		}
+		SaveBakeCache();
 		return true;
 	}
 	m_bsp.Clear();
 	return false;
 }
 
+bool Level::UpdateVisTree()
+{
+	if (!m_bsp.IsValid()) { return false; }
+	const std::vector<uint32_t>& leaves = m_bsp.GetLeaves();
+	if (m_bspVis.IsEmpty() || m_bspVis.GetWidth() != leaves.size() || m_bspVisInfluence.size() != leaves.size()) { return false; }
+
+	std::vector<size_t> changedLeaves;
+	for (size_t i = 0; i < leaves.size(); i++)
+	{
+		for (size_t index : m_bsp.GetQuadblockIndexes(leaves[i]))
+		{
+			if (m_quadblocks[index].GetVisTreeDirty()) { changedLeaves.push_back(i); break; }
+		}
+	}
+	if (changedLeaves.empty()) { return true; }
+
+	if (!::UpdateVisTree(m_bspVis, m_quadblocks, m_bsp, changedLeaves, m_bspVisInfluence, GetVisTreeSettings())) { return false; }
+	ClearVisTreeDirty();
+	return true;
+}
+
+VisTreeSettings Level::GetVisTreeSettings() const
+{
+	VisTreeSettings settings;
+	settings.simple = m_simpleVisTree;
+	settings.symmetric = m_symmetricVisTree;
+	settings.threadCount = m_visTreeThreads;
+	settings.minDistance = m_distanceNearClip;
+	settings.maxDistance = m_distanceFarClip;
+	settings.cameraHeight = m_visTreeCameraHeight;
+	return settings;
+}
+
+void Level::ClearVisTreeDirty()
+{
+	for (Quadblock& quadblock : m_quadblocks) { quadblock.SetVisTreeDirty(false); }
+}
+
+static constexpr uint32_t BAKE_CACHE_MAGIC = 0x454B4142; // "BAKE"
+static constexpr uint32_t BAKE_CACHE_VERSION = 1;
+
+struct BakeCacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t hash;
+	uint64_t layoutSize;
+	uint64_t visWidth;
+};
+
+// FNV-1a, so that the keys stay the same between runs and platforms
+template<typename T>
+static void HashBytes(uint64_t& hash, const T& value)
+{
+	const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+	for (size_t i = 0; i < sizeof(T); i++)
+	{
+		hash ^= bytes[i];
+		hash *= 0x100000001B3;
+	}
+}
+
+uint64_t Level::ComputeBakeHash() const
+{
+	uint64_t hash = 0xCBF29CE484222325;
+	HashBytes(hash, BAKE_CACHE_VERSION);
+	HashBytes(hash, static_cast<uint64_t>(m_quadblocks.size()));
+	for (const Quadblock& quadblock : m_quadblocks)
+	{
+		const Vertex* vertices = quadblock.GetUnswizzledVertices();
+		for (size_t i = 0; i < NUM_VERTICES_QUADBLOCK; i++)
+		{
+			HashBytes(hash, vertices[i].m_pos.x);
+			HashBytes(hash, vertices[i].m_pos.y);
+			HashBytes(hash, vertices[i].m_pos.z);
+		}
+		HashBytes(hash, quadblock.GetFlags());
+		HashBytes(hash, quadblock.GetVisTreeTransparent());
+		HashBytes(hash, quadblock.GetDrawDoubleSided());
+		HashBytes(hash, quadblock.IsQuadblock());
+	}
+	HashBytes(hash, m_maxQuadPerLeaf);
+	HashBytes(hash, m_bspBuilder);
+	HashBytes(hash, m_maxLeafAxisLength);
+	HashBytes(hash, m_genVisTree);
+	if (m_genVisTree)
+	{
+		HashBytes(hash, m_distanceNearClip);
+		HashBytes(hash, m_distanceFarClip);
+		HashBytes(hash, m_simpleVisTree);
+		HashBytes(hash, m_symmetricVisTree);
+		HashBytes(hash, m_visTreeCameraHeight);
+	}
+	return hash;
+}
+
+/*
+	One entry with the vis tree and one without, so that a BSP-only build (e.g. the one that follows every OBJ load)
+	never overwrites a vis bake. Each entry is overwritten by the next bake of its kind: the header hash tells whether it still matches.
+*/
+std::filesystem::path Level::GetBakeCachePath() const
+{
+	return m_parentPath / (m_name + "_cache") / (m_genVisTree ? "bake_vis.bin" : "bake.bin");
+}
+
+bool Level::LoadBakeCache()
+{
+	ScopedTimer timer("BSP/bake cache load");
+	if (m_parentPath.empty() || m_quadblocks.empty()) { return false; }
+	const std::filesystem::path cachePath = GetBakeCachePath();
+	if (!std::filesystem::is_regular_file(cachePath)) { return false; }
+
+	std::vector<uint8_t> buffer;
+	ReadBinaryFile(buffer, cachePath);
+	BakeCacheHeader header = {};
+	if (buffer.size() < sizeof(header)) { return false; }
+	std::memcpy(&header, buffer.data(), sizeof(header));
+	if (header.magic != BAKE_CACHE_MAGIC || header.version != BAKE_CACHE_VERSION || header.hash != ComputeBakeHash()) { return false; }
+	if (header.layoutSize > buffer.size() - sizeof(header)) { return false; }
+
+	size_t offset = sizeof(header);
+	const std::vector<uint8_t> layout(buffer.begin() + offset, buffer.begin() + offset + header.layoutSize);
+	size_t layoutOffset = 0;
+	if (!m_bsp.DeserializeLayout(layout, layoutOffset, m_quadblocks) || layoutOffset != layout.size())
+	{
+		m_bsp.Clear();
+		return false;
+	}
+	offset += header.layoutSize;
+
+	const size_t leafCount = m_bsp.GetLeaves().size();
+	BitMatrix visMatrix;
+	if (m_genVisTree)
+	{
+		if (header.visWidth != leafCount) { m_bsp.Clear(); return false; }
+		visMatrix = BitMatrix(leafCount, leafCount);
+		if (buffer.size() - offset != leafCount * visMatrix.GetRowWords() * sizeof(uint64_t)) { m_bsp.Clear(); return false; }
+		std::vector<uint64_t> row(visMatrix.GetRowWords());
+		for (size_t i = 0; i < leafCount; i++)
+		{
+			std::memcpy(row.data(), buffer.data() + offset, row.size() * sizeof(uint64_t));
+			visMatrix.SetRow(i, row.data());
+			offset += row.size() * sizeof(uint64_t);
+		}
+		m_bspVis = std::move(visMatrix);
+		m_bspVisInfluence = ComputeVisLeafInfluence(m_quadblocks, m_bsp);
+		ClearVisTreeDirty();
+	}
+	m_logMessage += "\nLoaded BSP bake from cache: " + cachePath.string();
+	return true;
+}
+
+bool Level::SaveBakeCache() const
+{
+	ScopedTimer timer("BSP/bake cache save");
+	if (m_parentPath.empty() || !m_bsp.IsValid()) { return false; }
+	if (m_genVisTree && m_bspVis.IsEmpty()) { return false; }
+
+	std::vector<uint8_t> layout;
+	m_bsp.SerializeLayout(layout);
+
+	BakeCacheHeader header = {};
+	header.magic = BAKE_CACHE_MAGIC;
+	header.version = BAKE_CACHE_VERSION;
+	header.hash = ComputeBakeHash();
+	header.layoutSize = layout.size();
+	header.visWidth = m_genVisTree ? m_bspVis.GetWidth() : 0;
+
+	const std::filesystem::path cachePath = GetBakeCachePath();
+	std::error_code error;
+	std::filesystem::create_directories(cachePath.parent_path(), error);
+	if (error) { return false; }
+
+	std::ofstream file(cachePath, std::ios::binary);
+	if (!file.is_open()) { return false; }
+	Write(file, &header, sizeof(header));
+	Write(file, layout.data(), layout.size());
+	if (m_genVisTree)
+	{
+		for (size_t i = 0; i < m_bspVis.GetWidth(); i++) { Write(file, m_bspVis.GetRow(i), m_bspVis.GetRowWords() * sizeof(uint64_t)); }
+	}
+	return file.good();
+}
+
 bool Level::GenerateCheckpoints()
 {
+	ScopedTimer timer("Checkpoints");
 	if (m_checkpointPaths.empty()) { return false; }
 
 	for (const Path& path : m_checkpointPaths) { if (!path.IsReady()) { return false; } }
@@ -401,6 +616,7 @@ enum class PresetHeader : unsigned
 
 bool Level::LoadPreset(const std::filesystem::path& filename)
 {
+	ScopedTimer timer("LoadPreset");
 	m_showLogWindow = true;
 	nlohmann::json json = nlohmann::json::parse(std::ifstream(filename));
 	if (!json.contains("header"))
@@ -720,14 +936,35 @@ void Level::ManageTurbopad(Quadblock& quadblock)
 
 bool Level::LoadLEV(const std::filesystem::path& levFile)
 {
-	std::ifstream file(levFile, std::ios::binary);
-
-	uint32_t offPointerMap;
-	Read(file, offPointerMap);
-
-	std::streampos offLev = file.tellg();
+	ScopedTimer timer("LoadLEV");
+	MappedFile file;
+	if (!file.Open(levFile) || file.GetSize() < sizeof(uint32_t)) { return false; }
+
+	uint32_t offPointerMap = 0;
+	std::memcpy(&offPointerMap, file.GetData(), sizeof(uint32_t));
+	const LevView levFileData = {file.GetData() + sizeof(uint32_t), file.GetSize() - sizeof(uint32_t)};
+	uint32_t pointerMapBytes = 0;
+	if (!levFileData.Read(offPointerMap, pointerMapBytes) ||
+		!levFileData.Contains<uint32_t>(offPointerMap + sizeof(uint32_t), pointerMapBytes / sizeof(uint32_t))) { return false; }
+
+	const LevView lev = {levFileData.data, offPointerMap};
 	PSX::LevHeader header = {};
-	Read(file, header);
+	PSX::MeshInfo meshInfo = {};
+	if (!lev.Read(0, header) || !lev.Read(header.offMeshInfo, meshInfo)) { return false; }
+	if (!lev.Contains<PSX::Vertex>(meshInfo.offVertices, meshInfo.numVertices) ||
+		!lev.Contains<PSX::Quadblock>(meshInfo.offQuadblocks, meshInfo.numQuadblocks) ||
+		!lev.Contains<PSX::BSPBranch>(meshInfo.offBSPNodes, meshInfo.numBSPNodes) ||
+		!lev.Contains<PSX::Checkpoint>(header.offCheckpointNodes, header.numCheckpointNodes)) { return false; }
+
+	std::vector<PSX::Quadblock> quadblocks(meshInfo.numQuadblocks);
+	if (!quadblocks.empty()) { std::memcpy(quadblocks.data(), lev.data + meshInfo.offQuadblocks, quadblocks.size() * sizeof(PSX::Quadblock)); }
+	for (const PSX::Quadblock& quadblock : quadblocks)
+	{
+		for (size_t i = 0; i < NUM_VERTICES_QUADBLOCK; i++)
+		{
+			if (quadblock.index[i] >= meshInfo.numVertices) { return false; }
+		}
+	}
 
 	m_configFlags = header.config;
 	m_clearColor = ConvertColor(header.clear);
@@ -745,117 +982,109 @@ bool Level::LoadLEV(const std::filesystem::path& levFile)
 		m_skyGradient[i].colorTo = ConvertColor(header.skyGradient[i].colorTo);
 	}
 
-	PSX::MeshInfo meshInfo = {};
-	file.seekg(offLev + std::streampos(header.offMeshInfo));
-	Read(file, meshInfo);
-
-	std::vector<PSX::Vertex> vertices;
-	vertices.reserve(meshInfo.numVertices);
-	file.seekg(offLev + std::streampos(meshInfo.offVertices));
-	for (uint32_t i = 0; i < meshInfo.numVertices; i++)
-	{
-		PSX::Vertex vertex = {};
-		Read(file, vertex);
-		vertices.push_back(vertex);
-	}
-
-	file.seekg(offLev + std::streampos(meshInfo.offQuadblocks));
-	for (uint32_t i = 0; i < meshInfo.numQuadblocks; i++)
-	{
-		PSX::Quadblock quadblock = {};
-		Read(file, quadblock);
-		m_quadblocks.emplace_back(quadblock, vertices, [this](const Quadblock& qb) { UpdateFilterRenderData(qb); });
-		m_materialToQuadblocks["default"].push_back(i);
-	}
-
+	std::vector<PSX::Vertex> vertices(meshInfo.numVertices);
+	if (!vertices.empty()) { std::memcpy(vertices.data(), lev.data + meshInfo.offVertices, vertices.size() * sizeof(PSX::Vertex)); }
 
-	m_bsp.Clear();
-	file.seekg(offLev + std::streampos(meshInfo.offBSPNodes));
-	std::vector<BSP*> bspArray;
-	for (uint32_t i = 0; i < meshInfo.numBSPNodes; i++)
+	m_quadblocks.reserve(quadblocks.size());
+	std::vector<size_t>& defaultQuadblocks = m_materialToQuadblocks["default"];
+	defaultQuadblocks.reserve(quadblocks.size());
+	for (size_t i = 0; i < quadblocks.size(); i++)
 	{
-		bspArray.push_back(new BSP());
+		m_quadblocks.emplace_back(quadblocks[i], vertices, [this](const Quadblock& qb) { UpdateFilterRenderData(qb); });
+		defaultQuadblocks.push_back(i);
 	}
 
-	for (uint32_t i = 0; i < meshInfo.numBSPNodes; i++)
-	{
-		uint16_t flag;
-		std::streampos nodeStart = file.tellg();
-		Read(file, flag);
-		file.seekg(nodeStart);
-
-		if (flag & BSPFlags::LEAF)
-		{
-			PSX::BSPLeaf leaf = {};
-			Read(file, leaf);
-			bspArray[leaf.id]->PopulateLeaf(leaf, bspArray, m_quadblocks, meshInfo.offQuadblocks, meshInfo.numBSPNodes);
-		}
-		else
-		{
-			PSX::BSPBranch branch = {};
-			Read(file, branch);
-			bspArray[branch.id]->PopulateBranch(branch, bspArray, meshInfo.numBSPNodes);
-		}
-	}
-
-	if (!bspArray.empty())
-	{
-		m_bsp = *(bspArray[0]);
-		m_bsp.PopulateBranchQuadIndexes();
-		if (m_bsp.IsValid()) { GenerateRenderBspData(); }
-		else { m_bsp.Clear(); }
-	}
+	const std::span<const uint8_t> bspData(lev.data + meshInfo.offBSPNodes, meshInfo.numBSPNodes * sizeof(PSX::BSPBranch));
+	if (m_bsp.LoadPSX(bspData, m_quadblocks, meshInfo.offQuadblocks)) { GenerateRenderBspData(); }
 	else { m_bsp.Clear(); }
 
-	file.seekg(offLev + std::streampos(header.offCheckpointNodes));
+	m_checkpoints.reserve(header.numCheckpointNodes);
 	for (uint32_t i = 0; i < header.numCheckpointNodes; i++)
 	{
 		PSX::Checkpoint checkpoint = {};
-		Read(file, checkpoint);
+		lev.Read(header.offCheckpointNodes + i * sizeof(PSX::Checkpoint), checkpoint);
 		m_checkpoints.emplace_back(checkpoint, static_cast<int>(i));
 	}
 	UpdateRenderCheckpointData();
 
 	m_tropyGhost.clear();
 	m_oxideGhost.clear();
-	if (header.offExtra > 0)
-	{
-		file.seekg(offLev + std::streampos(header.offExtra));
-		PSX::LevelExtraHeader extraHeader = {};
-		Read(file, extraHeader);
-		// Read N. Tropy Ghost
-		if (extraHeader.count >= PSX::LevelExtra::N_TROPY_GHOST + 1 &&
-			extraHeader.offsets[PSX::LevelExtra::N_TROPY_GHOST] > 0)
-		{
-			file.seekg(offLev + std::streampos(extraHeader.offsets[PSX::LevelExtra::N_TROPY_GHOST]));
-			size_t ghostSize = 0;
-			if (extraHeader.count > PSX::LevelExtra::N_OXIDE_GHOST && extraHeader.offsets[PSX::LevelExtra::N_OXIDE_GHOST] > 0)
-			{
-				ghostSize = extraHeader.offsets[PSX::LevelExtra::N_OXIDE_GHOST] - extraHeader.offsets[PSX::LevelExtra::N_TROPY_GHOST];
-			}
-			else
+	PSX::LevelExtraHeader extraHeader = {};
+	if (header.offExtra > 0 && lev.Read(header.offExtra, extraHeader))
+	{
+		auto ReadGhost = [&lev](size_t offGhost, size_t offEnd, std::vector<uint8_t>& ghost)
 			{
-				ghostSize = header.offLevNavTable - extraHeader.offsets[PSX::LevelExtra::N_TROPY_GHOST];
-			}
-			m_tropyGhost.resize(ghostSize);
-			file.read(reinterpret_cast<char*>(m_tropyGhost.data()), ghostSize);
-		}
-		// Read N. Oxide Ghost
-		if (extraHeader.count >= PSX::LevelExtra::N_OXIDE_GHOST + 1 && extraHeader.offsets[PSX::LevelExtra::N_OXIDE_GHOST] > 0)
+				if (offEnd <= offGhost || !lev.Contains<uint8_t>(offGhost, offEnd - offGhost)) { return; }
+				ghost.assign(lev.data + offGhost, lev.data + offEnd);
+			};
+
+		const size_t offTropyGhost = extraHeader.offsets[PSX::LevelExtra::N_TROPY_GHOST];
+		const size_t offOxideGhost = extraHeader.offsets[PSX::LevelExtra::N_OXIDE_GHOST];
+		const bool hasOxideGhost = extraHeader.count >= PSX::LevelExtra::N_OXIDE_GHOST + 1 && offOxideGhost > 0;
+		if (extraHeader.count >= PSX::LevelExtra::N_TROPY_GHOST + 1 && offTropyGhost > 0)
 		{
-			file.seekg(offLev + std::streampos(extraHeader.offsets[PSX::LevelExtra::N_OXIDE_GHOST]));
-			size_t ghostSize = header.offLevNavTable - extraHeader.offsets[PSX::LevelExtra::N_OXIDE_GHOST];
-			m_oxideGhost.resize(ghostSize);
-			file.read(reinterpret_cast<char*>(m_oxideGhost.data()), ghostSize);
+			ReadGhost(offTropyGhost, hasOxideGhost ? offOxideGhost : header.offLevNavTable, m_tropyGhost);
 		}
+		if (hasOxideGhost) { ReadGhost(offOxideGhost, header.offLevNavTable, m_oxideGhost); }
 	}
 
 	m_loaded = true;
-	file.close();
 	GenerateRenderLevData();
 	return true;
 }
 
+/*
+	Open addressing table handing out texture group ids in insertion order.
+	Each slot holds the id of a stored layout, probed linearly from the layout hash,
+	so a lookup and an insertion share the same single probe sequence.
+*/
+class TextureLayoutTable
+{
+public:
+	TextureLayoutTable(size_t expectedCount)
+	{
+		m_slots.assign(std::bit_ceil(std::max<size_t>(expectedCount * 2, 64)), EMPTY_SLOT);
+		m_layouts.reserve(expectedCount);
+	}
+
+	size_t FindOrInsert(const PSX::TextureLayout& layout, bool& inserted)
+	{
+		if ((m_layouts.size() + 1) * 2 > m_slots.size()) { Grow(); }
+		const size_t mask = m_slots.size() - 1;
+		for (size_t slot = std::hash<PSX::TextureLayout>{}(layout) & mask;; slot = (slot + 1) & mask)
+		{
+			const uint32_t id = m_slots[slot];
+			if (id == EMPTY_SLOT)
+			{
+				m_slots[slot] = static_cast<uint32_t>(m_layouts.size());
+				m_layouts.push_back(layout);
+				inserted = true;
+				return m_layouts.size() - 1;
+			}
+			if (m_layouts[id] == layout) { inserted = false; return id; }
+		}
+	}
+
+private:
+	void Grow()
+	{
+		std::vector<uint32_t> slots(m_slots.size() * 2, EMPTY_SLOT);
+		const size_t mask = slots.size() - 1;
+		for (size_t id = 0; id < m_layouts.size(); id++)
+		{
+			size_t slot = std::hash<PSX::TextureLayout>{}(m_layouts[id]) & mask;
+			while (slots[slot] != EMPTY_SLOT) { slot = (slot + 1) & mask; }
+			slots[slot] = static_cast<uint32_t>(id);
+		}
+		m_slots.swap(slots);
+	}
+
+private:
+	static constexpr uint32_t EMPTY_SLOT = std::numeric_limits<uint32_t>::max();
+	std::vector<uint32_t> m_slots;
+	std::vector<PSX::TextureLayout> m_layouts;
+};
+
 bool Level::SaveLEV(const std::filesystem::path& path)
 {
 	/*
@@ -878,14 +1107,25 @@ bool Level::SaveLEV(const std::filesystem::path& path)
 	*		- VisMem
 	*		- PointerMap
 	*/
+	ScopedTimer timer("SaveLEV");
 	m_hotReloadLevPath = path / (m_name + ".lev");
-	std::ofstream file(m_hotReloadLevPath, std::ios::binary);
 
 	if (m_bsp.IsEmpty()) { GenerateBSP(); }
+	bool staleVisTree = false;
+	if (m_genVisTree && !m_bspVis.IsEmpty())
+	{
+		for (const Quadblock& quadblock : m_quadblocks) { if (quadblock.GetVisTreeDirty()) { staleVisTree = true; break; } }
+	}
+	if (staleVisTree)
+	{
+		m_showLogWindow = true;
+		m_logMessage += "\nError: quadblocks were edited since the last vis tree bake. Update the vis tree before saving: " + m_hotReloadLevPath.string();
+		return false;
+	}
+
+	std::ofstream file(m_hotReloadLevPath, std::ios::binary);
 
-	std::vector<const BSP*> bspNodes = m_bsp.GetTree();
-	std::vector<const BSP*> orderedBSPNodes(bspNodes.size());
-	for (const BSP* bsp : bspNodes) { orderedBSPNodes[bsp->GetId()] = bsp; }
+	const std::vector<BSPTreeNode>& bspNodes = m_bsp.GetNodes();
 
 	PSX::LevHeader header = {};
 	const size_t offHeader = 0;
@@ -912,42 +1152,63 @@ bool Level::SaveLEV(const std::filesystem::path& path)
 	defaultTexGroup.near = defaultTex;
 	defaultTexGroup.mosaic = defaultTex;
 
+	ScopedTimer texturesTimer("SaveLEV/textures");
 	std::vector<uint8_t> animData;
 	std::vector<size_t> animPtrMapOffsets;
 	std::vector<PSX::TextureGroup> texGroups;
-	std::unordered_map<PSX::TextureLayout, size_t> savedLayouts;
+	TextureLayoutTable savedLayouts(m_quadblocks.size());
+	auto GetTextureID = [&savedLayouts, &texGroups](const PSX::TextureLayout& layout) -> size_t
+		{
+			bool inserted = false;
+			const size_t textureID = savedLayouts.FindOrInsert(layout, inserted);
+			if (inserted)
+			{
+				PSX::TextureGroup texGroup = {};
+				texGroup.far = layout;
+				texGroup.middle = layout;
+				texGroup.near = layout;
+				texGroup.mosaic = layout;
+				texGroups.push_back(texGroup);
+			}
+			return textureID;
+		};
+
 	if (UpdateVRM())
 	{
-		for (auto& [material, texture] : m_materialToTexture)
+		/*
+			The layouts only depend on each quadblock's texture and UVs, so they're all computed in parallel first.
+			Ids are then handed out serially in material order, which keeps the texture groups in the same order as before.
+		*/
+		std::vector<size_t> layoutQuads;
+		std::vector<const Texture*> layoutTextures;
+		layoutQuads.reserve(m_quadblocks.size());
+		layoutTextures.reserve(m_quadblocks.size());
+		for (const auto& [material, texture] : m_materialToTexture)
 		{
-			std::vector<size_t>& quadIndexes = m_materialToQuadblocks[material];
-			for (size_t index : quadIndexes)
+			for (size_t index : m_materialToQuadblocks[material])
 			{
-				Quadblock& currQuad = m_quadblocks[index];
-				if (currQuad.GetAnimated()) { continue; }
-				for (size_t i = 0; i < NUM_FACES_QUADBLOCK + 1; i++)
-				{
-					size_t textureID = 0;
-					const QuadUV& uvs = currQuad.GetQuadUV(i);
-					PSX::TextureLayout layout = texture.Serialize(uvs);
-					if (savedLayouts.contains(layout)) { textureID = savedLayouts[layout]; }
-					else
-					{
-						textureID = texGroups.size();
-						savedLayouts[layout] = textureID;
-
-						PSX::TextureGroup texGroup = {};
-						texGroup.far = layout;
-						texGroup.middle = layout;
-						texGroup.near = layout;
-						texGroup.mosaic = layout;
-						texGroups.push_back(texGroup);
-					}
-					currQuad.SetTextureID(textureID, i);
-				}
+				if (m_quadblocks[index].GetAnimated()) { continue; }
+				layoutQuads.push_back(index);
+				layoutTextures.push_back(&texture);
 			}
 		}
 
+		constexpr size_t LAYOUTS_PER_QUAD = NUM_FACES_QUADBLOCK + 1;
+		const int layoutQuadCount = static_cast<int>(layoutQuads.size());
+		std::vector<PSX::TextureLayout> quadLayouts(layoutQuads.size() * LAYOUTS_PER_QUAD);
+		#pragma omp parallel for schedule(static)
+		for (int i = 0; i < layoutQuadCount; i++)
+		{
+			const Quadblock& currQuad = m_quadblocks[layoutQuads[i]];
+			for (size_t j = 0; j < LAYOUTS_PER_QUAD; j++) { quadLayouts[i * LAYOUTS_PER_QUAD + j] = layoutTextures[i]->Serialize(currQuad.GetQuadUV(j)); }
+		}
+
+		for (size_t i = 0; i < layoutQuads.size(); i++)
+		{
+			Quadblock& currQuad = m_quadblocks[layoutQuads[i]];
+			for (size_t j = 0; j < LAYOUTS_PER_QUAD; j++) { currQuad.SetTextureID(GetTextureID(quadLayouts[i * LAYOUTS_PER_QUAD + j]), j); }
+		}
+
 		if (!m_animTextures.empty())
 		{
 			std::vector<std::array<size_t, NUM_FACES_QUADBLOCK>> animOffsetPerQuadblock;
@@ -963,22 +1224,7 @@ bool Level::SaveLEV(const std::filesystem::path& path)
 					for (size_t i = 0; i < NUM_FACES_QUADBLOCK + 1; i++)
 					{
 						if (i == NUM_FACES_QUADBLOCK && !firstFrame) { continue; }
-						size_t textureID = 0;
-						const QuadUV& uvs = frame.uvs[i];
-						PSX::TextureLayout layout = texture.Serialize(uvs);
-						if (savedLayouts.contains(layout)) { textureID = savedLayouts[layout]; }
-						else
-						{
-							textureID = texGroups.size();
-							savedLayouts[layout] = textureID;
-
-							PSX::TextureGroup texGroup = {};
-							texGroup.far = layout;
-							texGroup.middle = layout;
-							texGroup.near = layout;
-							texGroup.mosaic = layout;
-							texGroups.push_back(texGroup);
-						}
+						const size_t textureID = GetTextureID(texture.Serialize(frame.uvs[i]));
 						if (firstFrame && i == NUM_FACES_QUADBLOCK)
 						{
 							const std::vector<size_t>& quadblockIndexes = animTex.GetQuadblockIndexes();
@@ -1065,116 +1311,126 @@ bool Level::SaveLEV(const std::filesystem::path& path)
 	}
 
 	currOffset += (sizeof(PSX::TextureGroup) * texGroups.size()) + animData.size();
+	texturesTimer.Stop();
 
+	/*
+		Layout pass: once the quadblock order and the vertex list are known every section has a fixed size,
+		so all offsets are resolved up front and each section is then serialized in place into a single buffer.
+	*/
+	ScopedTimer layoutTimer("SaveLEV/layout");
 	const size_t offQuadblocks = currOffset;
-	std::vector<std::vector<uint8_t>> serializedBSPs;
-	std::vector<std::vector<uint8_t>> serializedQuads;
 	std::vector<const Quadblock*> orderedQuads;
-	std::unordered_map<Vertex, size_t> vertexMap;
-	std::vector<Vertex> orderedVertices;
-	size_t bspSize = 0;
-	for (const BSP* bsp : orderedBSPNodes)
-	{
-		serializedBSPs.push_back(bsp->Serialize(currOffset));
-		bspSize += serializedBSPs.back().size();
-		if (bsp->IsBranch()) { continue; }
-		const std::vector<size_t>& quadIndexes = bsp->GetQuadblockIndexes();
-		for (const size_t index : quadIndexes)
+	std::vector<size_t> quadVertexIndexes;
+	std::vector<size_t> leafOffQuads(bspNodes.size(), 0);
+	VertexWelder vertexWelder(m_quadblocks.size() * 4);
+	orderedQuads.reserve(m_quadblocks.size());
+	quadVertexIndexes.reserve(m_quadblocks.size() * NUM_VERTICES_QUADBLOCK);
+	for (uint32_t id = 0; id < bspNodes.size(); id++)
+	{
+		if (bspNodes[id].IsBranch()) { continue; }
+		leafOffQuads[id] = currOffset;
+		for (const size_t index : m_bsp.GetQuadblockIndexes(id))
 		{
 			const Quadblock& quadblock = m_quadblocks[index];
-			std::vector<Vertex> quadVertices = quadblock.GetVertices();
-			std::vector<size_t> verticesIndexes;
-			for (const Vertex& vertex : quadVertices)
-			{
-				if (!vertexMap.contains(vertex))
-				{
-					size_t vertexIndex = orderedVertices.size();
-					orderedVertices.push_back(vertex);
-					vertexMap[vertex] = vertexIndex;
-				}
-				verticesIndexes.push_back(vertexMap[vertex]);
-			}
-			size_t quadIndex = serializedQuads.size();
-			serializedQuads.push_back(quadblock.Serialize(quadIndex, offTexture, verticesIndexes));
+			for (const Vertex* vertex : quadblock.GetVertices()) { quadVertexIndexes.push_back(vertexWelder.Weld(*vertex)); }
 			orderedQuads.push_back(&quadblock);
-			currOffset += serializedQuads.back().size();
+			currOffset += sizeof(PSX::Quadblock);
 		}
 	}
 
+	const std::vector<const Vertex*>& orderedVertices = vertexWelder.GetVertices();
+
 	constexpr size_t BITS_PER_SLOT = sizeof(uint32_t) * 8;
-	std::vector<std::tuple<std::vector<uint32_t>, size_t>> visibleNodes;
-	std::vector<std::tuple<std::vector<uint32_t>, size_t>> visibleQuads;
-	std::vector<std::tuple<std::vector<uint32_t>, size_t>> visibleInstances;
 	size_t visNodeSize = static_cast<size_t>(std::ceil(static_cast<float>(bspNodes.size()) / static_cast<float>(BITS_PER_SLOT)));
 	size_t visQuadSize = static_cast<size_t>(std::ceil(static_cast<float>(m_quadblocks.size()) / static_cast<float>(BITS_PER_SLOT)));
-	std::vector<uint32_t> visibleNodeAll(visNodeSize, 0xFFFFFFFF);
-	for (const BSP* bsp : orderedBSPNodes)
-	{
-		if (bsp->GetFlags() & BSPFlags::INVISIBLE) { visibleNodeAll[bsp->GetId() / BITS_PER_SLOT] &= ~(1 << (bsp->GetId() % BITS_PER_SLOT)); }
-	}
-
-	std::vector<uint32_t> visibleQuadsAll(visQuadSize, 0xFFFFFFFF);
-	size_t quadIndex = 0;
 	const bool validVisTree = m_genVisTree && !m_bspVis.IsEmpty();
-	const std::vector<const BSP*> bspLeaves = m_bsp.GetLeaves();
-	std::unordered_map<size_t, const BSP*> idToLeaf;
-	std::unordered_map<const BSP*, size_t> leafToMatrix;
-	for (const BSP* leaf : bspLeaves) { idToLeaf[leaf->GetId()] = leaf; }
-	for (size_t i = 0; i < bspLeaves.size(); i++) { leafToMatrix[bspLeaves[i]] = i; }
-	for (const Quadblock* quad : orderedQuads)
-	{
-		if (quad->GetFlags() & (QuadFlags::INVISIBLE | QuadFlags::INVISIBLE_TRIGGER))
+
+	/*
+		Every quadblock in a leaf sees the same nodes, so the visible node bitsets are built once per leaf
+		and leaves that end up with identical bitsets share a single copy in the file.
+	*/
+	BitMatrix leafVisNodes;
+	std::vector<size_t> visNodeRowLeaves;
+	std::vector<size_t> quadVisNodeRows(orderedQuads.size(), 0);
+	if (validVisTree)
+	{
+		const std::vector<uint32_t>& bspLeaves = m_bsp.GetLeaves();
+		std::vector<size_t> idToMatrix(bspNodes.size());
+		for (size_t i = 0; i < bspLeaves.size(); i++) { idToMatrix[bspLeaves[i]] = i; }
+
+		// Each leaf sees its own node and every parent up to the root
+		BitMatrix leafToNodes(bspLeaves.size(), bspNodes.size());
+		for (size_t i = 0; i < bspLeaves.size(); i++)
 		{
-			visibleQuadsAll[quadIndex / BITS_PER_SLOT] &= ~(1 << (quadIndex % BITS_PER_SLOT));
+			for (uint32_t curr = bspLeaves[i]; curr != BSP_NODE_NONE; curr = bspNodes[curr].parent) { leafToNodes.Set(true, i, curr); }
 		}
-		if (validVisTree)
+
+		const int leafCount = static_cast<int>(bspLeaves.size());
+		leafVisNodes = BitMatrix(bspLeaves.size(), bspNodes.size());
+		#pragma omp parallel for schedule(dynamic, 16)
+		for (int leaf = 0; leaf < leafCount; leaf++)
 		{
-			std::vector<uint32_t> visNodes(visNodeSize, 0x0);
-			const BSP* bspLeaf = idToLeaf[quad->GetBSPID()];
-			const size_t matrixId = leafToMatrix[bspLeaf];
-			for (size_t i = 0; i < bspLeaves.size(); i++)
+			const uint64_t* visLeaves = m_bspVis.GetRow(leaf);
+			for (size_t word = 0; word < m_bspVis.GetRowWords(); word++)
 			{
-				if (m_bspVis.Get(matrixId, i))
+				uint64_t bits = visLeaves[word];
+				while (bits != 0)
 				{
-					const BSP* curr = bspLeaves[i];
-					while (curr != nullptr)
-					{
-						visNodes[curr->GetId() / BITS_PER_SLOT] |= (1 << (31 - (curr->GetId() % BITS_PER_SLOT)));
-						curr = curr->GetParent();
-					}
+					leafVisNodes.OrRow(leaf, leafToNodes, (word * 64) + std::countr_zero(bits));
+					bits &= bits - 1;
 				}
 			}
-			visibleNodes.push_back({visNodes, currOffset});
-			currOffset += visNodes.size() * sizeof(uint32_t);
 		}
-		quadIndex++;
-	}
 
-	if (!validVisTree)
-	{
-		visibleNodes.push_back({visibleNodeAll, currOffset});
-		currOffset += visibleNodeAll.size() * sizeof(uint32_t);
+		const size_t rowBytes = leafVisNodes.GetRowWords() * sizeof(uint64_t);
+		std::unordered_map<uint64_t, std::vector<size_t>> rowBuckets;
+		std::vector<size_t> leafToRow(bspLeaves.size());
+		for (size_t leaf = 0; leaf < bspLeaves.size(); leaf++)
+		{
+			const uint64_t* row = leafVisNodes.GetRow(leaf);
+			uint64_t hash = 0xCBF29CE484222325;
+			for (size_t word = 0; word < leafVisNodes.GetRowWords(); word++) { HashBytes(hash, row[word]); }
+
+			std::vector<size_t>& bucket = rowBuckets[hash];
+			bool found = false;
+			for (size_t visNodeRow : bucket)
+			{
+				if (std::memcmp(leafVisNodes.GetRow(visNodeRowLeaves[visNodeRow]), row, rowBytes) == 0)
+				{
+					leafToRow[leaf] = visNodeRow;
+					found = true;
+					break;
+				}
+			}
+			if (found) { continue; }
+			leafToRow[leaf] = visNodeRowLeaves.size();
+			bucket.push_back(visNodeRowLeaves.size());
+			visNodeRowLeaves.push_back(leaf);
+		}
+		for (size_t i = 0; i < orderedQuads.size(); i++) { quadVisNodeRows[i] = leafToRow[idToMatrix[orderedQuads[i]->GetBSPID()]]; }
 	}
 
-	visibleQuads.push_back({visibleQuadsAll, currOffset});
-	currOffset += visibleQuadsAll.size() * sizeof(uint32_t);
+	const size_t offVisibleNodes = currOffset;
+	const size_t visNodeBytes = visNodeSize * sizeof(uint32_t);
+	currOffset += validVisTree ? visNodeRowLeaves.size() * visNodeBytes : visNodeBytes;
 
-	std::vector<uint32_t> visibleInstancesDummy;
-	visibleInstancesDummy.push_back(0);
-	visibleInstances.push_back({visibleInstancesDummy, currOffset});
-	currOffset += visibleInstancesDummy.size() * sizeof(uint32_t);
+	const size_t offVisibleQuads = currOffset;
+	currOffset += visQuadSize * sizeof(uint32_t);
+
+	const size_t offVisibleInstances = currOffset;
+	currOffset += sizeof(uint32_t);
 
 	std::unordered_map<PSX::VisibleSet, size_t> visibleSetMap;
 	std::vector<PSX::VisibleSet> visibleSets;
+	std::vector<size_t> quadVisibleSets(orderedQuads.size());
 	const size_t offVisibleSet = currOffset;
 
 	for (size_t quadCount = 0; quadCount < orderedQuads.size(); quadCount++)
 	{
 		PSX::VisibleSet set = {};
-		if (validVisTree) { set.offVisibleBSPNodes = static_cast<uint32_t>(std::get<size_t>(visibleNodes[quadCount])); }
-		else { set.offVisibleBSPNodes = static_cast<uint32_t>(std::get<size_t>(visibleNodes[0])); }
-		set.offVisibleQuadblocks = static_cast<uint32_t>(std::get<size_t>(visibleQuads[0]));
-		set.offVisibleInstances = static_cast<uint32_t>(std::get<size_t>(visibleInstances[0]));
+		set.offVisibleBSPNodes = static_cast<uint32_t>(offVisibleNodes + quadVisNodeRows[quadCount] * visNodeBytes);
+		set.offVisibleQuadblocks = static_cast<uint32_t>(offVisibleQuads);
+		set.offVisibleInstances = static_cast<uint32_t>(offVisibleInstances);
 		set.offVisibleExtra = 0;
 
 		size_t visibleSetIndex = 0;
@@ -1185,40 +1441,28 @@ bool Level::SaveLEV(const std::filesystem::path& path)
 			visibleSets.push_back(set);
 			visibleSetMap[set] = visibleSetIndex;
 		}
-
-		PSX::Quadblock* serializedQuad = reinterpret_cast<PSX::Quadblock*>(serializedQuads[quadCount].data());
-		serializedQuad->offVisibleSet = static_cast<uint32_t>(offVisibleSet + sizeof(PSX::VisibleSet) * visibleSetIndex);
+		quadVisibleSets[quadCount] = visibleSetIndex;
 	}
 
 	currOffset += visibleSets.size() * sizeof(PSX::VisibleSet);
 
 	const size_t offVertices = currOffset;
-	std::vector<std::vector<uint8_t>> serializedVertices;
-	for (const Vertex& vertex : orderedVertices)
-	{
-		serializedVertices.push_back(vertex.Serialize());
-		currOffset += serializedVertices.back().size();
-	}
+	currOffset += orderedVertices.size() * sizeof(PSX::Vertex);
 
 	const size_t offBSP = currOffset;
-	currOffset += bspSize;
+	currOffset += bspNodes.size() * sizeof(PSX::BSPBranch);
 
-	meshInfo.numQuadblocks = static_cast<uint32_t>(serializedQuads.size());
-	meshInfo.numVertices = static_cast<uint32_t>(serializedVertices.size());
+	meshInfo.numQuadblocks = static_cast<uint32_t>(orderedQuads.size());
+	meshInfo.numVertices = static_cast<uint32_t>(orderedVertices.size());
 	meshInfo.offQuadblocks = static_cast<uint32_t>(offQuadblocks);
 	meshInfo.offVertices = static_cast<uint32_t>(offVertices);
 	meshInfo.unk1 = 0;
 	meshInfo.unk2 = 0;
 	meshInfo.offBSPNodes = static_cast<uint32_t>(offBSP);
-	meshInfo.numBSPNodes = static_cast<uint32_t>(serializedBSPs.size());
+	meshInfo.numBSPNodes = static_cast<uint32_t>(bspNodes.size());
 
 	const size_t offCheckpoints = currOffset;
-	std::vector<std::vector<uint8_t>> serializedCheckpoints;
-	for (const Checkpoint& checkpoint : m_checkpoints)
-	{
-		serializedCheckpoints.push_back(checkpoint.Serialize());
-		currOffset += serializedCheckpoints.back().size();
-	}
+	currOffset += m_checkpoints.size() * sizeof(PSX::Checkpoint);
 
 	const size_t offTropyGhost = m_tropyGhost.empty() ? 0 : currOffset;
 	currOffset += m_tropyGhost.size();
@@ -1250,13 +1494,11 @@ bool Level::SaveLEV(const std::filesystem::path& path)
 	const size_t offNavHeaders = currOffset;
 	currOffset += navHeaders.size() * sizeof(PSX::NavHeader);
 
-	std::vector<uint32_t> visMemNodesP1(visNodeSize);
 	const size_t offVisMemNodesP1 = currOffset;
-	currOffset += visMemNodesP1.size() * sizeof(uint32_t);
+	currOffset += visNodeSize * sizeof(uint32_t);
 
-	std::vector<uint32_t> visMemQuadsP1(visQuadSize);
 	const size_t offVisMemQuadsP1 = currOffset;
-	currOffset += visMemQuadsP1.size() * sizeof(uint32_t);
+	currOffset += visQuadSize * sizeof(uint32_t);
 
 	std::vector<uint32_t> visMemBSPP1(bspNodes.size() * 2);
 	const size_t offVisMemBSPP1 = currOffset;
@@ -1328,6 +1570,7 @@ bool Level::SaveLEV(const std::filesystem::path& path)
 		CALCULATE_OFFSET(PSX::VisualMem, offQuads[0], offVisMem),
 		CALCULATE_OFFSET(PSX::VisualMem, offBSP[0], offVisMem),
 	};
+	pointerMap.reserve(pointerMap.size() + animPtrMapOffsets.size() + orderedQuads.size() * 6 + bspNodes.size() * 2 + visibleSets.size() * 3 + skyboxPtrMapOffsets.size() + 3);
 
 	// Add skybox header pointer to pointer map
 	if (m_skybox.IsReady())
@@ -1344,7 +1587,7 @@ bool Level::SaveLEV(const std::filesystem::path& path)
 	}
 
 	size_t offCurrQuad = offQuadblocks;
-	for (size_t i = 0; i < serializedQuads.size(); i++)
+	for (size_t i = 0; i < orderedQuads.size(); i++)
 	{
 		pointerMap.push_back(CALCULATE_OFFSET(PSX::Quadblock, offMidTextures[0], offCurrQuad));
 		pointerMap.push_back(CALCULATE_OFFSET(PSX::Quadblock, offMidTextures[1], offCurrQuad));
@@ -1352,18 +1595,18 @@ bool Level::SaveLEV(const std::filesystem::path& path)
 		pointerMap.push_back(CALCULATE_OFFSET(PSX::Quadblock, offMidTextures[3], offCurrQuad));
 		pointerMap.push_back(CALCULATE_OFFSET(PSX::Quadblock, offLowTexture, offCurrQuad));
 		pointerMap.push_back(CALCULATE_OFFSET(PSX::Quadblock, offVisibleSet, offCurrQuad));
-		offCurrQuad += serializedQuads[i].size();
+		offCurrQuad += sizeof(PSX::Quadblock);
 	}
 
 	size_t offCurrNode = offBSP;
-	for (size_t i = 0; i < serializedBSPs.size(); i++)
+	for (size_t i = 0; i < bspNodes.size(); i++)
 	{
-		if (orderedBSPNodes[i]->IsBranch()) { offCurrNode += serializedBSPs[i].size(); continue; }
+		if (bspNodes[i].IsBranch()) { offCurrNode += sizeof(PSX::BSPBranch); continue; }
 		size_t visMemListIndex = 2 * i + 1;
 		visMemBSPP1[visMemListIndex] = static_cast<uint32_t>(offCurrNode);
 		pointerMap.push_back(static_cast<uint32_t>(offVisMemBSPP1 + visMemListIndex * sizeof(uint32_t)));
 		pointerMap.push_back(CALCULATE_OFFSET(PSX::BSPLeaf, offQuads, offCurrNode));
-		offCurrNode += serializedBSPs[i].size();
+		offCurrNode += sizeof(PSX::BSPLeaf);
 	}
 
 	size_t offCurrVisibleSet = offVisibleSet;
@@ -1381,94 +1624,299 @@ bool Level::SaveLEV(const std::filesystem::path& path)
 		pointerMap.push_back(static_cast<uint32_t>(offset));
 	}
 
-	const size_t pointerMapBytes = pointerMap.size() * sizeof(uint32_t);
+	const uint32_t pointerMapBytes = static_cast<uint32_t>(pointerMap.size() * sizeof(uint32_t));
 
-	Write(file, &offPointerMap, sizeof(uint32_t));
-	Write(file, &header, sizeof(header));
-	Write(file, &meshInfo, sizeof(meshInfo));
-	Write(file, texGroups.data(), texGroups.size() * sizeof(PSX::TextureGroup));
-	if (!animData.empty()) { Write(file, animData.data(), animData.size()); }
-	for (const std::vector<uint8_t>& serializedQuad : serializedQuads) { Write(file, serializedQuad.data(), serializedQuad.size()); }
-	for (const auto& tuple : visibleNodes)
-	{
-		const std::vector<uint32_t>& visibleNode = std::get<0>(tuple);
-		Write(file, visibleNode.data(), visibleNode.size() * sizeof(uint32_t));
-	}
-	for (const auto& tuple : visibleQuads)
-	{
-		const std::vector<uint32_t>& visibleQuad = std::get<0>(tuple);
-		Write(file, visibleQuad.data(), visibleQuad.size() * sizeof(uint32_t));
-	}
-	for (const auto& tuple : visibleInstances)
-	{
-		const std::vector<uint32_t>& visibleInst = std::get<0>(tuple);
-		Write(file, visibleInst.data(), visibleInst.size() * sizeof(uint32_t));
-	}
-	Write(file, visibleSets.data(), visibleSets.size() * sizeof(PSX::VisibleSet));
-	for (const std::vector<uint8_t>& serializedVertex : serializedVertices) { Write(file, serializedVertex.data(), serializedVertex.size()); }
-	for (const std::vector<uint8_t>& serializedBSP : serializedBSPs) { Write(file, serializedBSP.data(), serializedBSP.size()); }
-	for (const std::vector<uint8_t>& serializedCheckpoint : serializedCheckpoints) { Write(file, serializedCheckpoint.data(), serializedCheckpoint.size()); }
-	if (!m_tropyGhost.empty()) { Write(file, m_tropyGhost.data(), m_tropyGhost.size()); }
-	if (!m_oxideGhost.empty()) { Write(file, m_oxideGhost.data(), m_oxideGhost.size()); }
-	Write(file, &extraHeader, sizeof(extraHeader));
-	Write(file, navHeaders.data(), navHeaders.size() * sizeof(PSX::NavHeader));
-	Write(file, visMemNodesP1.data(), visMemNodesP1.size() * sizeof(uint32_t));
-	Write(file, visMemQuadsP1.data(), visMemQuadsP1.size() * sizeof(uint32_t));
-	Write(file, visMemBSPP1.data(), visMemBSPP1.size() * sizeof(uint32_t));
-	Write(file, &visMem, sizeof(visMem));
-	// Write skybox data if present
-	if (!skyboxData.empty()) { Write(file, skyboxData.data(), skyboxData.size()); }
-	Write(file, &pointerMapBytes, sizeof(uint32_t));
-	Write(file, pointerMap.data(), pointerMapBytes);
+	/*
+		Fill pass: the file is the offset to the pointer map, the sections addressed by the offsets
+		computed above, and the pointer map itself. Offsets are relative to the end of the first word.
+	*/
+	layoutTimer.Stop();
+	ScopedTimer serializeTimer("SaveLEV/serialize");
+	std::vector<uint8_t> lev(sizeof(uint32_t) + offPointerMap + sizeof(uint32_t) + pointerMapBytes);
+	uint8_t* levData = lev.data() + sizeof(uint32_t);
+	auto WriteAt = [levData](size_t offset, const void* data, size_t size)
+		{
+			if (size > 0) { std::memcpy(levData + offset, data, size); }
+		};
+
+	const uint32_t offPointerMapWord = static_cast<uint32_t>(offPointerMap);
+	std::memcpy(lev.data(), &offPointerMapWord, sizeof(uint32_t));
+	WriteAt(offHeader, &header, sizeof(header));
+	WriteAt(offMeshInfo, &meshInfo, sizeof(meshInfo));
+	WriteAt(offTexture, texGroups.data(), texGroups.size() * sizeof(PSX::TextureGroup));
+	WriteAt(offTexture + texGroups.size() * sizeof(PSX::TextureGroup), animData.data(), animData.size());
+
+	std::vector<uint32_t> visibleQuadsAll(visQuadSize, 0xFFFFFFFF);
+	for (size_t i = 0; i < orderedQuads.size(); i++)
+	{
+		if (orderedQuads[i]->GetFlags() & (QuadFlags::INVISIBLE | QuadFlags::INVISIBLE_TRIGGER))
+		{
+			visibleQuadsAll[i / BITS_PER_SLOT] &= ~(1 << (i % BITS_PER_SLOT));
+		}
+	}
+
+	if (!validVisTree)
+	{
+		std::vector<uint32_t> visibleNodeAll(visNodeSize, 0xFFFFFFFF);
+		for (size_t id = 0; id < bspNodes.size(); id++)
+		{
+			if (bspNodes[id].flags & BSPFlags::INVISIBLE) { visibleNodeAll[id / BITS_PER_SLOT] &= ~(1 << (id % BITS_PER_SLOT)); }
+		}
+		WriteAt(offVisibleNodes, visibleNodeAll.data(), visNodeBytes);
+	}
+
+	/*
+		Every element of the big sections lands at an offset fixed by the layout pass, so the sections are
+		split across the worker threads without any ordering between them and the output matches the serial writer.
+	*/
+	const int quadCount = static_cast<int>(orderedQuads.size());
+	const int visNodeRowCount = static_cast<int>(visNodeRowLeaves.size());
+	const int vertexCount = static_cast<int>(orderedVertices.size());
+	const int nodeCount = static_cast<int>(bspNodes.size());
+	#pragma omp parallel
+	{
+		#pragma omp for schedule(static) nowait
+		for (int i = 0; i < quadCount; i++)
+		{
+			const size_t offQuad = offQuadblocks + i * sizeof(PSX::Quadblock);
+			orderedQuads[i]->Serialize(i, offTexture, &quadVertexIndexes[i * NUM_VERTICES_QUADBLOCK], levData + offQuad);
+			const uint32_t offQuadVisibleSet = static_cast<uint32_t>(offVisibleSet + sizeof(PSX::VisibleSet) * quadVisibleSets[i]);
+			WriteAt(offQuad + offsetof(PSX::Quadblock, offVisibleSet), &offQuadVisibleSet, sizeof(uint32_t));
+		}
+
+		#pragma omp for schedule(static) nowait
+		for (int i = 0; i < visNodeRowCount; i++) { leafVisNodes.GetPSXRow(visNodeRowLeaves[i], levData + offVisibleNodes + i * visNodeBytes); }
+
+		#pragma omp for schedule(static) nowait
+		for (int i = 0; i < vertexCount; i++) { orderedVertices[i]->Serialize(levData + offVertices + i * sizeof(PSX::Vertex)); }
+
+		#pragma omp for schedule(static) nowait
+		for (int id = 0; id < nodeCount; id++) { m_bsp.Serialize(id, leafOffQuads[id], levData + offBSP + id * sizeof(PSX::BSPBranch)); }
+	}
+	WriteAt(offVisibleQuads, visibleQuadsAll.data(), visibleQuadsAll.size() * sizeof(uint32_t));
+	const uint32_t visibleInstancesDummy = 0;
+	WriteAt(offVisibleInstances, &visibleInstancesDummy, sizeof(uint32_t));
+	WriteAt(offVisibleSet, visibleSets.data(), visibleSets.size() * sizeof(PSX::VisibleSet));
+	for (size_t i = 0; i < m_checkpoints.size(); i++) { m_checkpoints[i].Serialize(levData + offCheckpoints + i * sizeof(PSX::Checkpoint)); }
+	WriteAt(offTropyGhost, m_tropyGhost.data(), m_tropyGhost.size());
+	WriteAt(offOxideGhost, m_oxideGhost.data(), m_oxideGhost.size());
+	WriteAt(offExtraHeader, &extraHeader, sizeof(extraHeader));
+	WriteAt(offNavHeaders, navHeaders.data(), navHeaders.size() * sizeof(PSX::NavHeader));
+	WriteAt(offVisMemBSPP1, visMemBSPP1.data(), visMemBSPP1.size() * sizeof(uint32_t));
+	WriteAt(offVisMem, &visMem, sizeof(visMem));
+	WriteAt(offSkyboxData, skyboxData.data(), skyboxData.size());
+	WriteAt(offPointerMap, &pointerMapBytes, sizeof(uint32_t));
+	WriteAt(offPointerMap + sizeof(uint32_t), pointerMap.data(), pointerMapBytes);
+
+	serializeTimer.Stop();
+
+	ScopedTimer writeTimer("SaveLEV/write");
+	Write(file, lev.data(), lev.size());
 	file.close();
+	Profiler::AddCount("SaveLEV/bytes", lev.size());
 	return true;
 }
 
-bool Level::LoadOBJ(const std::filesystem::path& objFile)
+static constexpr size_t OBJ_MAX_TOKENS = 8;
+static constexpr size_t OBJ_MIN_CHUNK_SIZE = 1 << 20;
+
+/*
+	One line of the OBJ, tokenized in place: the views point straight into the mapped file.
+	Only the first OBJ_MAX_TOKENS tokens are kept, but count holds the total so that n-gons can still be told apart from quads.
+*/
+struct OBJLine
 {
-	std::string line;
-	std::ifstream file(objFile);
-	m_name = objFile.filename().replace_extension().string();
-	m_parentPath = objFile.parent_path();
+	std::array<std::string_view, OBJ_MAX_TOKENS> tokens;
+	size_t count = 0;
+};
 
-	bool ret = true;
-	std::unordered_map<std::string, std::vector<Tri>> triMap;
-	std::unordered_map<std::string, std::vector<Quad>> quadMap;
-	std::unordered_map<std::string, std::vector<Vec3>> normalMap;
-	std::unordered_map<std::string, std::string> materialMap;
-	std::unordered_map<std::string, bool> meshMap;
-	std::unordered_set<std::string> materials;
+struct OBJFaceVertex
+{
+	int pos = 0;
+	int uv = 0;
+	int normal = 0;
+	bool hasUV = false;
+};
+
+/* Face indexes exactly as written in the file, they're only checked once every chunk has been parsed */
+struct OBJFace
+{
+	std::array<OBJFaceVertex, 4> vertices;
+	size_t vertexCount = 0; /* 0 if the line lists less than 3 vertices */
+	bool hasNormals = true;
+};
+
+enum class OBJCommand : uint8_t
+{
+	OBJECT, MATERIAL, FACE, UV_WARNING, NUMBER_ERROR
+};
+
+struct OBJRecord
+{
+	OBJCommand command;
+	size_t index; /* into the chunk names for OBJECT, MATERIAL and NUMBER_ERROR, into the chunk faces for FACE */
+};
+
+/*
+	Everything a worker reads out of one slice of the file. Vertex data goes to chunk local arrays, while every line that
+	depends on the parser state (current mesh, its material, whether its UVs are valid) is recorded in file order
+	and replayed serially once all chunks are done, so the result doesn't depend on how the file was split.
+*/
+struct OBJChunk
+{
+	std::string_view text;
 	std::vector<Point> vertices;
 	std::vector<Vec3> normals;
 	std::vector<Vec2> uvs;
-	std::string currQuadblockName;
-	bool currQuadblockGoodUV = true;
-	size_t quadblockCount = 0;
-	while (std::getline(file, line))
-	{
-		std::vector<std::string> tokens = Split(line);
-		if (tokens.empty()) { continue; }
-		const std::string& command = tokens[0];
+	std::vector<OBJFace> faces;
+	std::vector<std::string_view> names;
+	std::vector<OBJRecord> records;
+};
+
+/* One per "o" line, addressed by its position in the file */
+struct OBJMesh
+{
+	std::string name;
+	std::string material;
+	bool goodUV = true;
+	bool fetched = false;
+	bool built = false;
+};
+
+/* Faces of the mesh being read. Only the latest mesh can receive faces, so a single fixed buffer is reused for all of them */
+struct OBJFaceBuffer
+{
+	std::array<std::array<Point, 4>, 4> quads;
+	std::array<std::array<Point, 3>, 4> tris;
+	size_t quadCount = 0;
+	size_t triCount = 0;
+	Vec3 normalSum;
+};
+
+/* A mesh with all of its faces, waiting for its quadblock to be built */
+struct OBJBlock
+{
+	size_t mesh = 0;
+	bool isQuadblock = true;
+	std::array<std::array<Point, 4>, 4> points; /* the 4 quads, or the 4 tris in the first 3 points of each row */
+	Vec3 normal;
+	bool sameUVs = true;
+	size_t errorIndex = 0; /* position in the error log where the build errors of this block go */
+};
+
+static void TokenizeOBJLine(std::string_view line, OBJLine& out)
+{
+	out.count = 0;
+	size_t i = 0;
+	while (i < line.size())
+	{
+		while (i < line.size() && (line[i] == ' ' || line[i] == '\t' || line[i] == '\r')) { i++; }
+		if (i == line.size()) { break; }
+		const size_t start = i;
+		while (i < line.size() && line[i] != ' ' && line[i] != '\t' && line[i] != '\r') { i++; }
+		if (out.count < OBJ_MAX_TOKENS) { out.tokens[out.count] = line.substr(start, i - start); }
+		out.count++;
+	}
+}
+
+static bool ParseOBJFloat(std::string_view token, float& out)
+{
+	if (!token.empty() && token.front() == '+') { token.remove_prefix(1); }
+	return std::from_chars(token.data(), token.data() + token.size(), out).ec == std::errc();
+}
+
+static bool ParseOBJIndex(std::string_view token, int& out)
+{
+	if (!token.empty() && token.front() == '+') { token.remove_prefix(1); }
+	int index = 0;
+	if (std::from_chars(token.data(), token.data() + token.size(), index).ec != std::errc()) { return false; }
+	out = index - 1;
+	return true;
+}
+
+/* "pos/uv/normal", where the uv may be left empty. Returns false if the position or the normal is missing. */
+static bool ParseOBJFaceVertex(std::string_view token, OBJFaceVertex& out)
+{
+	const size_t first = token.find('/');
+	if (first == std::string_view::npos) { return false; }
+	const size_t second = token.find('/', first + 1);
+	if (second == std::string_view::npos) { return false; }
+	std::string_view normal = token.substr(second + 1);
+	normal = normal.substr(0, normal.find('/'));
+	out.hasUV = ParseOBJIndex(token.substr(first + 1, second - first - 1), out.uv);
+	return ParseOBJIndex(token.substr(0, first), out.pos) && ParseOBJIndex(normal, out.normal);
+}
+
+/* Splits the file right before "o" lines, aiming for chunkCount slices of about the same size */
+static std::vector<OBJChunk> SplitOBJChunks(std::string_view data, size_t chunkCount)
+{
+	std::vector<OBJChunk> chunks;
+	size_t start = 0;
+	for (size_t i = 1; i < chunkCount; i++)
+	{
+		size_t split = std::max(start, (data.size() / chunkCount) * i);
+		while (split != std::string_view::npos)
+		{
+			split = data.find("\no", split);
+			if (split == std::string_view::npos) { break; }
+			split++;
+			if (split + 1 < data.size() && (data[split + 1] == ' ' || data[split + 1] == '\t')) { break; }
+		}
+		if (split == std::string_view::npos) { break; }
+		chunks.emplace_back().text = data.substr(start, split - start);
+		start = split;
+	}
+	chunks.emplace_back().text = data.substr(start);
+	return chunks;
+}
+
+/* A vertex line whose numbers can't be read still takes its index, so that the faces after it keep pointing at the right data */
+static void AddOBJNumberError(OBJChunk& chunk, std::string_view command)
+{
+	chunk.records.push_back({OBJCommand::NUMBER_ERROR, chunk.names.size()});
+	chunk.names.push_back(command);
+}
+
+static void ParseOBJChunk(OBJChunk& chunk)
+{
+	const std::string_view data = chunk.text;
+	OBJLine line;
+	size_t lineStart = 0;
+	while (lineStart < data.size())
+	{
+		size_t lineEnd = data.find('\n', lineStart);
+		if (lineEnd == std::string_view::npos) { lineEnd = data.size(); }
+		TokenizeOBJLine(data.substr(lineStart, lineEnd - lineStart), line);
+		lineStart = lineEnd + 1;
+		if (line.count == 0) { continue; }
+
+		const std::array<std::string_view, OBJ_MAX_TOKENS>& tokens = line.tokens;
+		const std::string_view command = tokens[0];
 		if (command == "v")
 		{
-			if (tokens.size() < 4) { continue; }
-			vertices.emplace_back(std::stof(tokens[1]), std::stof(tokens[2]), std::stof(tokens[3]));
-			if (tokens.size() < 7) { continue; }
-			vertices.back().color = Color(std::stof(tokens[4]), std::stof(tokens[5]), std::stof(tokens[6]));
+			float x = 0.0f, y = 0.0f, z = 0.0f;
+			if (line.count < 4 || !ParseOBJFloat(tokens[1], x) || !ParseOBJFloat(tokens[2], y) || !ParseOBJFloat(tokens[3], z)) { AddOBJNumberError(chunk, command); }
+			chunk.vertices.emplace_back(x, y, z);
+			float r = 0.0f, g = 0.0f, b = 0.0f;
+			if (line.count < 7 || !ParseOBJFloat(tokens[4], r) || !ParseOBJFloat(tokens[5], g) || !ParseOBJFloat(tokens[6], b)) { continue; }
+			chunk.vertices.back().color = Color(r, g, b);
 		}
 		else if (command == "vn")
 		{
-			if (tokens.size() < 4) { continue; }
-			normals.emplace_back(std::stof(tokens[1]), std::stof(tokens[2]), std::stof(tokens[3]));
+			float x = 0.0f, y = 0.0f, z = 0.0f;
+			if (line.count < 4 || !ParseOBJFloat(tokens[1], x) || !ParseOBJFloat(tokens[2], y) || !ParseOBJFloat(tokens[3], z)) { AddOBJNumberError(chunk, command); }
+			chunk.normals.emplace_back(x, y, z);
 		}
 		else if (command == "vt")
 		{
-			if (tokens.size() < 3) { continue; }
-			Vec2 uv = {std::stof(tokens[1]), std::stof(tokens[2])};
-			if (uv.x < 0.0f || uv.x > 1.0f || uv.y < 0.0f || uv.y > 1.0f)
+			Vec2 uv;
+			if (line.count < 3 || !ParseOBJFloat(tokens[1], uv.x) || !ParseOBJFloat(tokens[2], uv.y))
 			{
-				m_invalidQuadblocks.emplace_back(currQuadblockName, "WARNING: UV outside of expect range [0.0f, 1.0f].");
+				AddOBJNumberError(chunk, command);
+				chunk.uvs.emplace_back();
+				continue;
 			}
+			if (uv.x < 0.0f || uv.x > 1.0f || uv.y < 0.0f || uv.y > 1.0f) { chunk.records.push_back({OBJCommand::UV_WARNING, 0}); }
 			auto Wrap = [](float x)
 				{
 					if (x >= 0.0f && x <= 1.0f) { return x; }
@@ -1479,229 +1927,308 @@ bool Level::LoadOBJ(const std::filesystem::path& objFile)
 				};
 			uv.x = Wrap(uv.x);
 			uv.y = 1.0f - Wrap(uv.y);
-			uvs.emplace_back(uv);
+			chunk.uvs.emplace_back(uv);
 		}
 		else if (command == "o")
 		{
-			if (tokens.size() < 2 || meshMap.contains(tokens[1]))
-			{
-				ret = false;
-				m_invalidQuadblocks.emplace_back(tokens[1], "Duplicated mesh name.");
-				continue;
-			}
-			currQuadblockName = tokens[1];
-			currQuadblockGoodUV = true;
-			meshMap[currQuadblockName] = false;
-			quadblockCount++;
+			chunk.records.push_back({OBJCommand::OBJECT, chunk.names.size()});
+			chunk.names.push_back(line.count < 2 ? std::string_view() : tokens[1]);
 		}
 		else if (command == "usemtl")
 		{
-			if (tokens.size() < 2) { continue; }
-			if (currQuadblockName.empty() || materialMap.contains(currQuadblockName)) { continue; } /* TODO: return false, generate error message */
-			materialMap[currQuadblockName] = tokens[1];
+			if (line.count < 2) { continue; }
+			chunk.records.push_back({OBJCommand::MATERIAL, chunk.names.size()});
+			chunk.names.push_back(tokens[1]);
 		}
 		else if (command == "f")
 		{
-			if (currQuadblockName.empty()) { return false; }
-			if (tokens.size() < 4) { continue; }
+			OBJFace& face = chunk.faces.emplace_back();
+			chunk.records.push_back({OBJCommand::FACE, chunk.faces.size() - 1});
+			if (line.count < 4) { continue; }
 
-			if (meshMap.contains(currQuadblockName) && meshMap.at(currQuadblockName))
+			face.vertexCount = line.count == 5 ? 4 : 3;
+			for (size_t i = 0; i < face.vertexCount; i++)
 			{
-				ret = false;
-				m_invalidQuadblocks.emplace_back(currQuadblockName, "Triblock and Quadblock merged in the same mesh.");
-				continue;
+				if (!ParseOBJFaceVertex(tokens[i + 1], face.vertices[i])) { face.hasNormals = false; break; }
 			}
+		}
+	}
+}
 
-			bool isQuadblock = tokens.size() == 5;
+/*
+	The file is parsed in chunks on every thread, then replayed serially in file order: that last pass only resolves
+	indexes and gathers the faces of each mesh, since building the quadblocks is the expensive part it's done in
+	parallel afterwards. Errors are collected in file order regardless of how many threads ran.
+*/
+bool Level::ImportOBJ(const std::filesystem::path& objFile, std::vector<std::string>& materialOrder, std::vector<std::filesystem::path>& sources)
+{
+	ScopedTimer parseTimer("LoadOBJ/parse");
+	sources.push_back(objFile);
+	MappedFile file;
+	if (!file.Open(objFile)) { return false; }
+
+	const std::string_view data(reinterpret_cast<const char*>(file.GetData()), file.GetSize());
+	const size_t maxChunks = static_cast<size_t>(omp_get_max_threads()) * 4;
+	std::vector<OBJChunk> chunks = SplitOBJChunks(data, std::clamp<size_t>(data.size() / OBJ_MIN_CHUNK_SIZE, 1, maxChunks));
+	const int chunkCount = static_cast<int>(chunks.size());
+	#pragma omp parallel for schedule(dynamic, 1)
+	for (int i = 0; i < chunkCount; i++) { ParseOBJChunk(chunks[i]); }
 
-			std::vector<std::string> token0 = Split(tokens[1], '/');
-			std::vector<std::string> token1 = Split(tokens[2], '/');
-			std::vector<std::string> token2 = Split(tokens[3], '/');
+	std::vector<Point> vertices;
+	std::vector<Vec3> normals;
+	std::vector<Vec2> uvs;
+	for (OBJChunk& chunk : chunks)
+	{
+		vertices.insert(vertices.end(), chunk.vertices.begin(), chunk.vertices.end());
+		normals.insert(normals.end(), chunk.normals.begin(), chunk.normals.end());
+		uvs.insert(uvs.end(), chunk.uvs.begin(), chunk.uvs.end());
+		chunk.vertices = std::vector<Point>();
+		chunk.normals = std::vector<Vec3>();
+		chunk.uvs = std::vector<Vec2>();
+	}
 
-			const size_t EXPECTED_INFORMATION_PER_TOKEN = 3; /* pos, opt uvs, normals */
-			if (token0.size() < EXPECTED_INFORMATION_PER_TOKEN ||
-				token1.size() < EXPECTED_INFORMATION_PER_TOKEN ||
-				token2.size() < EXPECTED_INFORMATION_PER_TOKEN)
+	bool ret = true;
+	constexpr size_t NO_MESH = std::numeric_limits<size_t>::max();
+	std::vector<OBJMesh> meshes;
+	std::unordered_map<std::string, size_t> meshIndexes;
+	std::unordered_set<std::string> materials;
+	std::vector<OBJBlock> blocks;
+	std::vector<std::tuple<size_t, size_t>> mergedErrors; /* error index, mesh: only kept if the mesh block builds */
+	OBJFaceBuffer faceBuffer;
+	size_t currMesh = NO_MESH;
+	for (const OBJChunk& chunk : chunks)
+	{
+		for (const OBJRecord& record : chunk.records)
+		{
+			if (record.command == OBJCommand::UV_WARNING)
+			{
+				m_invalidQuadblocks.emplace_back(currMesh == NO_MESH ? std::string() : meshes[currMesh].name, "WARNING: UV outside of expect range [0.0f, 1.0f].");
+			}
+			else if (record.command == OBJCommand::NUMBER_ERROR)
 			{
 				ret = false;
-				m_invalidQuadblocks.emplace_back(currQuadblockName, "Missing vertex normals.");
-				continue;
+				m_invalidQuadblocks.emplace_back(currMesh == NO_MESH ? std::string() : meshes[currMesh].name, "Invalid number in \"" + std::string(chunk.names[record.index]) + "\" line.");
 			}
-
-			int i0 = std::stoi(token0[0]) - 1;
-			int i1 = std::stoi(token1[0]) - 1;
-			int i2 = std::stoi(token2[0]) - 1;
-			int ni0 = std::stoi(token0[2]) - 1;
-			int ni1 = std::stoi(token1[2]) - 1;
-			int ni2 = std::stoi(token2[2]) - 1;
-			normalMap[currQuadblockName].push_back(normals[ni0]);
-			normalMap[currQuadblockName].push_back(normals[ni1]);
-			normalMap[currQuadblockName].push_back(normals[ni2]);
-
-			vertices[i0].normal = normals[ni0];
-			vertices[i1].normal = normals[ni1];
-			vertices[i2].normal = normals[ni2];
-
-			if (currQuadblockGoodUV)
+			else if (record.command == OBJCommand::OBJECT)
 			{
-				int uv0 = 0;
-				int uv1 = 0;
-				int uv2 = 0;
-				try
+				const std::string name = std::string(chunk.names[record.index]);
+				if (name.empty() || meshIndexes.contains(name))
 				{
-					uv0 = std::stoi(token0[1]) - 1;
-					uv1 = std::stoi(token1[1]) - 1;
-					uv2 = std::stoi(token2[1]) - 1;
+					ret = false;
+					m_invalidQuadblocks.emplace_back(name, "Duplicated mesh name.");
+					continue;
 				}
-				catch (...) { currQuadblockGoodUV = false; }
+				currMesh = meshes.size();
+				meshIndexes[name] = currMesh;
+				meshes.emplace_back().name = name;
+				faceBuffer.quadCount = 0;
+				faceBuffer.triCount = 0;
+				faceBuffer.normalSum = Vec3();
+			}
+			else if (record.command == OBJCommand::MATERIAL)
+			{
+				/* the material is bound once the quadblock is complete, later ones are ignored */
+				if (currMesh == NO_MESH || meshes[currMesh].fetched || !meshes[currMesh].material.empty()) { continue; } /* TODO: return false, generate error message */
+				meshes[currMesh].material = std::string(chunk.names[record.index]);
+			}
+			else if (record.command == OBJCommand::FACE)
+			{
+				if (currMesh == NO_MESH) { return false; }
+				OBJFace face = chunk.faces[record.index];
+				if (face.vertexCount == 0) { continue; }
 
-				if (currQuadblockGoodUV)
+				OBJMesh& mesh = meshes[currMesh];
+				if (mesh.fetched)
 				{
-					vertices[i0].uv = uvs[uv0];
-					vertices[i1].uv = uvs[uv1];
-					vertices[i2].uv = uvs[uv2];
+					ret = false;
+					mergedErrors.emplace_back(m_invalidQuadblocks.size(), currMesh);
+					m_invalidQuadblocks.emplace_back(mesh.name, "Triblock and Quadblock merged in the same mesh.");
+					continue;
 				}
-			}
 
-			if (!currQuadblockGoodUV)
-			{
-				m_invalidQuadblocks.emplace_back(currQuadblockName, "Missing UVs.");
-			}
+				if (!face.hasNormals)
+				{
+					ret = false;
+					m_invalidQuadblocks.emplace_back(mesh.name, "Missing vertex normals.");
+					continue;
+				}
 
-			bool blockFetched = false;
-			if (isQuadblock)
-			{
-				std::vector<std::string> token3 = Split(tokens[4], '/');
-				int i3 = std::stoi(token3[0]) - 1;
-				int ni3 = std::stoi(token3[2]) - 1;
-				normalMap[currQuadblockName].push_back(normals[ni3]);
-				vertices[i3].normal = normals[ni3];
-				if (currQuadblockGoodUV)
+				bool validIndexes = true;
+				for (size_t i = 0; i < face.vertexCount; i++)
+				{
+					OBJFaceVertex& faceVertex = face.vertices[i];
+					if (faceVertex.pos < 0 || static_cast<size_t>(faceVertex.pos) >= vertices.size() ||
+						faceVertex.normal < 0 || static_cast<size_t>(faceVertex.normal) >= normals.size()) { validIndexes = false; }
+					if (faceVertex.uv < 0 || static_cast<size_t>(faceVertex.uv) >= uvs.size()) { faceVertex.hasUV = false; }
+				}
+				if (!validIndexes)
 				{
-					int uv3 = std::stoi(token3[1]) - 1;
-					vertices[i3].uv = uvs[uv3];
+					ret = false;
+					m_invalidQuadblocks.emplace_back(mesh.name, "Face references a vertex that does not exist.");
+					continue;
 				}
 
-				if (!quadMap.contains(currQuadblockName)) { quadMap[currQuadblockName] = std::vector<Quad>(); }
-				quadMap[currQuadblockName].emplace_back(vertices[i0], vertices[i1], vertices[i2], vertices[i3]);
-				blockFetched = quadMap[currQuadblockName].size() == 4;
-			}
-			else
-			{
-				if (!triMap.contains(currQuadblockName)) { triMap[currQuadblockName] = std::vector<Tri>(); }
-				triMap[currQuadblockName].emplace_back(vertices[i0], vertices[i1], vertices[i2]);
-				blockFetched = triMap[currQuadblockName].size() == 4;
-			}
+				for (size_t i = 0; i < face.vertexCount; i++)
+				{
+					const Vec3& normal = normals[face.vertices[i].normal];
+					faceBuffer.normalSum = faceBuffer.normalSum + normal;
+					vertices[face.vertices[i].pos].normal = normal;
+					if (!face.vertices[i].hasUV) { mesh.goodUV = false; }
+				}
 
-			if (blockFetched)
-			{
-				Vec3 averageNormal = Vec3();
-				for (const Vec3& normal : normalMap[currQuadblockName])
+				if (mesh.goodUV)
 				{
-					averageNormal = averageNormal + normal;
+					for (size_t i = 0; i < face.vertexCount; i++) { vertices[face.vertices[i].pos].uv = uvs[face.vertices[i].uv]; }
 				}
-				averageNormal = averageNormal / averageNormal.Length();
-				std::string material;
-				if (materialMap.contains(currQuadblockName))
+				else
 				{
-					material = materialMap[currQuadblockName];
-					m_materialToQuadblocks[material].push_back(m_quadblocks.size());
-					if (!materials.contains(material))
-					{
-						materials.insert(material);
-						m_materialToTexture[material] = Texture();
-						m_propTerrain.SetDefaultValue(material, TerrainType::DEFAULT);
-						m_propQuadFlags.SetDefaultValue(material, QuadFlags::DEFAULT);
-						m_propDoubleSided.SetDefaultValue(material, false);
-						m_propCheckpoints.SetDefaultValue(material, false);
-						m_propTurboPads.SetDefaultValue(material, QuadblockTrigger::NONE);
-						m_propCheckpointPathable.SetDefaultValue(material, true);
-						m_propVisTreeTransparent.SetDefaultValue(material, false);
-						m_propTerrain.RegisterMaterial(this);
-						m_propQuadFlags.RegisterMaterial(this);
-						m_propDoubleSided.RegisterMaterial(this);
-						m_propCheckpoints.RegisterMaterial(this);
-						m_propTurboPads.RegisterMaterial(this);
-						m_propSpeedImpact.RegisterMaterial(this);
-						m_propCheckpointPathable.RegisterMaterial(this);
-						m_propVisTreeTransparent.RegisterMaterial(this);
-					}
+					m_invalidQuadblocks.emplace_back(mesh.name, "Missing UVs.");
 				}
-				bool sameUVs = true;
+
+				const bool isQuadblock = face.vertexCount == 4;
+				bool blockFetched = false;
 				if (isQuadblock)
 				{
-					Quad& q0 = quadMap[currQuadblockName][0];
-					Quad& q1 = quadMap[currQuadblockName][1];
-					Quad& q2 = quadMap[currQuadblockName][2];
-					Quad& q3 = quadMap[currQuadblockName][3];
-					const Vec2& targetUV = q0.p[0].uv;
-					for (size_t i = 0; i < 4; i++)
-					{
-						const Quad& q = quadMap[currQuadblockName][i];
-						for (size_t j = 0; j < 4; j++)
-						{
-							if (q.p[j].uv != targetUV) { sameUVs = false; break; }
-						}
-						if (!sameUVs) { break; }
-					}
-					try
-					{
-						m_quadblocks.emplace_back(currQuadblockName, q0, q1, q2, q3, averageNormal, material, currQuadblockGoodUV, [this](const Quadblock& qb) { UpdateFilterRenderData(qb); });
-						meshMap[currQuadblockName] = true;
-					}
-					catch (const QuadException& e)
-					{
-						ret = false;
-						m_invalidQuadblocks.emplace_back(currQuadblockName, e.what());
-					}
+					std::array<Point, 4>& quad = faceBuffer.quads[faceBuffer.quadCount++];
+					for (size_t i = 0; i < 4; i++) { quad[i] = vertices[face.vertices[i].pos]; }
+					blockFetched = faceBuffer.quadCount == 4;
 				}
 				else
 				{
-					Tri& t0 = triMap[currQuadblockName][0];
-					Tri& t1 = triMap[currQuadblockName][1];
-					Tri& t2 = triMap[currQuadblockName][2];
-					Tri& t3 = triMap[currQuadblockName][3];
-					const Vec2& targetUV = t0.p[0].uv;
-					for (size_t i = 0; i < 4; i++)
-					{
-						const Tri& t = triMap[currQuadblockName][i];
-						for (size_t j = 0; j < 3; j++)
-						{
-							if (t.p[j].uv != targetUV) { sameUVs = false; break; }
-						}
-						if (!sameUVs) { break; }
-					}
-					try
-					{
-						m_quadblocks.emplace_back(currQuadblockName, t0, t1, t2, t3, averageNormal, material, currQuadblockGoodUV, [this](const Quadblock& qb) { UpdateFilterRenderData(qb); });
-						meshMap[currQuadblockName] = true;
-					}
-					catch (const QuadException& e)
+					std::array<Point, 3>& tri = faceBuffer.tris[faceBuffer.triCount++];
+					for (size_t i = 0; i < 3; i++) { tri[i] = vertices[face.vertices[i].pos]; }
+					blockFetched = faceBuffer.triCount == 4;
+				}
+				if (!blockFetched) { continue; }
+
+				OBJBlock& block = blocks.emplace_back();
+				block.mesh = currMesh;
+				block.isQuadblock = isQuadblock;
+				block.normal = faceBuffer.normalSum / faceBuffer.normalSum.Length();
+				const size_t pointCount = isQuadblock ? 4 : 3;
+				for (size_t i = 0; i < 4; i++)
+				{
+					for (size_t j = 0; j < pointCount; j++) { block.points[i][j] = isQuadblock ? faceBuffer.quads[i][j] : faceBuffer.tris[i][j]; }
+				}
+				const Vec2& targetUV = block.points[0][0].uv;
+				for (size_t i = 0; i < 4 && block.sameUVs; i++)
+				{
+					for (size_t j = 0; j < pointCount; j++)
 					{
-						ret = false;
-						m_invalidQuadblocks.emplace_back(currQuadblockName, e.what());
+						if (block.points[i][j].uv != targetUV) { block.sameUVs = false; break; }
 					}
 				}
-				if (sameUVs)
+				block.errorIndex = m_invalidQuadblocks.size();
+				mesh.fetched = true;
+			}
+		}
+	}
+	file.Close();
+	parseTimer.Stop();
+
+	ScopedTimer buildTimer("LoadOBJ/build");
+	const int blockCount = static_cast<int>(blocks.size());
+	std::vector<std::optional<Quadblock>> quadblocks(blocks.size());
+	std::vector<std::string> buildErrors(blocks.size());
+	#pragma omp parallel for schedule(dynamic, 64)
+	for (int i = 0; i < blockCount; i++)
+	{
+		const OBJBlock& block = blocks[i];
+		const OBJMesh& mesh = meshes[block.mesh];
+		const std::array<std::array<Point, 4>, 4>& p = block.points;
+		try
+		{
+			if (block.isQuadblock)
+			{
+				Quad q0 = Quad(p[0][0], p[0][1], p[0][2], p[0][3]);
+				Quad q1 = Quad(p[1][0], p[1][1], p[1][2], p[1][3]);
+				Quad q2 = Quad(p[2][0], p[2][1], p[2][2], p[2][3]);
+				Quad q3 = Quad(p[3][0], p[3][1], p[3][2], p[3][3]);
+				quadblocks[i].emplace(mesh.name, q0, q1, q2, q3, block.normal, mesh.material, mesh.goodUV, [this](const Quadblock& qb) { UpdateFilterRenderData(qb); });
+			}
+			else
+			{
+				Tri t0 = Tri(p[0][0], p[0][1], p[0][2]);
+				Tri t1 = Tri(p[1][0], p[1][1], p[1][2]);
+				Tri t2 = Tri(p[2][0], p[2][1], p[2][2]);
+				Tri t3 = Tri(p[3][0], p[3][1], p[3][2]);
+				quadblocks[i].emplace(mesh.name, t0, t1, t2, t3, block.normal, mesh.material, mesh.goodUV, [this](const Quadblock& qb) { UpdateFilterRenderData(qb); });
+			}
+		}
+		catch (const QuadException& e) { buildErrors[i] = e.what(); }
+	}
+
+	/* Blocks are appended in file order, with their errors slotted back where the single threaded parser reported them */
+	std::vector<std::tuple<std::string, std::string>> parseErrors = std::move(m_invalidQuadblocks);
+	m_invalidQuadblocks.clear();
+	m_quadblocks.reserve(m_quadblocks.size() + blocks.size());
+	size_t nextError = 0;
+	size_t nextMergedError = 0;
+	auto FlushParseErrors = [&](size_t errorIndex)
+		{
+			for (; nextError < errorIndex; nextError++)
+			{
+				/* A mesh whose block failed to build never counted as complete, so its extra faces weren't reported */
+				if (nextMergedError < mergedErrors.size() && std::get<0>(mergedErrors[nextMergedError]) == nextError)
 				{
-					m_invalidQuadblocks.emplace_back(currQuadblockName, "Degenerated UV data.");
+					const bool built = meshes[std::get<1>(mergedErrors[nextMergedError++])].built;
+					if (!built) { continue; }
 				}
+				m_invalidQuadblocks.push_back(std::move(parseErrors[nextError]));
 			}
+		};
+	for (size_t i = 0; i < blocks.size(); i++)
+	{
+		const OBJBlock& block = blocks[i];
+		OBJMesh& mesh = meshes[block.mesh];
+		FlushParseErrors(block.errorIndex);
+
+		const std::string& material = mesh.material;
+		if (!material.empty())
+		{
+			m_materialToQuadblocks[material].push_back(m_quadblocks.size());
+			if (!materials.contains(material))
+			{
+				materials.insert(material);
+				materialOrder.push_back(material);
+				RegisterOBJMaterial(material);
+			}
+		}
+
+		if (quadblocks[i])
+		{
+			m_quadblocks.push_back(std::move(*quadblocks[i]));
+			mesh.built = true;
+		}
+		else
+		{
+			ret = false;
+			m_invalidQuadblocks.emplace_back(mesh.name, buildErrors[i]);
+		}
+		if (block.sameUVs)
+		{
+			m_invalidQuadblocks.emplace_back(mesh.name, "Degenerated UV data.");
 		}
 	}
-	file.close();
+	FlushParseErrors(parseErrors.size());
+	buildTimer.Stop();
+	Profiler::AddCount("LoadOBJ/quadblocks", m_quadblocks.size());
 
 	m_showLogWindow = !m_invalidQuadblocks.empty();
 
 	if (!materials.empty())
 	{
+		ScopedTimer texturesTimer("LoadOBJ/textures");
 		std::filesystem::path mtlPath = m_parentPath / (objFile.stem().string() + ".mtl");
+		sources.push_back(mtlPath);
 		if (std::filesystem::exists(mtlPath))
 		{
 			std::ifstream mtl(mtlPath);
+			std::string line;
 			std::string currMaterial;
 			while (std::getline(mtl, line))
 			{
+				if (!line.empty() && line.back() == '\r') { line.pop_back(); } /* names coming from the OBJ never keep the carriage return */
 				std::vector<std::string> tokens = Split(line);
 				if (tokens.empty()) { continue; }
 
@@ -1712,9 +2239,15 @@ bool Level::LoadOBJ(const std::filesystem::path& objFile)
 					std::string imagePath = tokens[1];
 					for (size_t i = 2; i < tokens.size(); i++) { imagePath += " " + tokens[i]; }
 					std::filesystem::path materialPath = imagePath;
-					if (!std::filesystem::exists(materialPath)) { materialPath = m_parentPath / materialPath.filename(); }
+					if (!std::filesystem::exists(materialPath))
+					{
+						sources.push_back(materialPath);
+						materialPath = m_parentPath / materialPath.filename();
+					}
+					sources.push_back(materialPath);
 					if (std::filesystem::exists(materialPath))
 					{
+						if (!m_materialToTexture.contains(currMaterial)) { materialOrder.push_back(currMaterial); }
 						m_materialToTexture[currMaterial] = Texture(materialPath);
 					}
 				}
@@ -1722,23 +2255,9 @@ bool Level::LoadOBJ(const std::filesystem::path& objFile)
 		}
 	}
 
-	if (ret)
-	{
-		for (const auto& [material, texture] : m_materialToTexture)
-		{
-			const bool semiTransparent = texture.IsSemiTransparent();
-			m_propVisTreeTransparent.SetDefaultValue(material, semiTransparent);
-
-			const std::filesystem::path& texPath = texture.GetPath();
-			const std::vector<size_t>& quadblockIndexes = m_materialToQuadblocks[material];
-			for (const size_t index : quadblockIndexes)
-			{
-				m_quadblocks[index].SetTexPath(texPath);
-				m_quadblocks[index].SetVisTreeTransparent(semiTransparent);
-			}
-		}
-	}
+	if (ret) { ApplyMaterialTextures(); }
 
+	const size_t quadblockCount = meshes.size();
 	if (quadblockCount != m_quadblocks.size())
 	{
 		m_showLogWindow = true;
@@ -1746,15 +2265,68 @@ bool Level::LoadOBJ(const std::filesystem::path& objFile)
 		m_logMessage += "\n\nThe following meshes are not a quadblock:\n\n";
 		constexpr size_t QUADS_PER_LINE = 10;
 		size_t invalidQuadblocks = 0;
-		for (auto& [name, status] : meshMap)
+		for (auto& [name, index] : meshIndexes)
 		{
-			if (status) { continue; }
+			if (meshes[index].built) { continue; }
 			m_logMessage += name + ", ";
 			if (((invalidQuadblocks + 1) % QUADS_PER_LINE) == 0) { m_logMessage += "\n"; }
 			invalidQuadblocks++;
 		}
 		ret = false;
 	}
+	return ret;
+}
+
+void Level::RegisterOBJMaterial(const std::string& material)
+{
+	m_materialToTexture[material] = Texture();
+	m_propTerrain.SetDefaultValue(material, TerrainType::DEFAULT);
+	m_propQuadFlags.SetDefaultValue(material, QuadFlags::DEFAULT);
+	m_propDoubleSided.SetDefaultValue(material, false);
+	m_propCheckpoints.SetDefaultValue(material, false);
+	m_propTurboPads.SetDefaultValue(material, QuadblockTrigger::NONE);
+	m_propCheckpointPathable.SetDefaultValue(material, true);
+	m_propVisTreeTransparent.SetDefaultValue(material, false);
+	m_propTerrain.RegisterMaterial(this);
+	m_propQuadFlags.RegisterMaterial(this);
+	m_propDoubleSided.RegisterMaterial(this);
+	m_propCheckpoints.RegisterMaterial(this);
+	m_propTurboPads.RegisterMaterial(this);
+	m_propSpeedImpact.RegisterMaterial(this);
+	m_propCheckpointPathable.RegisterMaterial(this);
+	m_propVisTreeTransparent.RegisterMaterial(this);
+}
+
+void Level::ApplyMaterialTextures()
+{
+	for (const auto& [material, texture] : m_materialToTexture)
+	{
+		const bool semiTransparent = texture.IsSemiTransparent();
+		m_propVisTreeTransparent.SetDefaultValue(material, semiTransparent);
+
+		const std::filesystem::path& texPath = texture.GetPath();
+		const std::vector<size_t>& quadblockIndexes = m_materialToQuadblocks[material];
+		for (const size_t index : quadblockIndexes)
+		{
+			m_quadblocks[index].SetTexPath(texPath);
+			m_quadblocks[index].SetVisTreeTransparent(semiTransparent);
+		}
+	}
+}
+
+bool Level::LoadOBJ(const std::filesystem::path& objFile, bool generateBSP)
+{
+	ScopedTimer timer("LoadOBJ");
+	m_name = objFile.filename().replace_extension().string();
+	m_parentPath = objFile.parent_path();
+	bool ret = LoadCompiledOBJ(objFile);
+	if (!ret)
+	{
+		std::vector<std::string> materialOrder;
+		std::vector<std::filesystem::path> sources;
+		ret = ImportOBJ(objFile, materialOrder, sources);
+		if (ret) { SaveCompiledOBJ(materialOrder, sources); }
+	}
 	m_loaded = ret;
 
 	if (m_loaded)
@@ -1770,10 +2342,371 @@ bool Level::LoadOBJ(const std::filesystem::path& objFile)
 		}
 	}
 	GenerateRenderLevData();
-	GenerateBSP();
+	if (generateBSP) { GenerateBSP(); }
 	return ret;
 }
 
+static constexpr uint32_t COMPILED_OBJ_MAGIC = 0x4A424F43; // "COBJ"
+static constexpr uint32_t COMPILED_OBJ_VERSION = 1;
+static constexpr uint64_t COMPILED_OBJ_MISSING = std::numeric_limits<uint64_t>::max();
+
+/*
+	Flat little-endian layout: a header with the offset of every array, followed by the arrays themselves.
+	Strings live in a single table referenced by offset and length, so the whole file can be read straight from a mapping.
+*/
+struct CompiledOBJHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t sourceCount;
+	uint64_t quadblockCount;
+	uint64_t materialCount;
+	uint64_t logCount;
+	uint64_t indexCount;
+	uint64_t pixelCount;
+	uint64_t stringsSize;
+	uint64_t offSources;
+	uint64_t offQuadblocks;
+	uint64_t offMaterials;
+	uint64_t offLog;
+	uint64_t offIndexes;
+	uint64_t offPixels;
+	uint64_t offStrings;
+};
+
+struct CompiledOBJString
+{
+	uint64_t offset;
+	uint64_t length;
+};
+
+struct CompiledOBJSource
+{
+	CompiledOBJString path;
+	uint64_t size; // COMPILED_OBJ_MISSING if the file did not exist during the import
+	int64_t time;
+	uint64_t hash;
+};
+
+struct CompiledOBJQuadblock
+{
+	CompiledOBJString name;
+	CompiledOBJString material;
+	float pos[NUM_VERTICES_QUADBLOCK][3];
+	float normal[NUM_VERTICES_QUADBLOCK][3];
+	uint8_t color[NUM_VERTICES_QUADBLOCK][4];
+	float uvs[NUM_FACES_QUADBLOCK + 1][4][2];
+	uint32_t triblock;
+};
+
+struct CompiledOBJMaterial
+{
+	CompiledOBJString name;
+	CompiledOBJString texturePath;
+	uint64_t firstIndex;
+	uint64_t indexCount;
+	uint64_t imageOffset; // the CLUT follows the image in the pixel array
+	uint64_t imageCount;
+	uint64_t clutCount;
+	int32_t width;
+	int32_t height;
+	uint16_t blendMode;
+	uint8_t semiTransparent;
+	uint8_t registered;
+	uint32_t padding;
+};
+
+struct CompiledOBJLogEntry
+{
+	CompiledOBJString name;
+	CompiledOBJString message;
+};
+
+static CompiledOBJString AddCompiledOBJString(std::string& strings, const std::string& str)
+{
+	CompiledOBJString ret = {strings.size(), str.size()};
+	strings += str;
+	return ret;
+}
+
+static bool ReadCompiledOBJString(const LevView& view, const CompiledOBJHeader& header, const CompiledOBJString& str, std::string& out)
+{
+	if (str.offset > header.stringsSize || str.length > header.stringsSize - str.offset) { return false; }
+	out.assign(reinterpret_cast<const char*>(view.data + header.offStrings + str.offset), str.length);
+	return true;
+}
+
+template<typename T>
+static bool ReadCompiledOBJArray(const LevView& view, uint64_t offset, uint64_t count, std::vector<T>& out)
+{
+	if (!view.Contains<T>(offset, count)) { return false; }
+	out.resize(count);
+	if (count > 0) { std::memcpy(out.data(), view.data + offset, count * sizeof(T)); }
+	return true;
+}
+
+static CompiledOBJSource GetCompiledOBJSource(const std::filesystem::path& path, bool computeHash)
+{
+	CompiledOBJSource source = {};
+	std::error_code error;
+	if (!std::filesystem::is_regular_file(path, error))
+	{
+		source.size = COMPILED_OBJ_MISSING;
+		return source;
+	}
+	source.size = std::filesystem::file_size(path, error);
+	source.time = static_cast<int64_t>(std::filesystem::last_write_time(path, error).time_since_epoch().count());
+	if (!computeHash) { return source; }
+
+	source.hash = 0xCBF29CE484222325;
+	MappedFile file;
+	if (!file.Open(path)) { return source; }
+	const uint8_t* data = file.GetData();
+	for (size_t i = 0; i < file.GetSize(); i++)
+	{
+		source.hash ^= data[i];
+		source.hash *= 0x100000001B3;
+	}
+	return source;
+}
+
+std::filesystem::path Level::GetCompiledOBJPath() const
+{
+	return m_parentPath / (m_name + "_cache") / "compiled_obj.bin";
+}
+
+/*
+	The compiled OBJ is only trusted when every file the import read (OBJ, MTL and textures) is unchanged:
+	size and modification time are checked first, and when the time differs the contents are hashed again,
+	so touching a file without editing it doesn't throw the cache away.
+*/
+bool Level::LoadCompiledOBJ(const std::filesystem::path& objFile)
+{
+	ScopedTimer timer("LoadOBJ/compiled load");
+	const std::filesystem::path cachePath = GetCompiledOBJPath();
+	if (!std::filesystem::is_regular_file(cachePath)) { return false; }
+
+	MappedFile file;
+	if (!file.Open(cachePath)) { return false; }
+	const LevView view = {file.GetData(), file.GetSize()};
+	CompiledOBJHeader header = {};
+	if (!view.Read(0, header)) { return false; }
+	if (header.magic != COMPILED_OBJ_MAGIC || header.version != COMPILED_OBJ_VERSION || header.sourceCount == 0) { return false; }
+	if (!view.Contains<char>(header.offStrings, header.stringsSize)) { return false; }
+
+	std::vector<CompiledOBJSource> sources;
+	std::vector<CompiledOBJQuadblock> quadblocks;
+	std::vector<CompiledOBJMaterial> materials;
+	std::vector<CompiledOBJLogEntry> log;
+	std::vector<uint64_t> indexes;
+	std::vector<uint16_t> pixels;
+	if (!ReadCompiledOBJArray(view, header.offSources, header.sourceCount, sources) ||
+		!ReadCompiledOBJArray(view, header.offQuadblocks, header.quadblockCount, quadblocks) ||
+		!ReadCompiledOBJArray(view, header.offMaterials, header.materialCount, materials) ||
+		!ReadCompiledOBJArray(view, header.offLog, header.logCount, log) ||
+		!ReadCompiledOBJArray(view, header.offIndexes, header.indexCount, indexes) ||
+		!ReadCompiledOBJArray(view, header.offPixels, header.pixelCount, pixels)) { return false; }
+
+	for (size_t i = 0; i < sources.size(); i++)
+	{
+		std::string path;
+		if (!ReadCompiledOBJString(view, header, sources[i].path, path)) { return false; }
+		if (i == 0 && path != objFile.string()) { return false; }
+
+		const CompiledOBJSource& stored = sources[i];
+		CompiledOBJSource current = GetCompiledOBJSource(path, false);
+		if (current.size != stored.size) { return false; }
+		if (current.size == COMPILED_OBJ_MISSING || current.time == stored.time) { continue; }
+		current = GetCompiledOBJSource(path, true);
+		if (current.hash != stored.hash) { return false; }
+	}
+
+	std::vector<Quadblock> loadedQuadblocks;
+	loadedQuadblocks.reserve(quadblocks.size());
+	for (const CompiledOBJQuadblock& entry : quadblocks)
+	{
+		std::string name, material;
+		if (!ReadCompiledOBJString(view, header, entry.name, name) || !ReadCompiledOBJString(view, header, entry.material, material)) { return false; }
+
+		std::array<Vertex, NUM_VERTICES_QUADBLOCK> vertices;
+		for (size_t i = 0; i < NUM_VERTICES_QUADBLOCK; i++)
+		{
+			Point point;
+			point.pos = Vec3(entry.pos[i][0], entry.pos[i][1], entry.pos[i][2]);
+			point.normal = Vec3(entry.normal[i][0], entry.normal[i][1], entry.normal[i][2]);
+			point.color = Color(entry.color[i][0], entry.color[i][1], entry.color[i][2], entry.color[i][3]);
+			vertices[i] = Vertex(point);
+		}
+		std::array<QuadUV, NUM_FACES_QUADBLOCK + 1> uvs;
+		for (size_t i = 0; i < uvs.size(); i++)
+		{
+			for (size_t j = 0; j < 4; j++) { uvs[i][j] = Vec2(entry.uvs[i][j][0], entry.uvs[i][j][1]); }
+		}
+		loadedQuadblocks.emplace_back(name, material, vertices, uvs, entry.triblock != 0, [this](const Quadblock& qb) { UpdateFilterRenderData(qb); });
+	}
+
+	std::vector<std::tuple<std::string, std::string>> invalidQuadblocks;
+	for (const CompiledOBJLogEntry& entry : log)
+	{
+		std::string name, message;
+		if (!ReadCompiledOBJString(view, header, entry.name, name) || !ReadCompiledOBJString(view, header, entry.message, message)) { return false; }
+		invalidQuadblocks.emplace_back(name, message);
+	}
+
+	std::vector<std::tuple<std::string, std::vector<size_t>, Texture, bool>> loadedMaterials;
+	for (const CompiledOBJMaterial& entry : materials)
+	{
+		std::string name, texturePath;
+		if (!ReadCompiledOBJString(view, header, entry.name, name) || !ReadCompiledOBJString(view, header, entry.texturePath, texturePath)) { return false; }
+		if (entry.firstIndex > indexes.size() || entry.indexCount > indexes.size() - entry.firstIndex) { return false; }
+		if (entry.imageOffset > pixels.size()) { return false; }
+		const uint64_t pixelsLeft = pixels.size() - entry.imageOffset;
+		if (entry.imageCount > pixelsLeft || entry.clutCount > pixelsLeft - entry.imageCount) { return false; }
+		if (!Texture::IsValidConvertedImage(entry.width, entry.height, static_cast<size_t>(entry.imageCount), static_cast<size_t>(entry.clutCount))) { return false; }
+
+		std::vector<size_t> quadblockIndexes;
+		for (size_t i = 0; i < entry.indexCount; i++)
+		{
+			const uint64_t index = indexes[entry.firstIndex + i];
+			if (index >= loadedQuadblocks.size()) { return false; }
+			quadblockIndexes.push_back(static_cast<size_t>(index));
+		}
+		const auto imageBegin = pixels.begin() + entry.imageOffset;
+		const std::vector<uint16_t> image(imageBegin, imageBegin + entry.imageCount);
+		const std::vector<uint16_t> clut(imageBegin + entry.imageCount, imageBegin + entry.imageCount + entry.clutCount);
+		Texture texture(texturePath, entry.width, entry.height, entry.blendMode, entry.semiTransparent != 0, image, clut);
+		loadedMaterials.emplace_back(name, std::move(quadblockIndexes), std::move(texture), entry.registered != 0);
+	}
+
+	/* Materials are replayed in the order the import created them, which keeps the texture map iteration (and so the VRM) identical */
+	m_quadblocks = std::move(loadedQuadblocks);
+	for (auto& [name, quadblockIndexes, texture, registered] : loadedMaterials)
+	{
+		if (registered)
+		{
+			m_materialToQuadblocks[name] = std::move(quadblockIndexes);
+			RegisterOBJMaterial(name);
+		}
+		m_materialToTexture[name] = std::move(texture);
+	}
+	m_invalidQuadblocks = std::move(invalidQuadblocks);
+	m_showLogWindow = !m_invalidQuadblocks.empty();
+	ApplyMaterialTextures();
+	Profiler::AddCount("LoadOBJ/quadblocks", m_quadblocks.size());
+	Profiler::AddCount("LoadOBJ/compiled cache hits", 1);
+	m_logMessage += "\nLoaded compiled OBJ from cache: " + cachePath.string();
+	return true;
+}
+
+bool Level::SaveCompiledOBJ(const std::vector<std::string>& materialOrder, const std::vector<std::filesystem::path>& sources) const
+{
+	ScopedTimer timer("LoadOBJ/compiled save");
+	if (sources.empty()) { return false; }
+
+	std::string strings;
+	std::vector<CompiledOBJSource> compiledSources;
+	for (const std::filesystem::path& path : sources)
+	{
+		CompiledOBJSource source = GetCompiledOBJSource(path, true);
+		source.path = AddCompiledOBJString(strings, path.string());
+		compiledSources.push_back(source);
+	}
+
+	std::vector<CompiledOBJQuadblock> compiledQuadblocks(m_quadblocks.size());
+	for (size_t i = 0; i < m_quadblocks.size(); i++)
+	{
+		const Quadblock& quadblock = m_quadblocks[i];
+		CompiledOBJQuadblock& entry = compiledQuadblocks[i];
+		entry.name = AddCompiledOBJString(strings, quadblock.GetName());
+		entry.material = AddCompiledOBJString(strings, quadblock.GetMaterial());
+		const Vertex* vertices = quadblock.GetUnswizzledVertices();
+		for (size_t j = 0; j < NUM_VERTICES_QUADBLOCK; j++)
+		{
+			const Color color = vertices[j].GetColor(true);
+			entry.pos[j][0] = vertices[j].m_pos.x; entry.pos[j][1] = vertices[j].m_pos.y; entry.pos[j][2] = vertices[j].m_pos.z;
+			entry.normal[j][0] = vertices[j].m_normal.x; entry.normal[j][1] = vertices[j].m_normal.y; entry.normal[j][2] = vertices[j].m_normal.z;
+			entry.color[j][0] = color.r; entry.color[j][1] = color.g; entry.color[j][2] = color.b; entry.color[j][3] = color.a;
+		}
+		const std::array<QuadUV, NUM_FACES_QUADBLOCK + 1>& uvs = quadblock.GetUVs();
+		for (size_t j = 0; j < uvs.size(); j++)
+		{
+			for (size_t k = 0; k < 4; k++) { entry.uvs[j][k][0] = uvs[j][k].x; entry.uvs[j][k][1] = uvs[j][k].y; }
+		}
+		entry.triblock = quadblock.IsQuadblock() ? 0 : 1;
+	}
+
+	std::vector<CompiledOBJMaterial> compiledMaterials;
+	std::vector<uint64_t> indexes;
+	std::vector<uint16_t> pixels;
+	for (const std::string& material : materialOrder)
+	{
+		if (!m_materialToTexture.contains(material)) { return false; }
+		const Texture& texture = m_materialToTexture.at(material);
+		CompiledOBJMaterial entry = {};
+		entry.name = AddCompiledOBJString(strings, material);
+		entry.texturePath = AddCompiledOBJString(strings, texture.GetPath().string());
+		entry.firstIndex = indexes.size();
+		if (m_materialToQuadblocks.contains(material))
+		{
+			const std::vector<size_t>& quadblockIndexes = m_materialToQuadblocks.at(material);
+			indexes.insert(indexes.end(), quadblockIndexes.begin(), quadblockIndexes.end());
+			entry.indexCount = quadblockIndexes.size();
+			entry.registered = quadblockIndexes.empty() ? 0 : 1;
+		}
+		entry.imageOffset = pixels.size();
+		entry.imageCount = texture.GetImage().size();
+		entry.clutCount = texture.GetClut().size();
+		pixels.insert(pixels.end(), texture.GetImage().begin(), texture.GetImage().end());
+		pixels.insert(pixels.end(), texture.GetClut().begin(), texture.GetClut().end());
+		entry.width = texture.GetWidth();
+		entry.height = texture.GetHeight();
+		entry.blendMode = texture.GetBlendMode();
+		entry.semiTransparent = texture.IsSemiTransparent() ? 1 : 0;
+		compiledMaterials.push_back(entry);
+	}
+
+	std::vector<CompiledOBJLogEntry> log;
+	for (const auto& [name, message] : m_invalidQuadblocks)
+	{
+		log.push_back({AddCompiledOBJString(strings, name), AddCompiledOBJString(strings, message)});
+	}
+
+	CompiledOBJHeader header = {};
+	header.magic = COMPILED_OBJ_MAGIC;
+	header.version = COMPILED_OBJ_VERSION;
+	header.sourceCount = compiledSources.size();
+	header.quadblockCount = compiledQuadblocks.size();
+	header.materialCount = compiledMaterials.size();
+	header.logCount = log.size();
+	header.indexCount = indexes.size();
+	header.pixelCount = pixels.size();
+	header.stringsSize = strings.size();
+	header.offSources = sizeof(header);
+	header.offQuadblocks = header.offSources + compiledSources.size() * sizeof(CompiledOBJSource);
+	header.offMaterials = header.offQuadblocks + compiledQuadblocks.size() * sizeof(CompiledOBJQuadblock);
+	header.offLog = header.offMaterials + compiledMaterials.size() * sizeof(CompiledOBJMaterial);
+	header.offIndexes = header.offLog + log.size() * sizeof(CompiledOBJLogEntry);
+	header.offPixels = header.offIndexes + indexes.size() * sizeof(uint64_t);
+	header.offStrings = header.offPixels + pixels.size() * sizeof(uint16_t);
+
+	const std::filesystem::path cachePath = GetCompiledOBJPath();
+	std::error_code error;
+	std::filesystem::create_directories(cachePath.parent_path(), error);
+	if (error) { return false; }
+
+	std::ofstream file(cachePath, std::ios::binary);
+	if (!file.is_open()) { return false; }
+	Write(file, &header, sizeof(header));
+	Write(file, compiledSources.data(), compiledSources.size() * sizeof(CompiledOBJSource));
+	Write(file, compiledQuadblocks.data(), compiledQuadblocks.size() * sizeof(CompiledOBJQuadblock));
+	Write(file, compiledMaterials.data(), compiledMaterials.size() * sizeof(CompiledOBJMaterial));
+	Write(file, log.data(), log.size() * sizeof(CompiledOBJLogEntry));
+	Write(file, indexes.data(), indexes.size() * sizeof(uint64_t));
+	Write(file, pixels.data(), pixels.size() * sizeof(uint16_t));
+	Write(file, strings.data(), strings.size());
+	return file.good();
+}
+
 bool Level::StartEmuIPC(const std::string& emulator)
 {
 	constexpr size_t PSX_RAM_SIZE = 0x800000;
@@ -1784,6 +2717,7 @@ bool Level::StartEmuIPC(const std::string& emulator)
 
 bool Level::HotReload(const std::string& levPath, const std::string& vrmPath, const std::string& emulator)
 {
+	ScopedTimer timer("HotReload");
 	bool vrmOnly = false;
 	if (levPath.empty())
 	{
@@ -1866,6 +2800,7 @@ bool Level::SetGhostData(const std::filesystem::path& path, bool tropy)
 
 bool Level::UpdateVRM()
 {
+	ScopedTimer timer("UpdateVRM");
 	std::vector<Texture*> textures;
 	std::vector<std::tuple<Texture*, Texture*>> copyTextureAttributes;
 	for (auto& [material, texture] : m_materialToTexture)
@@ -2042,46 +2977,30 @@ void Level::GenerateRenderBspData()
 {
 	if (!m_models[LevelModels::BSP]) { return; }
 
-	struct NodeDepth
-	{
-		const BSP* node;
-		int depth;
-	};
 	std::vector<Primitive> triangles;
-	std::vector<NodeDepth> stack;
-	stack.push_back({&m_bsp, 0});
+	const std::vector<BSPTreeNode>& nodes = m_bsp.GetNodes();
 	GuiRenderSettings::bspTreeMaxDepth = 0;
-	while (!stack.empty())
+	for (const BSPTreeNode& node : nodes)
 	{
-		const NodeDepth entry = stack.back();
-		stack.pop_back();
-		if (!entry.node) { continue; }
+		int depth = 0;
+		for (uint32_t parent = node.parent; parent != BSP_NODE_NONE; parent = nodes[parent].parent) { depth++; }
 
-		if (GuiRenderSettings::bspTreeMaxDepth < entry.depth)
+		if (GuiRenderSettings::bspTreeMaxDepth < depth)
 		{
-			GuiRenderSettings::bspTreeMaxDepth = entry.depth;
+			GuiRenderSettings::bspTreeMaxDepth = depth;
 		}
 
-		const bool drawDepth = (GuiRenderSettings::bspTreeTopDepth <= entry.depth && GuiRenderSettings::bspTreeBottomDepth >= entry.depth);
+		const bool drawDepth = (GuiRenderSettings::bspTreeTopDepth <= depth && GuiRenderSettings::bspTreeBottomDepth >= depth);
 		if (drawDepth)
 		{
-			const Color c = Color(entry.depth * 30.0, 1.0, 1.0);
-			std::vector<Primitive> nodeTriangles = entry.node->GetBoundingBox().ToGeometry();
+			const Color c = Color(depth * 30.0, 1.0, 1.0);
+			std::vector<Primitive> nodeTriangles = node.bbox.ToGeometry();
 			for (Primitive& primitive : nodeTriangles)
 			{
 				for (unsigned i = 0; i < primitive.pointCount; i++) { primitive.p[i].color = c; }
 				triangles.push_back(primitive);
 			}
 		}
-
-		if (entry.node->GetLeftChildren() != nullptr)
-		{
-			stack.push_back({entry.node->GetLeftChildren(), entry.depth + 1});
-		}
-		if (entry.node->GetRightChildren() != nullptr)
-		{
-			stack.push_back({entry.node->GetRightChildren(), entry.depth + 1});
-		}
 	}
 
 	m_models[LevelModels::BSP]->GetMesh().SetGeometry(triangles, Mesh::RenderFlags::DrawWireframe | Mesh::RenderFlags::DontOverrideRenderFlags);
@@ -2184,22 +3103,19 @@ void Level::GenerateRenderSelectedBlockData(const Quadblock& quadblock, const Ve
 
 	if (GuiRenderSettings::showVisTree)
 	{
-		std::vector<const BSP*> bspLeaves = m_bsp.GetLeaves();
+		const std::vector<uint32_t>& bspLeaves = m_bsp.GetLeaves();
 		size_t myBSPIndex = 0;
 		for (size_t bsp_index = 0; bsp_index < bspLeaves.size(); bsp_index++)
 		{
-			const BSP& bsp = *bspLeaves[bsp_index];
-			if (bsp.GetId() == quadblock.GetBSPID()) { myBSPIndex = bsp_index; }
+			if (bspLeaves[bsp_index] == quadblock.GetBSPID()) { myBSPIndex = bsp_index; }
 		}
 
 		std::vector<Primitive> multiTriangles;
 		for (size_t bsp_index = 0; bsp_index < bspLeaves.size(); bsp_index++)
 		{
-			const BSP& bsp = *bspLeaves[bsp_index];
 			if (m_bspVis.Get(bsp_index, myBSPIndex))
 			{
-				const std::vector<size_t> qbIndeces = bsp.GetQuadblockIndexes();
-				for (size_t qbInd : qbIndeces)
+				for (size_t qbInd : m_bsp.GetQuadblockIndexes(bspLeaves[bsp_index]))
 				{
 					Quadblock& qb = m_quadblocks[qbInd];
 					std::vector<Primitive> qbTriangles = qb.ToGeometry(false, &emptyUvs, &emptyTexturePath);
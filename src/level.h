@@ -71,7 +71,13 @@ private:
 	void ManageTurbopad(Quadblock& quadblock);
 	bool LoadLEV(const std::filesystem::path& levFile);
 	bool SaveLEV(const std::filesystem::path& path);
-	bool LoadOBJ(const std::filesystem::path& objFile);
+	bool LoadOBJ(const std::filesystem::path& objFile, bool generateBSP = true);
+	bool ImportOBJ(const std::filesystem::path& objFile, std::vector<std::string>& materialOrder, std::vector<std::filesystem::path>& sources);
+	void RegisterOBJMaterial(const std::string& material);
+	void ApplyMaterialTextures();
+	std::filesystem::path GetCompiledOBJPath() const;
+	bool LoadCompiledOBJ(const std::filesystem::path& objFile);
+	bool SaveCompiledOBJ(const std::vector<std::string>& materialOrder, const std::vector<std::filesystem::path>& sources) const;
 	bool StartEmuIPC(const std::string& emulator);
 	bool HotReload(const std::string& levPath, const std::string& vrmPath, const std::string& emulator);
 	bool SaveGhostData(const std::string& emulator, const std::filesystem::path& path);
@@ -79,6 +85,13 @@ private:
 	bool UpdateVRM();
 	bool GenerateCheckpoints();
 	bool GenerateBSP();
+	bool UpdateVisTree();
+	uint64_t ComputeBakeHash() const;
+	std::filesystem::path GetBakeCachePath() const;
+	bool LoadBakeCache();
+	bool SaveBakeCache() const;
+	VisTreeSettings GetVisTreeSettings() const;
+	void ClearVisTreeDirty();
 
 	void OpenHotReloadWindow();
 	void RenderUI(Renderer& renderer);
@@ -95,6 +108,7 @@ private:
 	void ViewportClickHandleBlockSelection(int pixelX, int pixelY, bool appendSelection, const Renderer& rend);
 
 	friend class UI;
+	friend class CLI;
 
 private:
 	bool m_saveScript;
@@ -102,11 +116,15 @@ private:
 	bool m_showHotReloadWindow;
 	bool m_loaded;
 	bool m_simpleVisTree;
+	bool m_symmetricVisTree;
 	bool m_genVisTree;
 	int m_maxQuadPerLeaf;
+	BSPBuilder m_bspBuilder;
+	int m_visTreeThreads;
 	float m_maxLeafAxisLength;
 	float m_distanceNearClip;
 	float m_distanceFarClip;
+	float m_visTreeCameraHeight;
 
 	std::vector<std::tuple<std::string, std::string>> m_invalidQuadblocks;
 	std::string m_logMessage;
@@ -131,6 +149,7 @@ private:
 	std::string m_pythonConsole;
 	std::vector<AnimTexture> m_animTextures;
 	BitMatrix m_bspVis;
+	std::vector<BoundingBox> m_bspVisInfluence;
 	std::vector<uint8_t> m_vrm;
 	Skybox m_skybox;
 
@@ -145,7 +164,7 @@ private:
 	MaterialProperty<bool, MaterialType::CHECKPOINT_PATHABLE> m_propCheckpointPathable;
 	MaterialProperty<bool, MaterialType::VISTREE_TRANSPARENT> m_propVisTreeTransparent;
 
-	std::array<Model*, LevelModels::COUNT> m_models;
+	std::array<Model*, LevelModels::COUNT> m_models = {};
 
 	Vec3 m_rendererQueryPoint;
 	std::vector<size_t> m_rendererSelectedQuadblockIndexes;
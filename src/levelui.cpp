@@ -11,6 +11,7 @@
 #include "texture.h"
 #include "ui.h"
 #include "script.h"
+#include "profiler.h"
 
 #include <imgui.h>
 #include <misc/cpp/imgui_stdlib.h>
@@ -100,28 +101,35 @@ void BoundingBox::RenderUI() const
 	ImGui::EndDisabled();
 }
 
-void BSP::RenderUI(const std::vector<Quadblock>& quadblocks)
+void BSP::RenderUI(const std::vector<Quadblock>& quadblocks) const
 {
-	std::string title = GetType() + " " + std::to_string(m_id);
+	if (!m_nodes.empty()) { RenderNodeUI(0, quadblocks); }
+}
+
+void BSP::RenderNodeUI(uint32_t id, const std::vector<Quadblock>& quadblocks) const
+{
+	const BSPTreeNode& node = m_nodes[id];
+	std::string title = GetType(id) + " " + std::to_string(id);
 	if (ImGui::TreeNode(title.c_str()))
 	{
-		if (IsBranch()) { ImGui::Text(("Axis:  " + GetAxis()).c_str()); }
-		ImGui::Text(("Quads: " + std::to_string(m_quadblockIndexes.size())).c_str());
+		if (node.IsBranch()) { ImGui::Text(("Axis:  " + GetAxis(id)).c_str()); }
+		ImGui::Text(("Quads: " + std::to_string(node.quadCount)).c_str());
 		if (ImGui::TreeNode("Quadblock List:"))
 		{
 			constexpr size_t QUADS_PER_LINE = 10;
-			for (size_t i = 0; i < m_quadblockIndexes.size(); i++)
+			std::span<const size_t> quadblockIndexes = GetQuadblockIndexes(id);
+			for (size_t i = 0; i < quadblockIndexes.size(); i++)
 			{
-				ImGui::Text((quadblocks[m_quadblockIndexes[i]].GetName() + ", ").c_str());
-				if (((i + 1) % QUADS_PER_LINE) == 0 || i == m_quadblockIndexes.size() - 1) { continue; }
+				ImGui::Text((quadblocks[quadblockIndexes[i]].GetName() + ", ").c_str());
+				if (((i + 1) % QUADS_PER_LINE) == 0 || i == quadblockIndexes.size() - 1) { continue; }
 				ImGui::SameLine();
 			}
 			ImGui::TreePop();
 		}
 		ImGui::Text("Bounding Box:");
-		m_bbox.RenderUI();
-		if (m_left) { m_left->RenderUI(quadblocks); }
-		if (m_right) { m_right->RenderUI(quadblocks); }
+		node.bbox.RenderUI();
+		if (node.left != BSP_NODE_NONE) { RenderNodeUI(node.left, quadblocks); }
+		if (node.right != BSP_NODE_NONE) { RenderNodeUI(node.right, quadblocks); }
 		ImGui::TreePop();
 	}
 }
@@ -418,6 +426,7 @@ void Level::RenderUI(Renderer& renderer)
 		if (ImGui::MenuItem("Renderer")) { Settings::w_renderer = !Settings::w_renderer; }
 		if (ImGui::MenuItem("Ghosts")) { Settings::w_ghost = !Settings::w_ghost; }
 		if (ImGui::MenuItem("Python")) { Settings::w_python = !Settings::w_python; }
+		if (ImGui::MenuItem("Profiler")) { Settings::w_profiler = !Settings::w_profiler; }
 		ImGui::EndMainMenuBar();
 	}
 
@@ -640,6 +649,7 @@ void Level::RenderUI(Renderer& renderer)
 	if (Settings::w_quadblocks)
 	{
 		bool resetBsp = false;
+		bool refitBsp = false;
 		if (ImGui::Begin("Quadblocks", &Settings::w_quadblocks))
 		{
 			ImGui::InputTextWithHint("Search", "Search Quadblocks...", &quadblockQuery);
@@ -647,7 +657,7 @@ void Level::RenderUI(Renderer& renderer)
 			{
 				if (!quadblock.GetHide() && Matches(quadblock.GetName(), quadblockQuery))
 				{
-					if (quadblock.RenderUI(m_checkpoints.size() - 1, resetBsp))
+					if (quadblock.RenderUI(m_checkpoints.size() - 1, resetBsp, refitBsp))
 					{
 						ManageTurbopad(quadblock);
 					}
@@ -660,6 +670,11 @@ void Level::RenderUI(Renderer& renderer)
 			m_bsp.Clear();
 			GenerateRenderBspData();
 		}
+		else if (refitBsp && m_bsp.IsValid())
+		{
+			m_bsp.RefitBoundingBoxes(m_quadblocks);
+			GenerateRenderBspData();
+		}
 	}
 
 	if (!quadblockQuery.empty() && !Settings::w_quadblocks) { quadblockQuery.clear(); }
@@ -758,6 +773,10 @@ void Level::RenderUI(Renderer& renderer)
 			static ButtonUI generateBSPButton = ButtonUI();
 			if (ImGui::TreeNode("Advanced"))
 			{
+				static const std::array<const char*, 2> bspBuilders = {"Midpoint", "Surface Area Heuristic"};
+				int bspBuilder = static_cast<int>(m_bspBuilder);
+				if (ImGui::Combo("BSP Builder", &bspBuilder, bspBuilders.data(), static_cast<int>(bspBuilders.size()))) { m_bspBuilder = static_cast<BSPBuilder>(bspBuilder); }
+				ImGui::SetItemTooltip("Midpoint splits each node in half. Surface Area Heuristic tests several split planes per axis and usually builds a shallower tree.");
 				if (ImGui::InputInt("Max Quad Per Leaf", &m_maxQuadPerLeaf)) { m_maxQuadPerLeaf = std::max(m_maxQuadPerLeaf, 1); }
 				ImGui::SetItemTooltip("Lower values improve rendering performance, but increases file size and slows down vis tree generation.");
 				if (ImGui::InputFloat("Max Leaf Axis Length", &m_maxLeafAxisLength)) { m_maxLeafAxisLength = std::max(m_maxLeafAxisLength, 0.0f); }
@@ -768,8 +787,14 @@ void Level::RenderUI(Renderer& renderer)
 				ImGui::SetItemTooltip("Maximum drawing distance. Lower values improve performance and speed up the vis tree generation.");
 				ImGui::Checkbox("Simple Vis Tree", &m_simpleVisTree);
 				ImGui::SetItemTooltip("The vis tree will be generated faster, but will be less precise");
+				ImGui::Checkbox("Symmetric Vis Tree", &m_symmetricVisTree);
+				ImGui::SetItemTooltip("Tests each pair of leaves once and assumes that visibility goes both ways. Roughly halves the generation time.");
+				if (ImGui::InputFloat("Vis Tree Camera Height", &m_visTreeCameraHeight)) { m_visTreeCameraHeight = std::max(m_visTreeCameraHeight, 0.0f); }
+				ImGui::SetItemTooltip("Height above ground quadblocks from which visibility is tested. With 0 the symmetric vis tree can reuse every result.");
 				ImGui::Checkbox("Generate Vis Tree", &m_genVisTree);
 				ImGui::SetItemTooltip("Generating the vis tree may take several minutes, but the gameplay will be more performant.");
+				if (ImGui::InputInt("Vis Tree Threads", &m_visTreeThreads)) { m_visTreeThreads = std::max(m_visTreeThreads, 0); }
+				ImGui::SetItemTooltip("Number of threads used to generate the vis tree. 0 uses every available core.");
 				ImGui::TreePop();
 			}
 			if (generateBSPButton.Show("Generate", buttonMessage, false))
@@ -777,6 +802,16 @@ void Level::RenderUI(Renderer& renderer)
 				if (GenerateBSP()) { buttonMessage = "Successfully generated the BSP tree."; }
 				else { buttonMessage = "Failed generating the BSP tree."; }
 			}
+			ImGui::BeginDisabled(!m_genVisTree || m_bspVis.IsEmpty() || !m_bsp.IsValid());
+			static std::string updateVisTreeMessage;
+			static ButtonUI updateVisTreeButton = ButtonUI();
+			if (updateVisTreeButton.Show("Update Vis Tree", updateVisTreeMessage, false))
+			{
+				if (UpdateVisTree()) { updateVisTreeMessage = "Successfully updated the vis tree."; }
+				else { updateVisTreeMessage = "Failed updating the vis tree."; }
+			}
+			ImGui::SetItemTooltip("Only recomputes the visibility of leaves affected by the quadblocks edited since the last bake.");
+			ImGui::EndDisabled();
 		}
 		ImGui::End();
 	}
@@ -1084,12 +1119,13 @@ void Level::RenderUI(Renderer& renderer)
 				{
 					Quadblock& quadblock = m_quadblocks[currentIndex];
 					bool resetBsp = false;
+					bool refitBsp = false;
 					if (prevSelectedQuadblock != currentIndex)
 					{
 						prevSelectedQuadblock = currentIndex;
 						ImGui::SetNextItemOpen(true);
 					}
-					if (quadblock.RenderUI(m_checkpoints.size() - 1, resetBsp))
+					if (quadblock.RenderUI(m_checkpoints.size() - 1, resetBsp, refitBsp))
 					{
 						ManageTurbopad(quadblock);
 					}
@@ -1098,6 +1134,11 @@ void Level::RenderUI(Renderer& renderer)
 						m_bsp.Clear();
 						GenerateRenderBspData();
 					}
+					else if (refitBsp && m_bsp.IsValid())
+					{
+						m_bsp.RefitBoundingBoxes(m_quadblocks);
+						GenerateRenderBspData();
+					}
 				}
 			}
 		}
@@ -1178,6 +1219,63 @@ void Level::RenderUI(Renderer& renderer)
 		}
 		ImGui::End();
 	}
+
+	if (Settings::w_profiler)
+	{
+		ImGui::SetNextWindowSize(ImVec2(560.0f, 400.0f), ImGuiCond_FirstUseEver);
+		if (ImGui::Begin("Profiler", &Settings::w_profiler))
+		{
+			constexpr float MEGABYTE = 1024.0f * 1024.0f;
+			ImGui::Text("Memory: %.1f MB (peak %.1f MB)", static_cast<float>(Profiler::GetCurrentMemory()) / MEGABYTE, static_cast<float>(Profiler::GetPeakMemory()) / MEGABYTE);
+			if (ImGui::Button("Reset")) { Profiler::Reset(); }
+			ImGui::SameLine();
+			if (ImGui::Button("Export JSON"))
+			{
+				auto selection = pfd::save_file("Profiler Report", "profile.json", {"JSON File (*.json)", "*.json"}).result();
+				if (!selection.empty())
+				{
+					std::ofstream file(selection);
+					file << Profiler::ToJson().dump(2) << std::endl;
+				}
+			}
+
+			ImGui::SeparatorText("Timers");
+			if (ImGui::BeginTable("Profiler Timers", 6, ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders | ImGuiTableFlags_SizingStretchProp))
+			{
+				ImGui::TableSetupColumn("Stage");
+				ImGui::TableSetupColumn("Calls");
+				ImGui::TableSetupColumn("Last (ms)");
+				ImGui::TableSetupColumn("Total (ms)");
+				ImGui::TableSetupColumn("Max (ms)");
+				ImGui::TableSetupColumn("Peak (MB)");
+				ImGui::TableHeadersRow();
+				for (const ProfilerTimer& timer : Profiler::GetTimers())
+				{
+					ImGui::TableNextRow();
+					ImGui::TableNextColumn(); ImGui::TextUnformatted(timer.name.c_str());
+					ImGui::TableNextColumn(); ImGui::Text("%zu", timer.calls);
+					ImGui::TableNextColumn(); ImGui::Text("%.2f", timer.lastMs);
+					ImGui::TableNextColumn(); ImGui::Text("%.2f", timer.totalMs);
+					ImGui::TableNextColumn(); ImGui::Text("%.2f", timer.maxMs);
+					ImGui::TableNextColumn(); ImGui::Text("%.1f", static_cast<float>(timer.peakMemory) / MEGABYTE);
+				}
+				ImGui::EndTable();
+			}
+
+			ImGui::SeparatorText("Counters");
+			if (ImGui::BeginTable("Profiler Counters", 2, ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders | ImGuiTableFlags_SizingStretchProp))
+			{
+				for (const ProfilerCounter& counter : Profiler::GetCounters())
+				{
+					ImGui::TableNextRow();
+					ImGui::TableNextColumn(); ImGui::TextUnformatted(counter.name.c_str());
+					ImGui::TableNextColumn(); ImGui::Text("%llu", static_cast<unsigned long long>(counter.value));
+				}
+				ImGui::EndTable();
+			}
+		}
+		ImGui::End();
+	}
 }
 
 void Path::RenderUI(const std::string& title, const std::vector<Quadblock>& quadblocks, const std::string& searchQuery, bool& insertAbove, bool& removePath, const std::vector<size_t>& selectedIndexes, bool mainPath)
@@ -1338,7 +1436,7 @@ void Path::RenderUI(const std::string& title, const std::vector<Quadblock>& quad
 	if (popColor) { ImGui::PopStyleColor(); }
 }
 
-bool Quadblock::RenderUI(size_t checkpointCount, bool& resetBsp)
+bool Quadblock::RenderUI(size_t checkpointCount, bool& resetBsp, bool& refitBsp)
 {
 	bool ret = false;
 	if (ImGui::TreeNode(m_name.c_str()))
@@ -1351,7 +1449,8 @@ bool Quadblock::RenderUI(size_t checkpointCount, bool& resetBsp)
 				m_p[i].RenderUI(i, editedPos);
 				if (editedPos)
 				{
-					resetBsp = true;
+					refitBsp = true;
+					m_visTreeDirty = true;
 					ComputeBoundingBox();
 				}
 			}
@@ -1408,13 +1507,13 @@ bool Quadblock::RenderUI(size_t checkpointCount, bool& resetBsp)
 		{
 			for (const auto& [label, flag] : QuadFlags::LABELS)
 			{
-				UIFlagCheckbox(m_flags, flag, label);
+				if (UIFlagCheckbox(m_flags, flag, label)) { m_visTreeDirty = true; }
 			}
 			ImGui::TreePop();
 		}
 		if (ImGui::TreeNode("Draw Flags"))
 		{
-			ImGui::Checkbox("Double Sided", &m_doubleSided);
+			if (ImGui::Checkbox("Double Sided", &m_doubleSided)) { m_visTreeDirty = true; }
 			const std::vector<std::string> s_rotateFlip = {"None", "Rotate 90", "Rotate 180", "Rotate -90", "Flip + Rotate 90", "Flip + Rotate 180", "Flip + Rotate -90", "Flip"};
 			const std::vector<std::string> s_faceDrawMode = {"Both", "Left", "Right", "None"};
 
@@ -1450,7 +1549,7 @@ bool Quadblock::RenderUI(size_t checkpointCount, bool& resetBsp)
 		ImGui::Text("Checkpoint Index: ");
 		ImGui::SameLine();
 		if (ImGui::InputInt("##cp", &m_checkpointIndex)) { m_checkpointIndex = Clamp(m_checkpointIndex, -1, static_cast<int>(checkpointCount)); }
-		ImGui::Checkbox("VisTree Transparency", &m_visTreeTransparent);
+		if (ImGui::Checkbox("VisTree Transparency", &m_visTreeTransparent)) { m_visTreeDirty = true; }
 		ImGui::Text("Trigger:");
 		if (ImGui::RadioButton("None", m_trigger == QuadblockTrigger::NONE))
 		{
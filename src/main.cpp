@@ -1,7 +1,14 @@
 #include "app.h"
+#include "cli.h"
 
 int main(int argc, char* argv[])
 {
+	if (argc > 1)
+	{
+		CLI cli;
+		return cli.Run(argc, argv);
+	}
+
 	App app;
 	if (!app.Init()) { return -1; }
 	app.Run();
@@ -0,0 +1,98 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+
+MappedFile::MappedFile() : m_data(nullptr), m_size(0), m_open(false), m_file(INVALID_HANDLE_VALUE), m_mapping(nullptr) {}
+
+bool MappedFile::Open(const std::filesystem::path& path)
+{
+	Close();
+	HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) { return false; }
+	m_file = file;
+
+	LARGE_INTEGER size = {};
+	if (!GetFileSizeEx(file, &size)) { Close(); return false; }
+	if (size.QuadPart > 0)
+	{
+		m_mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!m_mapping) { Close(); return false; }
+		m_data = static_cast<const uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+		if (!m_data) { Close(); return false; }
+	}
+	m_size = static_cast<size_t>(size.QuadPart);
+	m_open = true;
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (m_data) { UnmapViewOfFile(m_data); }
+	if (m_mapping) { CloseHandle(m_mapping); }
+	if (m_file != INVALID_HANDLE_VALUE) { CloseHandle(m_file); }
+	m_data = nullptr;
+	m_size = 0;
+	m_open = false;
+	m_mapping = nullptr;
+	m_file = INVALID_HANDLE_VALUE;
+}
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile() : m_data(nullptr), m_size(0), m_open(false) {}
+
+bool MappedFile::Open(const std::filesystem::path& path)
+{
+	Close();
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd == -1) { return false; }
+
+	struct stat st = {};
+	if (fstat(fd, &st) == -1) { close(fd); return false; }
+	const size_t size = static_cast<size_t>(st.st_size);
+	if (size > 0)
+	{
+		void* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (addr == MAP_FAILED) { close(fd); return false; }
+		madvise(addr, size, MADV_SEQUENTIAL);
+		m_data = static_cast<const uint8_t*>(addr);
+	}
+	close(fd);
+	m_size = size;
+	m_open = true;
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (m_data) { munmap(const_cast<uint8_t*>(m_data), m_size); }
+	m_data = nullptr;
+	m_size = 0;
+	m_open = false;
+}
+#endif
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+bool MappedFile::IsOpen() const
+{
+	return m_open;
+}
+
+const uint8_t* MappedFile::GetData() const
+{
+	return m_data;
+}
+
+size_t MappedFile::GetSize() const
+{
+	return m_size;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <filesystem>
+#include <cstdint>
+
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	bool Open(const std::filesystem::path& path);
+	void Close();
+	bool IsOpen() const;
+	const uint8_t* GetData() const;
+	size_t GetSize() const;
+
+private:
+	const uint8_t* m_data;
+	size_t m_size;
+	bool m_open;
+#ifdef _WIN32
+	void* m_file;
+	void* m_mapping;
+#endif
+};
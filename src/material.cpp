@@ -3,6 +3,7 @@
 #include <vector>
 #include <cstdint>
 #include <functional>
+#include <mutex>
 
 template class MaterialProperty<std::string, MaterialType::TERRAIN>;
 template class MaterialProperty<uint16_t, MaterialType::QUAD_FLAGS>;
@@ -13,20 +14,25 @@ template class MaterialProperty<int, MaterialType::SPEED_IMPACT>;
 template class MaterialProperty<bool, MaterialType::CHECKPOINT_PATHABLE>;
 template class MaterialProperty<bool, MaterialType::VISTREE_TRANSPARENT>;
 
+// Levels can be loaded on several threads at once by the command line tools
 static std::unordered_map<Level*, std::vector<MaterialBase*>> g_materials;
+static std::mutex g_materialsMutex;
 
 void ClearMaterials(Level* level)
 {
+	std::lock_guard<std::mutex> lock(g_materialsMutex);
 	for (MaterialBase* material : g_materials[level]) { material->Clear(); }
 }
 
 void RestoreMaterials(Level* level)
 {
+	std::lock_guard<std::mutex> lock(g_materialsMutex);
 	for (MaterialBase* material : g_materials[level]) { material->Restore(); }
 }
 
 void DeleteMaterials(Level* level)
 {
+	std::lock_guard<std::mutex> lock(g_materialsMutex);
 	g_materials.erase(level);
 }
 
@@ -40,6 +46,7 @@ MaterialProperty<T, M>::MaterialProperty()
 template<typename T, MaterialType M>
 void MaterialProperty<T, M>::RegisterMaterial(Level* level)
 {
+	std::lock_guard<std::mutex> lock(g_materialsMutex);
 	if (g_materials.contains(level)) { g_materials[level].push_back(this); }
 	else { g_materials.insert({level, { this }}); }
 }
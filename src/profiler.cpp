@@ -0,0 +1,138 @@
+#include "profiler.h"
+
+#include <mutex>
+#include <unordered_map>
+#include <algorithm>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <Psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#include <cstdio>
+#endif
+
+static std::mutex g_profilerMutex;
+static std::vector<ProfilerTimer> g_timers;
+static std::vector<ProfilerCounter> g_counters;
+static std::unordered_map<std::string, size_t> g_timerIndexes;
+static std::unordered_map<std::string, size_t> g_counterIndexes;
+
+void Profiler::AddTime(const std::string& name, double ms)
+{
+	const size_t peakMemory = GetPeakMemory();
+	std::lock_guard<std::mutex> lock(g_profilerMutex);
+	auto [it, inserted] = g_timerIndexes.emplace(name, g_timers.size());
+	if (inserted) { g_timers.push_back({name}); }
+
+	ProfilerTimer& timer = g_timers[it->second];
+	timer.calls++;
+	timer.totalMs += ms;
+	timer.lastMs = ms;
+	timer.maxMs = std::max(timer.maxMs, ms);
+	timer.peakMemory = peakMemory;
+}
+
+void Profiler::AddCount(const std::string& name, uint64_t value)
+{
+	std::lock_guard<std::mutex> lock(g_profilerMutex);
+	auto [it, inserted] = g_counterIndexes.emplace(name, g_counters.size());
+	if (inserted) { g_counters.push_back({name}); }
+	g_counters[it->second].value += value;
+}
+
+void Profiler::Reset()
+{
+	std::lock_guard<std::mutex> lock(g_profilerMutex);
+	g_timers.clear();
+	g_counters.clear();
+	g_timerIndexes.clear();
+	g_counterIndexes.clear();
+}
+
+std::vector<ProfilerTimer> Profiler::GetTimers()
+{
+	std::lock_guard<std::mutex> lock(g_profilerMutex);
+	return g_timers;
+}
+
+std::vector<ProfilerCounter> Profiler::GetCounters()
+{
+	std::lock_guard<std::mutex> lock(g_profilerMutex);
+	return g_counters;
+}
+
+#ifdef _WIN32
+size_t Profiler::GetCurrentMemory()
+{
+	PROCESS_MEMORY_COUNTERS counters = {};
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) { return 0; }
+	return static_cast<size_t>(counters.WorkingSetSize);
+}
+
+size_t Profiler::GetPeakMemory()
+{
+	PROCESS_MEMORY_COUNTERS counters = {};
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) { return 0; }
+	return static_cast<size_t>(counters.PeakWorkingSetSize);
+}
+#else
+size_t Profiler::GetCurrentMemory()
+{
+	FILE* file = fopen("/proc/self/statm", "r");
+	if (!file) { return 0; }
+	long pages = 0;
+	const bool read = fscanf(file, "%*s %ld", &pages) == 1;
+	fclose(file);
+	return read ? static_cast<size_t>(pages) * static_cast<size_t>(sysconf(_SC_PAGESIZE)) : 0;
+}
+
+size_t Profiler::GetPeakMemory()
+{
+	struct rusage usage = {};
+	if (getrusage(RUSAGE_SELF, &usage) != 0) { return 0; }
+#ifdef __APPLE__
+	return static_cast<size_t>(usage.ru_maxrss);
+#else
+	return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+}
+#endif
+
+nlohmann::json Profiler::ToJson()
+{
+	nlohmann::json timers = nlohmann::json::array();
+	for (const ProfilerTimer& timer : GetTimers())
+	{
+		timers.push_back({
+			{"name", timer.name}, {"calls", timer.calls}, {"totalMs", timer.totalMs},
+			{"lastMs", timer.lastMs}, {"maxMs", timer.maxMs}, {"peakMemory", timer.peakMemory}
+		});
+	}
+	nlohmann::json counters = nlohmann::json::object();
+	for (const ProfilerCounter& counter : GetCounters()) { counters[counter.name] = counter.value; }
+
+	nlohmann::json json;
+	json["timers"] = timers;
+	json["counters"] = counters;
+	json["currentMemory"] = GetCurrentMemory();
+	json["peakMemory"] = GetPeakMemory();
+	return json;
+}
+
+ScopedTimer::ScopedTimer(const char* name) : m_name(name), m_start(std::chrono::steady_clock::now()), m_running(true) {}
+
+ScopedTimer::~ScopedTimer()
+{
+	Stop();
+}
+
+void ScopedTimer::Stop()
+{
+	if (!m_running) { return; }
+	m_running = false;
+	Profiler::AddTime(m_name, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_start).count());
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <nlohmann/json.hpp>
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+
+struct ProfilerTimer
+{
+	std::string name;
+	size_t calls = 0;
+	double totalMs = 0.0;
+	double lastMs = 0.0;
+	double maxMs = 0.0;
+	size_t peakMemory = 0; // process peak resident memory when the timer last stopped, in bytes
+};
+
+struct ProfilerCounter
+{
+	std::string name;
+	uint64_t value = 0;
+};
+
+/*
+	Process wide timers and counters for the level build pipeline.
+	Names are grouped with a slash ("SaveLEV/write") and entries are kept in the order they were first recorded,
+	so reports read in pipeline order. Everything is guarded by a mutex: record once per stage, not per ray.
+*/
+class Profiler
+{
+public:
+	static void AddTime(const std::string& name, double ms);
+	static void AddCount(const std::string& name, uint64_t value);
+	static void Reset();
+	static std::vector<ProfilerTimer> GetTimers();
+	static std::vector<ProfilerCounter> GetCounters();
+	static size_t GetCurrentMemory();
+	static size_t GetPeakMemory();
+	static nlohmann::json ToJson();
+};
+
+class ScopedTimer
+{
+public:
+	ScopedTimer(const char* name);
+	~ScopedTimer();
+	ScopedTimer(const ScopedTimer&) = delete;
+	ScopedTimer& operator=(const ScopedTimer&) = delete;
+	void Stop();
+
+private:
+	const char* m_name;
+	std::chrono::steady_clock::time_point m_start;
+	bool m_running;
+};
@@ -419,6 +419,17 @@ Quadblock::Quadblock(const PSX::Quadblock& quadblock, const std::vector<PSX::Ver
 	m_filterCallback = filterCallback;
 }
 
+Quadblock::Quadblock(const std::string& name, const std::string& material, const std::array<Vertex, NUM_VERTICES_QUADBLOCK>& vertices, const std::array<QuadUV, NUM_FACES_QUADBLOCK + 1>& uvs, bool triblock, UpdateFilterCallback filterCallback)
+{
+	for (size_t i = 0; i < NUM_VERTICES_QUADBLOCK; i++) { m_p[i] = vertices[i]; }
+	m_uvs = uvs;
+	m_name = name;
+	m_material = material;
+	m_triblock = triblock;
+	m_filterCallback = filterCallback;
+	SetDefaultValues();
+}
+
 const std::string& Quadblock::GetName() const
 {
 	return m_name;
@@ -561,6 +572,11 @@ bool Quadblock::GetVisTreeTransparent() const
 	return m_visTreeTransparent;
 }
 
+bool Quadblock::GetVisTreeDirty() const
+{
+	return m_visTreeDirty;
+}
+
 const QuadUV& Quadblock::GetQuadUV(size_t quad) const
 {
 	return m_uvs[quad];
@@ -598,6 +614,7 @@ void Quadblock::SetTerrain(uint8_t terrain)
 
 void Quadblock::SetFlag(uint16_t flag)
 {
+	if ((m_flags ^ flag) & QuadFlags::GROUND) { m_visTreeDirty = true; }
 	m_flags = flag;
 }
 
@@ -613,6 +630,7 @@ int Quadblock::GetCheckpoint() const
 
 void Quadblock::SetDrawDoubleSided(bool active)
 {
+	if (m_doubleSided != active) { m_visTreeDirty = true; }
 	m_doubleSided = active;
 }
 
@@ -628,9 +646,15 @@ void Quadblock::SetCheckpointPathable(bool pathable)
 
 void Quadblock::SetVisTreeTransparent(bool transparent)
 {
+	if (m_visTreeTransparent != transparent) { m_visTreeDirty = true; }
 	m_visTreeTransparent = transparent;
 }
 
+void Quadblock::SetVisTreeDirty(bool dirty)
+{
+	m_visTreeDirty = dirty;
+}
+
 void Quadblock::SetName(const std::string& name)
 {
 	m_name = name;
@@ -692,6 +716,7 @@ void Quadblock::Translate(float ratio, const Vec3& direction)
 {
 	for (size_t i = 0; i < NUM_VERTICES_QUADBLOCK; i++) { m_p[i].m_pos += direction * ratio; }
 	ComputeBoundingBox();
+	m_visTreeDirty = true;
 }
 
 const BoundingBox& Quadblock::GetBoundingBox() const
@@ -784,10 +809,10 @@ std::vector<Primitive> Quadblock::ToGeometry(bool filterTriangles, const std::ar
 	return primitives;
 }
 
-std::vector<Vertex> Quadblock::GetVertices() const
+std::array<const Vertex*, NUM_VERTICES_QUADBLOCK> Quadblock::GetVertices() const
 {
-	/*                                 0       1       2       3       4       5       6       7       8    */
-	std::vector<Vertex> vertices = { m_p[0], m_p[2], m_p[6], m_p[8], m_p[1], m_p[3], m_p[4], m_p[5], m_p[7] };
+	/*                                                                0       1       2       3       4       5       6       7       8    */
+	std::array<const Vertex*, NUM_VERTICES_QUADBLOCK> vertices = { &m_p[0], &m_p[2], &m_p[6], &m_p[8], &m_p[1], &m_p[3], &m_p[4], &m_p[5], &m_p[7] };
 	return vertices;
 }
 
@@ -823,10 +848,9 @@ bool Quadblock::Neighbours(const Quadblock& quadblock, float threshold) const
 	return false;
 }
 
-std::vector<uint8_t> Quadblock::Serialize(size_t id, size_t offTextures, const std::vector<size_t>& vertexIndexes) const
+void Quadblock::Serialize(size_t id, size_t offTextures, const size_t* vertexIndexes, uint8_t* dst) const
 {
 	PSX::Quadblock quadblock = {};
-	std::vector<uint8_t> buffer(sizeof(quadblock));
 	for (size_t i = 0; i < NUM_VERTICES_QUADBLOCK; i++)
 	{
 		quadblock.index[i] = static_cast<uint16_t>(vertexIndexes[i]);
@@ -882,8 +906,7 @@ std::vector<uint8_t> Quadblock::Serialize(size_t id, size_t offTextures, const s
 	quadblock.triNormalVecDividend[7] = CalculateNormalDividend(6, 4, 7, scaler);
 	quadblock.triNormalVecDividend[9] = CalculateNormalDividend(2, 8, 6, scaler); /* low LoD */
 	quadblock.triNormalVecDividend[8] = CalculateNormalDividend(0, 2, 6, scaler); /* low LoD */
-	std::memcpy(buffer.data(), &quadblock, sizeof(quadblock));
-	return buffer;
+	std::memcpy(dst, &quadblock, sizeof(quadblock));
 }
 
 void Quadblock::SetDefaultValues()
@@ -902,6 +925,7 @@ void Quadblock::SetDefaultValues()
 	m_checkpointPathable = true;
 	m_checkpointStatus = false;
 	m_visTreeTransparent = false;
+	m_visTreeDirty = false;
 	m_trigger = QuadblockTrigger::NONE;
 	m_turboPadIndex = TURBO_PAD_INDEX_NONE;
 	m_hide = false;
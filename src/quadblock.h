@@ -114,6 +114,7 @@ public:
 	Quadblock(const std::string& name, Tri& t0, Tri& t1, Tri& t2, Tri& t3, const Vec3& normal, const std::string& material, bool hasUV, UpdateFilterCallback filterCallback);
 	Quadblock(const std::string& name, Quad& q0, Quad& q1, Quad& q2, Quad& q3, const Vec3& normal, const std::string& material, bool hasUV, UpdateFilterCallback filterCallback);
 	Quadblock(const PSX::Quadblock& quadblock, const std::vector<PSX::Vertex>& vertices, UpdateFilterCallback filterCallback);
+	Quadblock(const std::string& name, const std::string& material, const std::array<Vertex, NUM_VERTICES_QUADBLOCK>& vertices, const std::array<QuadUV, NUM_FACES_QUADBLOCK + 1>& uvs, bool triblock, UpdateFilterCallback filterCallback);
 	const std::string& GetName() const;
 	Vec3 GetCenter() const;
 	Vec3 GetNormal() const;
@@ -133,6 +134,7 @@ public:
 	bool GetCheckpointStatus() const;
 	bool GetCheckpointPathable() const;
 	bool GetVisTreeTransparent() const;
+	bool GetVisTreeDirty() const;
 	const QuadUV& GetQuadUV(size_t quad) const;
 	const std::filesystem::path& GetTexPath() const;
 	const std::array<QuadUV, NUM_FACES_QUADBLOCK + 1>& GetUVs() const;
@@ -147,6 +149,7 @@ public:
 	void SetCheckpointStatus(bool active);
 	void SetCheckpointPathable(bool pathable);
 	void SetVisTreeTransparent(bool transparent);
+	void SetVisTreeDirty(bool dirty);
 	void SetName(const std::string& name);
 	void SetTurboPadIndex(size_t index);
 	void SetHide(bool active);
@@ -162,12 +165,12 @@ public:
 	void Translate(float ratio, const Vec3& direction);
 	const BoundingBox& GetBoundingBox() const;
 	std::vector<Primitive> ToGeometry(bool filterTriangles = false, const std::array<QuadUV, NUM_FACES_QUADBLOCK + 1>* overrideUvs = nullptr, const std::filesystem::path* overrideTexturePath = nullptr) const;
-	std::vector<Vertex> GetVertices() const;
+	std::array<const Vertex*, NUM_VERTICES_QUADBLOCK> GetVertices() const;
 	const Vertex* const GetUnswizzledVertices() const;
 	float DistanceClosestVertex(Vec3& out, const Vec3& v) const;
 	bool Neighbours(const Quadblock& quadblock, float threshold = 0.1f) const;
-	std::vector<uint8_t> Serialize(size_t id, size_t offTextures, const std::vector<size_t>& vertexIndexes) const;
-	bool RenderUI(size_t checkpointCount, bool& resetBsp);
+	void Serialize(size_t id, size_t offTextures, const size_t* vertexIndexes, uint8_t* dst) const;
+	bool RenderUI(size_t checkpointCount, bool& resetBsp, bool& refitBsp);
 	Vec3 ComputeNormalVector(size_t id0, size_t id1, size_t id2) const;
 
 private:
@@ -189,6 +192,7 @@ private:
 	bool m_checkpointPathable;
 	bool m_checkpointStatus;
 	bool m_visTreeTransparent;
+	bool m_visTreeDirty;
 	bool m_hide;
 	Vertex m_p[NUM_VERTICES_QUADBLOCK];
 	BoundingBox m_bbox;
@@ -1,14 +1,23 @@
 #include "texture.h"
+#include "profiler.h"
+
+#include <limits>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#endif
+
 static constexpr size_t MIN_CLUT_WIDTH = 16;
 static constexpr size_t TEXPAGE_WIDTH = 64;
 static constexpr size_t TEXPAGE_HEIGHT = 256;
 static constexpr size_t VRAM_WIDTH = 512;
 static constexpr size_t VRAM_HEIGHT = 512;
 static constexpr size_t RESERVED_TEXPAGES[] = {6, 7};
+static constexpr size_t CLUT_LOOKUP_SIZE = 1 << 16; /* every 15-bit color, with and without the semi transparency bit */
+static constexpr uint32_t CLUT_LOOKUP_EMPTY = std::numeric_limits<uint32_t>::max();
 
 static size_t GetTexPage(size_t x, size_t y)
 {
@@ -22,6 +31,47 @@ Texture::Texture(const std::filesystem::path& path)
 	if (!CreateTexture()) { ClearTexture(); }
 }
 
+/* Rebuilds an already converted texture, e.g. from the compiled OBJ cache, without decoding the source image again */
+Texture::Texture(const std::filesystem::path& path, int width, int height, uint16_t blendMode, bool semiTransparent, const std::vector<uint16_t>& image, const std::vector<uint16_t>& clut)
+	: m_width(width), m_height(height), m_blendMode(blendMode), m_imageX(0), m_imageY(0), m_clutX(0), m_clutY(0), m_semiTransparent(semiTransparent), m_image(image), m_clut(clut), m_path(path)
+{
+	Texture::BPP bpp = GetBPP();
+	if (bpp == Texture::BPP::BPP_16) { return; }
+
+	const size_t indexesPerPixel = bpp == Texture::BPP::BPP_4 ? 4 : 2;
+	const size_t shifter = (sizeof(uint16_t) * 8) / indexesPerPixel;
+	const size_t rowWords = (static_cast<size_t>(m_width) + indexesPerPixel - 1) / indexesPerPixel;
+	const uint16_t mask = static_cast<uint16_t>((1u << shifter) - 1);
+	std::vector<size_t> colorIndexes;
+	colorIndexes.reserve(static_cast<size_t>(m_width) * m_height);
+	for (size_t y = 0; y < static_cast<size_t>(m_height); y++)
+	{
+		for (size_t x = 0; x < static_cast<size_t>(m_width); x++)
+		{
+			const size_t word = (y * rowWords) + (x / indexesPerPixel);
+			const uint16_t px = word < m_image.size() ? m_image[word] : 0;
+			colorIndexes.push_back((px >> (shifter * (x % indexesPerPixel))) & mask);
+		}
+	}
+	FillShapes(colorIndexes);
+}
+
+/* Checks that image and CLUT sizes read back from a file are the ones CreateTexture would have produced for these dimensions */
+bool Texture::IsValidConvertedImage(int width, int height, size_t imageCount, size_t clutCount)
+{
+	if (width == 0 && height == 0) { return imageCount == 0 && clutCount == 0; } /* textures that failed to load */
+	if (width <= 0 || height <= 0 || clutCount == 0) { return false; }
+	if (static_cast<size_t>(width) > TEXPAGE_WIDTH * 4 || static_cast<size_t>(height) > TEXPAGE_HEIGHT) { return false; }
+
+	size_t indexesPerPixel = 1;
+	if (clutCount <= 16) { indexesPerPixel = 4; }
+	else if (clutCount <= 256) { indexesPerPixel = 2; }
+	const size_t rowWords = (static_cast<size_t>(width) + indexesPerPixel - 1) / indexesPerPixel;
+	if (rowWords > TEXPAGE_WIDTH) { return false; }
+	if (indexesPerPixel == 1) { return imageCount == clutCount; } /* 16 bpp textures keep their colors as the image */
+	return imageCount == rowWords * static_cast<size_t>(height);
+}
+
 void Texture::UpdateTexture(const std::filesystem::path& path)
 {
 	uint16_t blendMode = m_blendMode;
@@ -220,14 +270,11 @@ void Texture::FillShapes(const std::vector<size_t>& colorIndexes)
 	Texture::BPP bpp = GetBPP();
 	if (bpp == Texture::BPP::BPP_16) { return; }
 
-	for (size_t i = 0; i < m_clut.size(); i++)
+	const size_t firstShape = m_shapes.size();
+	m_shapes.resize(firstShape + m_clut.size());
+	for (size_t j = 0; j < colorIndexes.size(); j++)
 	{
-		Shape shape;
-		for (size_t j = 0; j < colorIndexes.size(); j++)
-		{
-			if (colorIndexes[j] == i) { shape.insert(j); }
-		}
-		m_shapes.push_back(shape);
+		if (colorIndexes[j] < m_clut.size()) { m_shapes[firstShape + colorIndexes[j]].insert(j); }
 	}
 }
 
@@ -249,21 +296,23 @@ bool Texture::CreateTexture()
 	if (image == nullptr) { return false; }
 	bool alphaImage = channels == 4;
 	int semiTransparentPx = 0;
-	std::vector<size_t> colorIndexes;
 	const int pxCount = m_width * m_height;
+	std::vector<uint16_t> colors;
+	ConvertColors(image, channels, static_cast<size_t>(pxCount), colors);
+
+	/* Colors get their CLUT slot in order of first appearance, the lookup table just replaces the linear search */
+	std::vector<uint32_t> clutLookup(CLUT_LOOKUP_SIZE, CLUT_LOOKUP_EMPTY);
+	std::vector<size_t> colorIndexes(static_cast<size_t>(pxCount));
 	for (int i = 0; i < pxCount; i++)
 	{
-		int px = i * channels;
-		uint16_t color = alphaImage ? ConvertColor(image[px + 0], image[px + 1], image[px + 2], image[px + 3]) : ConvertColor(image[px + 0], image[px + 1], image[px + 2], 255);
-		if (alphaImage && (image[px + 3] != 255)) { semiTransparentPx++; }
-		bool foundColor = false;
-		size_t clutIndex = m_clut.size();
-		for (size_t j = 0; j < m_clut.size(); j++)
+		if (alphaImage && (image[(i * channels) + 3] != 255)) { semiTransparentPx++; }
+		uint32_t& clutIndex = clutLookup[colors[i]];
+		if (clutIndex == CLUT_LOOKUP_EMPTY)
 		{
-			if (color == m_clut[j]) { clutIndex = j; foundColor = true; break; }
+			clutIndex = static_cast<uint32_t>(m_clut.size());
+			m_clut.push_back(colors[i]);
 		}
-		if (!foundColor) { m_clut.push_back(color); }
-		colorIndexes.push_back(clutIndex);
+		colorIndexes[i] = clutIndex;
 	}
 	m_semiTransparent = semiTransparentPx >= (pxCount / 2);
 	Texture::BPP bpp = GetBPP();
@@ -295,6 +344,62 @@ uint16_t Texture::ConvertColor(unsigned char r, unsigned char g, unsigned char b
 	return color;
 }
 
+/*
+	Converts every pixel of the image to a 16-bit PSX color, the same way ConvertColor does.
+	The multiply-add fits in 16 bits ((255 * 249) + 1014 < 65536), so four pixels are converted at once in 32-bit lanes.
+*/
+void Texture::ConvertColors(const unsigned char* image, int channels, size_t count, std::vector<uint16_t>& colors)
+{
+	colors.resize(count);
+	size_t i = 0;
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	if (channels == 3 || channels == 4)
+	{
+		const __m128i byteMask = _mm_set1_epi32(0xFF);
+		const __m128i mul = _mm_set1_epi32(249);
+		const __m128i add = _mm_set1_epi32(1014);
+		const __m128i opaque = _mm_set1_epi32(255);
+		const __m128i semiTransparentBit = _mm_set1_epi32(1 << 15);
+		const __m128i blackColor = _mm_set1_epi32(1 << 10);
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i rgbAlpha = _mm_set1_epi32(static_cast<int>(0xFF000000));
+		const size_t pxBytes = static_cast<size_t>(channels);
+		/* every load reads 16 bytes, so RGB images stop early enough to stay inside the buffer */
+		const size_t simdCount = channels == 4 ? count & ~static_cast<size_t>(3) : (count >= 6 ? (count - 2) & ~static_cast<size_t>(3) : 0);
+		for (; i < simdCount; i += 4)
+		{
+			__m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(image + (i * pxBytes)));
+			if (channels == 3)
+			{
+				const __m128i px01 = _mm_unpacklo_epi32(px, _mm_srli_si128(px, 3));
+				const __m128i px23 = _mm_unpacklo_epi32(_mm_srli_si128(px, 6), _mm_srli_si128(px, 9));
+				px = _mm_or_si128(_mm_unpacklo_epi64(px01, px23), rgbAlpha);
+			}
+			const __m128i r = _mm_and_si128(px, byteMask);
+			const __m128i g = _mm_and_si128(_mm_srli_epi32(px, 8), byteMask);
+			const __m128i b = _mm_and_si128(_mm_srli_epi32(px, 16), byteMask);
+			const __m128i a = _mm_srli_epi32(px, 24);
+			const __m128i r5 = _mm_srli_epi32(_mm_add_epi32(_mm_mullo_epi16(r, mul), add), 11);
+			const __m128i g5 = _mm_srli_epi32(_mm_add_epi32(_mm_mullo_epi16(g, mul), add), 11);
+			const __m128i b5 = _mm_srli_epi32(_mm_add_epi32(_mm_mullo_epi16(b, mul), add), 11);
+			__m128i color = _mm_or_si128(_mm_or_si128(r5, _mm_slli_epi32(g5, 5)), _mm_slli_epi32(b5, 10));
+			color = _mm_or_si128(color, _mm_andnot_si128(_mm_cmpeq_epi32(a, opaque), semiTransparentBit));
+			color = _mm_or_si128(color, _mm_and_si128(_mm_cmpeq_epi32(color, zero), blackColor));
+			color = _mm_andnot_si128(_mm_cmpeq_epi32(a, zero), color);
+			/* sign extend the low halves so that the saturating pack keeps the bits as they are */
+			color = _mm_srai_epi32(_mm_slli_epi32(color, 16), 16);
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(colors.data() + i), _mm_packs_epi32(color, color));
+		}
+	}
+#endif
+	const bool alphaImage = channels == 4;
+	for (; i < count; i++)
+	{
+		const size_t px = i * channels;
+		colors[i] = ConvertColor(image[px + 0], image[px + 1], image[px + 2], alphaImage ? image[px + 3] : 255);
+	}
+}
+
 void Texture::ConvertPixels(const std::vector<size_t>& colorIndexes, unsigned indexesPerPixel)
 {
 	uint16_t px = 0;
@@ -374,6 +479,8 @@ static bool FindAvailableSpace(std::vector<bool>& vramUsed, size_t width, size_t
 
 std::vector<uint8_t> PackVRM(std::vector<Texture*>& textures)
 {
+	ScopedTimer timer("PackVRM");
+	Profiler::AddCount("PackVRM/textures", textures.size());
 	bool empty = true;
 	std::vector<Texture*> cachedTextures;
 	std::vector<uint16_t> vram(VRAM_WIDTH * VRAM_HEIGHT, 0);
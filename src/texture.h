@@ -20,6 +20,7 @@ public:
 	};
 	Texture() : m_width(0), m_height(0), m_imageX(0), m_imageY(0), m_clutX(0), m_clutY(0), m_blendMode(0), m_semiTransparent(false) {};
 	Texture(const std::filesystem::path& path);
+	Texture(const std::filesystem::path& path, int width, int height, uint16_t blendMode, bool semiTransparent, const std::vector<uint16_t>& image, const std::vector<uint16_t>& clut);
 	void UpdateTexture(const std::filesystem::path& path);
 	Texture::BPP GetBPP() const;
 	int GetWidth() const;
@@ -45,12 +46,14 @@ public:
 	bool operator!=(const Texture& tex) const;
 	void RenderUI(const std::vector<size_t>& quadblockIndexes, std::vector<Quadblock>& quadblocks, std::function<void(void)> refreshTextureStores);
 	void RenderUI();
+	static bool IsValidConvertedImage(int width, int height, size_t imageCount, size_t clutCount);
 
 private:
 	void FillShapes(const std::vector<size_t>& colorIndexes);
 	void ClearTexture();
 	bool CreateTexture();
-	uint16_t ConvertColor(unsigned char r, unsigned char g, unsigned char b, unsigned char a);
+	static uint16_t ConvertColor(unsigned char r, unsigned char g, unsigned char b, unsigned char a);
+	static void ConvertColors(const unsigned char* image, int channels, size_t count, std::vector<uint16_t>& colors);
 	void ConvertPixels(const std::vector<size_t>& colorIndexes, unsigned indexesPerPixel);
 
 private:
@@ -2,6 +2,8 @@
 
 #include <string>
 #include <cstring>
+#include <bit>
+#include <algorithm>
 
 Vertex::Vertex()
 {
@@ -30,16 +32,14 @@ Vertex::Vertex(const PSX::Vertex& vertex)
 	m_normal = {0.0f, 1.0f, 0.0f};
 }
 
-std::vector<uint8_t> Vertex::Serialize() const
+void Vertex::Serialize(uint8_t* dst) const
 {
 	PSX::Vertex v = {};
-	std::vector<uint8_t> buffer(sizeof(v));
 	v.pos = ConvertVec3(m_pos, FP_ONE_GEO);
 	v.flags = m_flags;
 	v.colorHi = ConvertColor(m_colorHigh);
 	v.colorLo = ConvertColor(m_colorLow);
-	std::memcpy(buffer.data(), &v, sizeof(v));
-	return buffer;
+	std::memcpy(dst, &v, sizeof(v));
 }
 
 Color Vertex::GetColor(bool high) const
@@ -75,3 +75,62 @@ std::vector<Primitive> Vertex::ToGeometry(bool highColor) const
 	for (const Vec3& dir : radiusDirection) { AppendTri(dir); }
 	return triangles;
 }
+
+VertexWelder::VertexWelder(size_t expectedCount)
+{
+	m_slots.assign(std::bit_ceil(std::max<size_t>(expectedCount * 2, 64)), EMPTY_SLOT);
+	m_keys.reserve(expectedCount);
+	m_vertices.reserve(expectedCount);
+}
+
+size_t VertexWelder::Weld(const Vertex& vertex)
+{
+	const PSX::Vec3 pos = ConvertVec3(vertex.m_pos, FP_ONE_GEO);
+	Key key;
+	key.pos = static_cast<uint64_t>(static_cast<uint16_t>(pos.x)) | (static_cast<uint64_t>(static_cast<uint16_t>(pos.y)) << 16) |
+		(static_cast<uint64_t>(static_cast<uint16_t>(pos.z)) << 32) | (static_cast<uint64_t>(vertex.m_flags) << 48);
+	const Color& high = vertex.m_colorHigh;
+	const Color& low = vertex.m_colorLow;
+	key.color = static_cast<uint64_t>(high.r) | (static_cast<uint64_t>(high.g) << 8) | (static_cast<uint64_t>(high.b) << 16) | (static_cast<uint64_t>(high.a) << 24) |
+		(static_cast<uint64_t>(low.r) << 32) | (static_cast<uint64_t>(low.g) << 40) | (static_cast<uint64_t>(low.b) << 48) | (static_cast<uint64_t>(low.a) << 56);
+
+	if ((m_keys.size() + 1) * 2 > m_slots.size()) { Grow(); }
+	const size_t mask = m_slots.size() - 1;
+	for (size_t slot = HashKey(key) & mask;; slot = (slot + 1) & mask)
+	{
+		const uint32_t index = m_slots[slot];
+		if (index == EMPTY_SLOT)
+		{
+			m_slots[slot] = static_cast<uint32_t>(m_keys.size());
+			m_keys.push_back(key);
+			m_vertices.push_back(&vertex);
+			return m_keys.size() - 1;
+		}
+		if (m_keys[index] == key) { return index; }
+	}
+}
+
+const std::vector<const Vertex*>& VertexWelder::GetVertices() const
+{
+	return m_vertices;
+}
+
+size_t VertexWelder::HashKey(const Key& key)
+{
+	uint64_t hash = (key.pos * 0x9E3779B97F4A7C15) ^ (key.color * 0xC2B2AE3D27D4EB4F);
+	hash ^= hash >> 29;
+	return static_cast<size_t>(hash);
+}
+
+void VertexWelder::Grow()
+{
+	std::vector<uint32_t> slots(m_slots.size() * 2, EMPTY_SLOT);
+	const size_t mask = slots.size() - 1;
+	for (size_t index = 0; index < m_keys.size(); index++)
+	{
+		size_t slot = HashKey(m_keys[index]) & mask;
+		while (slots[slot] != EMPTY_SLOT) { slot = (slot + 1) & mask; }
+		slots[slot] = static_cast<uint32_t>(index);
+	}
+	m_slots.swap(slots);
+}
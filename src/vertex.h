@@ -4,6 +4,8 @@
 #include "psx_types.h"
 
 #include <cstdint>
+#include <vector>
+#include <limits>
 
 struct VertexFlags
 {
@@ -17,7 +19,7 @@ public:
 	Vertex(const Point& point);
 	Vertex(const PSX::Vertex& vertex);
 	void RenderUI(size_t index, bool& editedPos);
-	std::vector<uint8_t> Serialize() const;
+	void Serialize(uint8_t* dst) const;
 	Color GetColor(bool high) const;
 	std::vector<Primitive> ToGeometry(bool highColor = true) const;
 	inline bool operator==(const Vertex& v) const {
@@ -39,6 +41,37 @@ private:
 	Color m_colorLow;
 
 	friend std::hash<Vertex>;
+	friend class VertexWelder;
+};
+
+/*
+	Deduplicates vertices the way the game sees them: positions are compared once converted to fixed point.
+	Each vertex is packed into two 64-bit words (position and flags, then both colors),
+	which are looked up in an open addressing table.
+*/
+class VertexWelder
+{
+public:
+	VertexWelder(size_t expectedCount);
+	size_t Weld(const Vertex& vertex);
+	const std::vector<const Vertex*>& GetVertices() const;
+
+private:
+	struct Key
+	{
+		uint64_t pos;
+		uint64_t color;
+		inline bool operator==(const Key& key) const { return pos == key.pos && color == key.color; }
+	};
+
+	static size_t HashKey(const Key& key);
+	void Grow();
+
+private:
+	static constexpr uint32_t EMPTY_SLOT = std::numeric_limits<uint32_t>::max();
+	std::vector<uint32_t> m_slots;
+	std::vector<Key> m_keys;
+	std::vector<const Vertex*> m_vertices;
 };
 
 template<>
@@ -1,13 +1,26 @@
 #include "vistree.h"
+#include "profiler.h"
 #include <omp.h>
 #include <cmath>
 #include <unordered_set>
 #include <chrono>
 #include <algorithm>
+#include <bit>
+#include <cstring>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#endif
 
 bool BitMatrix::Get(size_t x, size_t y) const
 {
-	return m_data[(y * m_width) + x];
+	return (m_data[(x * m_rowWords) + (y / 64)] >> (y % 64)) & 1;
 }
 
 size_t BitMatrix::GetWidth() const
@@ -20,103 +33,120 @@ size_t BitMatrix::GetHeight() const
 	return m_height;
 }
 
-void BitMatrix::Set(bool value, size_t x, size_t y)
+size_t BitMatrix::GetRowWords() const
 {
-	m_data[(y * m_width) + x] = value;
+	return m_rowWords;
 }
 
-bool BitMatrix::IsEmpty() const
+const uint64_t* BitMatrix::GetRow(size_t x) const
 {
-	return m_data.empty();
+	return &m_data[x * m_rowWords];
 }
 
-void BitMatrix::Clear()
+void BitMatrix::GetPSXRow(size_t x, uint8_t* dst) const
 {
-	m_width = 0;
-	m_height = 0;
-	m_data.clear();
+	// The game reads the bits of each 32-bit word starting from the most significant one
+	const size_t wordCount = (m_height + 31) / 32;
+	const uint64_t* row = GetRow(x);
+	for (size_t i = 0; i < wordCount; i++)
+	{
+		uint32_t word = static_cast<uint32_t>(row[i / 2] >> (32 * (i % 2)));
+		uint32_t reversed = 0;
+		for (size_t bit = 0; bit < 32; bit++) { reversed |= ((word >> bit) & 1) << (31 - bit); }
+		std::memcpy(dst + i * sizeof(reversed), &reversed, sizeof(reversed));
+	}
 }
 
-static bool WorldspaceRayTriIntersection(const Vec3& worldSpaceRayOrigin, const Vec3& worldSpaceRayDir, const std::array<Vec3, 3>& tri, float& dist)
+void BitMatrix::Set(bool value, size_t x, size_t y)
 {
-	//TODO : merge with renderer 
-	constexpr float failsafe = 0.5f; 
-	constexpr float barycentricTolerance = 0.5f; 
-
-	//moller-trumbore intersection test
-	//https://en.wikipedia.org/wiki/M%C3%B6ller%E2%80%93Trumbore_intersection_algorithm
-
-	Vec3 edge_1 = tri[1] - tri[0], edge_2 = tri[2] - tri[0];
-	Vec3 ray_cross_e2 = worldSpaceRayDir.Cross(edge_2);
-	float det = edge_1.Dot(ray_cross_e2);
-
-	if (std::abs(det) < EPSILON) { return false; } // ray is parallel to plane
+	uint64_t& word = m_data[(x * m_rowWords) + (y / 64)];
+	const uint64_t mask = static_cast<uint64_t>(1) << (y % 64);
+	if (value) { word |= mask; }
+	else { word &= ~mask; }
+}
 
-	float inv_det = 1.0f / det;
-	Vec3 s = worldSpaceRayOrigin - tri[0];
-	float u = inv_det * s.Dot(ray_cross_e2);
+void BitMatrix::SetRow(size_t x, const uint64_t* words)
+{
+	std::copy_n(words, m_rowWords, m_data.begin() + (x * m_rowWords));
+}
 
-	// Allow u to be slightly outside [0, 1] range
-	// u < -tolerance means point is beyond edge 0->1
-	// u > 1+tolerance means point is beyond the opposite side
-	if (u < -barycentricTolerance || u > 1.0f + barycentricTolerance) {
-		return false;
-	}
+void BitMatrix::OrRow(size_t x, const BitMatrix& other, size_t otherX)
+{
+	uint64_t* row = &m_data[x * m_rowWords];
+	const uint64_t* otherRow = other.GetRow(otherX);
+	for (size_t i = 0; i < m_rowWords; i++) { row[i] |= otherRow[i]; }
+}
 
-	Vec3 s_cross_e1 = s.Cross(edge_1);
-	float v = inv_det * worldSpaceRayDir.Dot(s_cross_e1);
+void BitMatrix::AndRow(size_t x, const BitMatrix& other, size_t otherX)
+{
+	uint64_t* row = &m_data[x * m_rowWords];
+	const uint64_t* otherRow = other.GetRow(otherX);
+	for (size_t i = 0; i < m_rowWords; i++) { row[i] &= otherRow[i]; }
+}
 
-	// Allow v to be slightly outside [0, 1] range
-	if (v < -barycentricTolerance || v > 1.0f + barycentricTolerance) {
-		return false;
-	}
+void BitMatrix::ClearRow(size_t x)
+{
+	std::fill_n(m_data.begin() + (x * m_rowWords), m_rowWords, static_cast<uint64_t>(0));
+}
 
-	// Check if u+v is within triangle (with tolerance)
-	// u+v > 1 means outside the triangle on the hypotenuse edge
-	if (u + v > 1.0f + barycentricTolerance) {
-		return false;
-	}
+size_t BitMatrix::CountRow(size_t x) const
+{
+	size_t count = 0;
+	const uint64_t* row = GetRow(x);
+	for (size_t i = 0; i < m_rowWords; i++) { count += std::popcount(row[i]); }
+	return count;
+}
 
-	float t = inv_det * edge_2.Dot(s_cross_e1); // time value (interpolant)
+size_t BitMatrix::Count() const
+{
+	size_t count = 0;
+	for (uint64_t word : m_data) { count += std::popcount(word); }
+	return count;
+}
 
-	// Allow hits slightly behind the origin (for edge cases where ray starts on surface)
-	if (t > -failsafe) {
-		dist = t;
-		return true;
-	}
+bool BitMatrix::IsEmpty() const
+{
+	return m_data.empty();
+}
 
-	return false;
+void BitMatrix::Clear()
+{
+	m_width = 0;
+	m_height = 0;
+	m_rowWords = 0;
+	m_data.clear();
 }
 
-static bool RayIntersectQuadblockTest(const Vec3& worldSpaceRayOrigin, const Vec3& worldSpaceRayDir, const Quadblock& qb, float& dist)
+// Ray with its inverse direction computed once, shared by every bounding box test
+struct VisRay
 {
-	std::vector<std::array<size_t, 3>> triFacesID = qb.GetTriFacesIndexes();
-	for (std::array<size_t, 3> ids : triFacesID) 
+	VisRay(const Vec3& origin, const Vec3& dir) : origin(origin), dir(dir)
 	{
-		if (WorldspaceRayTriIntersection(worldSpaceRayOrigin, worldSpaceRayDir, qb.GetTriFace(ids[0], ids[1], ids[2]), dist)) { return true; }
+		constexpr float epsilon = 0.00001f;
+		invDir.x = 1.0f / (std::abs(dir.x) < epsilon ? epsilon : dir.x);
+		invDir.y = 1.0f / (std::abs(dir.y) < epsilon ? epsilon : dir.y);
+		invDir.z = 1.0f / (std::abs(dir.z) < epsilon ? epsilon : dir.z);
 	}
-	return false;
-}
+
+	Vec3 origin;
+	Vec3 dir;
+	Vec3 invDir;
+};
 
 // Ray-AABB intersection test using the slab method
 // Returns true if the ray intersects the bounding box, and sets dist to the distance to the nearest intersection
-static bool RayIntersectBoundingBox(const Vec3& rayOrigin, const Vec3& rayDir, const BoundingBox& bbox, float& tmin, float& tmax)
+static bool RayIntersectBoundingBox(const VisRay& ray, const BoundingBox& bbox, float& tmin, float& tmax)
 {
-	constexpr float epsilon = 0.00001f;
 	constexpr float failsafe = 0.5f;
-
-	// Compute inverse ray direction for efficiency
-	float invDirX = 1.0f / (std::abs(rayDir.x) < epsilon ? epsilon : rayDir.x);
-	float invDirY = 1.0f / (std::abs(rayDir.y) < epsilon ? epsilon : rayDir.y);
-	float invDirZ = 1.0f / (std::abs(rayDir.z) < epsilon ? epsilon : rayDir.z);
+	const Vec3& rayOrigin = ray.origin;
 
 	// Compute intersection distances for each pair of slabs
-	float t1 = (bbox.min.x - rayOrigin.x) * invDirX;
-	float t2 = (bbox.max.x - rayOrigin.x) * invDirX;
-	float t3 = (bbox.min.y - rayOrigin.y) * invDirY;
-	float t4 = (bbox.max.y - rayOrigin.y) * invDirY;
-	float t5 = (bbox.min.z - rayOrigin.z) * invDirZ;
-	float t6 = (bbox.max.z - rayOrigin.z) * invDirZ;
+	float t1 = (bbox.min.x - rayOrigin.x) * ray.invDir.x;
+	float t2 = (bbox.max.x - rayOrigin.x) * ray.invDir.x;
+	float t3 = (bbox.min.y - rayOrigin.y) * ray.invDir.y;
+	float t4 = (bbox.max.y - rayOrigin.y) * ray.invDir.y;
+	float t5 = (bbox.min.z - rayOrigin.z) * ray.invDir.z;
+	float t6 = (bbox.max.z - rayOrigin.z) * ray.invDir.z;
 
 	// Find the min and max for each axis
 	tmin = std::max(std::max(std::min(t1, t2), std::min(t3, t4)), std::min(t5, t6));
@@ -138,91 +168,351 @@ static bool RayIntersectBoundingBox(const Vec3& rayOrigin, const Vec3& rayDir, c
 	return true;
 }
 
-// Helper structure to store leaf data with its tmax value
-struct LeafWithDistance
+static constexpr size_t VIS_TRIANGLES_PER_QUAD = 8;
+
+// Triangles of one quadblock stored component by component, so that a single ray can be tested against
+// 4 or 8 of them at once. Triblocks only use the first 4 slots, the others are degenerated and never hit.
+struct VisTriangles
 {
-	std::vector<size_t> quadIndexes; // All quads in this leaf
-	float tmax; // Distance to the far side of the leaf's bounding box
+	alignas(32) float v0[3][VIS_TRIANGLES_PER_QUAD];
+	alignas(32) float e1[3][VIS_TRIANGLES_PER_QUAD];
+	alignas(32) float e2[3][VIS_TRIANGLES_PER_QUAD];
 };
 
-// Recursively traverse BSP tree to collect leaves with their distances
-static void GetPotentialLeavesRecursive(
-	const std::vector<Quadblock>& quadblocks,
-	const BSP* node,
-	const Vec3& rayOrigin,
-	const Vec3& rayDir,
-	const float maxDist,
-	std::vector<LeafWithDistance>& result)
+static VisTriangles BuildVisTriangles(const Quadblock& quadblock)
 {
-	float tmin, tmax;
-	// Check if the ray intersects this node's bounding box
-	if (!RayIntersectBoundingBox(rayOrigin, rayDir, node->GetBoundingBox(), tmin, tmax)) { return; }
+	VisTriangles tris = {};
+	const Vertex* verts = quadblock.GetUnswizzledVertices();
+	const std::vector<std::array<size_t, 3>> triFacesID = quadblock.GetTriFacesIndexes();
+	for (size_t i = 0; i < triFacesID.size(); i++)
+	{
+		const std::array<size_t, 3>& ids = triFacesID[i];
+		const Vec3& p0 = verts[ids[0]].m_pos;
+		const Vec3 edge_1 = verts[ids[1]].m_pos - p0;
+		const Vec3 edge_2 = verts[ids[2]].m_pos - p0;
+		for (size_t axis = 0; axis < 3; axis++)
+		{
+			tris.v0[axis][i] = p0.Data()[axis];
+			tris.e1[axis][i] = edge_1.Data()[axis];
+			tris.e2[axis][i] = edge_2.Data()[axis];
+		}
+	}
+	return tris;
+}
+
+//moller-trumbore intersection test
+//https://en.wikipedia.org/wiki/M%C3%B6ller%E2%80%93Trumbore_intersection_algorithm
+//Every version below performs the exact same float operations, so they all return the same hits.
+static constexpr float TRI_FAILSAFE = 0.5f;
+static constexpr float TRI_BARYCENTRIC_TOLERANCE = 0.5f;
+
+static bool RayIntersectTriangle(const VisRay& ray, const VisTriangles& tris, size_t i, float& dist)
+{
+	const Vec3 edge_1 = Vec3(tris.e1[0][i], tris.e1[1][i], tris.e1[2][i]);
+	const Vec3 edge_2 = Vec3(tris.e2[0][i], tris.e2[1][i], tris.e2[2][i]);
+	Vec3 ray_cross_e2 = ray.dir.Cross(edge_2);
+	float det = edge_1.Dot(ray_cross_e2);
+
+	if (std::abs(det) < EPSILON) { return false; } // ray is parallel to plane
 
-	// Check if the node's bounding box is too far away
-	if (tmin > maxDist) { return; }
+	float inv_det = 1.0f / det;
+	Vec3 s = ray.origin - Vec3(tris.v0[0][i], tris.v0[1][i], tris.v0[2][i]);
+	float u = inv_det * s.Dot(ray_cross_e2);
+
+	// Allow u and v to be slightly outside [0, 1] range
+	if (u < -TRI_BARYCENTRIC_TOLERANCE || u > 1.0f + TRI_BARYCENTRIC_TOLERANCE) { return false; }
+
+	Vec3 s_cross_e1 = s.Cross(edge_1);
+	float v = inv_det * ray.dir.Dot(s_cross_e1);
+	if (v < -TRI_BARYCENTRIC_TOLERANCE || v > 1.0f + TRI_BARYCENTRIC_TOLERANCE) { return false; }
+
+	// u+v > 1 means outside the triangle on the hypotenuse edge
+	if (u + v > 1.0f + TRI_BARYCENTRIC_TOLERANCE) { return false; }
 
-	// If this is a leaf node, add it's LeafWithDistance
-	if (!node->IsBranch())
+	float t = inv_det * edge_2.Dot(s_cross_e1); // time value (interpolant)
+
+	// Allow hits slightly behind the origin (for edge cases where ray starts on surface)
+	if (t > -TRI_FAILSAFE)
 	{
-		result.push_back({ node->GetQuadblockIndexes(), tmax });
-		return;
+		dist = t;
+		return true;
 	}
+	return false;
+}
+
+#if defined(__AVX2__)
+
+// Returns the bitmask of the 8 triangles hit by the ray, and their distances
+static int RayIntersectTriangles8(const VisRay& ray, const VisTriangles& tris, float* dist)
+{
+	const __m256 dirX = _mm256_set1_ps(ray.dir.x), dirY = _mm256_set1_ps(ray.dir.y), dirZ = _mm256_set1_ps(ray.dir.z);
+	const __m256 e1X = _mm256_load_ps(tris.e1[0]), e1Y = _mm256_load_ps(tris.e1[1]), e1Z = _mm256_load_ps(tris.e1[2]);
+	const __m256 e2X = _mm256_load_ps(tris.e2[0]), e2Y = _mm256_load_ps(tris.e2[1]), e2Z = _mm256_load_ps(tris.e2[2]);
+
+	const __m256 cX = _mm256_sub_ps(_mm256_mul_ps(dirY, e2Z), _mm256_mul_ps(dirZ, e2Y));
+	const __m256 cY = _mm256_sub_ps(_mm256_mul_ps(dirZ, e2X), _mm256_mul_ps(dirX, e2Z));
+	const __m256 cZ = _mm256_sub_ps(_mm256_mul_ps(dirX, e2Y), _mm256_mul_ps(e2X, dirY));
+	const __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1X, cX), _mm256_mul_ps(e1Y, cY)), _mm256_mul_ps(e1Z, cZ));
+	const __m256 absDet = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), det);
+	__m256 reject = _mm256_cmp_ps(absDet, _mm256_set1_ps(EPSILON), _CMP_LT_OQ);
+
+	const __m256 invDet = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+	const __m256 sX = _mm256_sub_ps(_mm256_set1_ps(ray.origin.x), _mm256_load_ps(tris.v0[0]));
+	const __m256 sY = _mm256_sub_ps(_mm256_set1_ps(ray.origin.y), _mm256_load_ps(tris.v0[1]));
+	const __m256 sZ = _mm256_sub_ps(_mm256_set1_ps(ray.origin.z), _mm256_load_ps(tris.v0[2]));
+	const __m256 u = _mm256_mul_ps(invDet, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sX, cX), _mm256_mul_ps(sY, cY)), _mm256_mul_ps(sZ, cZ)));
+
+	const __m256 qX = _mm256_sub_ps(_mm256_mul_ps(sY, e1Z), _mm256_mul_ps(sZ, e1Y));
+	const __m256 qY = _mm256_sub_ps(_mm256_mul_ps(sZ, e1X), _mm256_mul_ps(sX, e1Z));
+	const __m256 qZ = _mm256_sub_ps(_mm256_mul_ps(sX, e1Y), _mm256_mul_ps(e1X, sY));
+	const __m256 v = _mm256_mul_ps(invDet, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dirX, qX), _mm256_mul_ps(dirY, qY)), _mm256_mul_ps(dirZ, qZ)));
+	const __m256 t = _mm256_mul_ps(invDet, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2X, qX), _mm256_mul_ps(e2Y, qY)), _mm256_mul_ps(e2Z, qZ)));
+
+	const __m256 minBarycentric = _mm256_set1_ps(-TRI_BARYCENTRIC_TOLERANCE);
+	const __m256 maxBarycentric = _mm256_set1_ps(1.0f + TRI_BARYCENTRIC_TOLERANCE);
+	reject = _mm256_or_ps(reject, _mm256_cmp_ps(u, minBarycentric, _CMP_LT_OQ));
+	reject = _mm256_or_ps(reject, _mm256_cmp_ps(u, maxBarycentric, _CMP_GT_OQ));
+	reject = _mm256_or_ps(reject, _mm256_cmp_ps(v, minBarycentric, _CMP_LT_OQ));
+	reject = _mm256_or_ps(reject, _mm256_cmp_ps(v, maxBarycentric, _CMP_GT_OQ));
+	reject = _mm256_or_ps(reject, _mm256_cmp_ps(_mm256_add_ps(u, v), maxBarycentric, _CMP_GT_OQ));
+	const __m256 hit = _mm256_andnot_ps(reject, _mm256_cmp_ps(t, _mm256_set1_ps(-TRI_FAILSAFE), _CMP_GT_OQ));
+
+	_mm256_storeu_ps(dist, t);
+	return _mm256_movemask_ps(hit);
+}
+
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+
+// Returns the bitmask of the 4 triangles starting at first hit by the ray, and their distances
+static int RayIntersectTriangles4(const VisRay& ray, const VisTriangles& tris, size_t first, float* dist)
+{
+	const __m128 dirX = _mm_set1_ps(ray.dir.x), dirY = _mm_set1_ps(ray.dir.y), dirZ = _mm_set1_ps(ray.dir.z);
+	const __m128 e1X = _mm_load_ps(&tris.e1[0][first]), e1Y = _mm_load_ps(&tris.e1[1][first]), e1Z = _mm_load_ps(&tris.e1[2][first]);
+	const __m128 e2X = _mm_load_ps(&tris.e2[0][first]), e2Y = _mm_load_ps(&tris.e2[1][first]), e2Z = _mm_load_ps(&tris.e2[2][first]);
+
+	const __m128 cX = _mm_sub_ps(_mm_mul_ps(dirY, e2Z), _mm_mul_ps(dirZ, e2Y));
+	const __m128 cY = _mm_sub_ps(_mm_mul_ps(dirZ, e2X), _mm_mul_ps(dirX, e2Z));
+	const __m128 cZ = _mm_sub_ps(_mm_mul_ps(dirX, e2Y), _mm_mul_ps(e2X, dirY));
+	const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1X, cX), _mm_mul_ps(e1Y, cY)), _mm_mul_ps(e1Z, cZ));
+	const __m128 absDet = _mm_andnot_ps(_mm_set1_ps(-0.0f), det);
+	__m128 reject = _mm_cmplt_ps(absDet, _mm_set1_ps(EPSILON));
+
+	const __m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+	const __m128 sX = _mm_sub_ps(_mm_set1_ps(ray.origin.x), _mm_load_ps(&tris.v0[0][first]));
+	const __m128 sY = _mm_sub_ps(_mm_set1_ps(ray.origin.y), _mm_load_ps(&tris.v0[1][first]));
+	const __m128 sZ = _mm_sub_ps(_mm_set1_ps(ray.origin.z), _mm_load_ps(&tris.v0[2][first]));
+	const __m128 u = _mm_mul_ps(invDet, _mm_add_ps(_mm_add_ps(_mm_mul_ps(sX, cX), _mm_mul_ps(sY, cY)), _mm_mul_ps(sZ, cZ)));
+
+	const __m128 qX = _mm_sub_ps(_mm_mul_ps(sY, e1Z), _mm_mul_ps(sZ, e1Y));
+	const __m128 qY = _mm_sub_ps(_mm_mul_ps(sZ, e1X), _mm_mul_ps(sX, e1Z));
+	const __m128 qZ = _mm_sub_ps(_mm_mul_ps(sX, e1Y), _mm_mul_ps(e1X, sY));
+	const __m128 v = _mm_mul_ps(invDet, _mm_add_ps(_mm_add_ps(_mm_mul_ps(dirX, qX), _mm_mul_ps(dirY, qY)), _mm_mul_ps(dirZ, qZ)));
+	const __m128 t = _mm_mul_ps(invDet, _mm_add_ps(_mm_add_ps(_mm_mul_ps(e2X, qX), _mm_mul_ps(e2Y, qY)), _mm_mul_ps(e2Z, qZ)));
+
+	const __m128 minBarycentric = _mm_set1_ps(-TRI_BARYCENTRIC_TOLERANCE);
+	const __m128 maxBarycentric = _mm_set1_ps(1.0f + TRI_BARYCENTRIC_TOLERANCE);
+	reject = _mm_or_ps(reject, _mm_cmplt_ps(u, minBarycentric));
+	reject = _mm_or_ps(reject, _mm_cmpgt_ps(u, maxBarycentric));
+	reject = _mm_or_ps(reject, _mm_cmplt_ps(v, minBarycentric));
+	reject = _mm_or_ps(reject, _mm_cmpgt_ps(v, maxBarycentric));
+	reject = _mm_or_ps(reject, _mm_cmpgt_ps(_mm_add_ps(u, v), maxBarycentric));
+	const __m128 hit = _mm_andnot_ps(reject, _mm_cmpgt_ps(t, _mm_set1_ps(-TRI_FAILSAFE)));
+
+	_mm_storeu_ps(dist, t);
+	return _mm_movemask_ps(hit);
+}
+
+#endif
 
-	const BSP* leftChild = node->GetLeftChildren();
-	const BSP* rightChild = node->GetRightChildren();
-	if (leftChild != nullptr)
+// Like the original per triangle loop, the distance reported is the one of the first triangle hit
+static bool RayIntersectTriangles(const VisRay& ray, const VisTriangles& tris, size_t triangleCount, float& dist)
+{
+#if defined(__AVX2__)
+	float dists[VIS_TRIANGLES_PER_QUAD];
+	const int mask = RayIntersectTriangles8(ray, tris, dists);
+	if (mask == 0) { return false; }
+	dist = dists[std::countr_zero(static_cast<unsigned>(mask))];
+	return true;
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	float dists[4];
+	for (size_t first = 0; first < triangleCount; first += 4)
 	{
-		GetPotentialLeavesRecursive(quadblocks, leftChild, rayOrigin, rayDir, maxDist, result);
+		const int mask = RayIntersectTriangles4(ray, tris, first, dists);
+		if (mask == 0) { continue; }
+		dist = dists[std::countr_zero(static_cast<unsigned>(mask))];
+		return true;
 	}
-
-	if (rightChild != nullptr)
+	return false;
+#else
+	for (size_t i = 0; i < triangleCount; i++)
 	{
-		GetPotentialLeavesRecursive(quadblocks, rightChild, rayOrigin, rayDir, maxDist, result);
+		if (RayIntersectTriangle(ray, tris, i, dist)) { return true; }
 	}
+	return false;
+#endif
 }
 
-static std::vector<size_t> GetPotentialQuadblockIndexes(
-	const std::vector<Quadblock>& quadblocks,
-	const BSP* node,
-	const Vec3& rayOrigin,
-	const Vec3& rayDir,
-	const size_t leafBID,
-	const float maxDist)
+static constexpr uint32_t VIS_NODE_NONE = BSP_NODE_NONE;
+
+struct VisNode
 {
-	// Return all the quadblock that can potentially block the ray, sorted by leaf's Bbox tmax. (close quads have higher chance to block the ray)
+	BoundingBox bbox;
+	uint32_t parent;
+	uint32_t left;
+	uint32_t right;
+	uint32_t firstQuad;
+	uint32_t quadCount;
+	int axis; // -1 when the node wasn't split along an axis
+	bool branch;
+};
 
-	std::vector<LeafWithDistance> leavesWithDist;
-	GetPotentialLeavesRecursive(quadblocks, node, rayOrigin, rayDir, maxDist, leavesWithDist);
+struct VisQuad
+{
+	Vec3 normalA;
+	Vec3 normalB;
+	size_t leaf;
+	size_t triangleCount;
+	bool transparent;
+	bool doubleSided;
+};
 
-	std::sort(leavesWithDist.begin(), leavesWithDist.end(),
-		[](const LeafWithDistance& a, const LeafWithDistance& b) { return a.tmax < b.tmax; });
+// Flattened copy of the BSP, built once per bake. Nodes are stored contiguously in depth first order
+// and the quads of each leaf are packed together with everything the ray casts need to filter and test them.
+struct VisBSP
+{
+	std::vector<VisNode> nodes;
+	std::vector<VisQuad> quads;
+	std::vector<VisTriangles> triangles;
+};
+
+// Work done by the ray casts, accumulated per row and only merged into the profiler once the bake is over
+struct VisBakeStats
+{
+	uint64_t rays = 0;
+	uint64_t triangleTests = 0;
+	uint64_t blockedEarlyOuts = 0;
+	uint64_t nearEarlyOuts = 0;
+	uint64_t insideEarlyOuts = 0;
+};
 
-	std::vector<size_t> result;
-	for (const auto& leaf : leavesWithDist)
+// The BSP pool is already in preorder, so its ids map one to one to the flattened nodes
+static void FlattenVisBSP(const std::vector<Quadblock>& quadblocks, const BSP& bsp, const std::vector<size_t>& quadIndexesToLeaves, VisBSP& visBsp)
+{
+	visBsp.nodes.reserve(bsp.GetNodeCount());
+	for (uint32_t id = 0; id < bsp.GetNodeCount(); id++)
 	{
-		for (size_t quadID : leaf.quadIndexes)
+		const BSPTreeNode& node = bsp.GetNode(id);
+		VisNode visNode = {};
+		visNode.bbox = node.bbox;
+		visNode.parent = node.parent;
+		visNode.left = node.left;
+		visNode.right = node.right;
+		visNode.branch = node.IsBranch();
+		visNode.axis = node.axis == AxisSplit::X ? 0 : node.axis == AxisSplit::Y ? 1 : node.axis == AxisSplit::Z ? 2 : -1;
+		if (!visNode.branch)
 		{
-			const Quadblock& quad = quadblocks[quadID]; 
-			if (quad.GetBSPID() == leafBID || !quad.GetVisTreeTransparent())
+			visNode.firstQuad = static_cast<uint32_t>(visBsp.quads.size());
+			for (size_t quadID : bsp.GetQuadblockIndexes(id))
 			{
+				const Quadblock& quad = quadblocks[quadID];
+				VisQuad visQuad = {};
 				// Ideally, a quad has 8 normal, but I just test 2
 				// Fix for triblocks please
-				if (quad.GetDrawDoubleSided() || quad.ComputeNormalVector(0, 2, 6).Dot(rayDir) < 0 || quad.ComputeNormalVector(2, 8, 6).Dot(rayDir) < 0)
+				visQuad.normalA = quad.ComputeNormalVector(0, 2, 6);
+				visQuad.normalB = quad.ComputeNormalVector(2, 8, 6);
+				visQuad.leaf = quadIndexesToLeaves[quadID];
+				visQuad.triangleCount = quad.IsQuadblock() ? VIS_TRIANGLES_PER_QUAD : VIS_TRIANGLES_PER_QUAD / 2;
+				visQuad.transparent = quad.GetVisTreeTransparent();
+				visQuad.doubleSided = quad.GetDrawDoubleSided();
+				visBsp.quads.push_back(visQuad);
+				visBsp.triangles.push_back(BuildVisTriangles(quad));
+			}
+			visNode.quadCount = static_cast<uint32_t>(visBsp.quads.size()) - visNode.firstQuad;
+		}
+		visBsp.nodes.push_back(visNode);
+	}
+}
+
+struct VisHit
+{
+	float closestDist = std::numeric_limits<float>::max();
+	size_t closestLeaf;
+};
+
+// Tests the ray against every quad of the leaf that can potentially block it.
+// Returns true as soon as a quad outside of leafB hides leafB.
+static bool TestVisLeaf(const VisBSP& visBsp, const VisNode& node, const VisRay& ray, size_t leafB, float tminB, VisHit& hit, VisBakeStats& stats)
+{
+	constexpr float failsafe = 0.5f;
+
+	const uint32_t lastQuad = node.firstQuad + node.quadCount;
+	for (uint32_t i = node.firstQuad; i < lastQuad; i++)
+	{
+		const VisQuad& quad = visBsp.quads[i];
+		if (quad.leaf != leafB && quad.transparent) { continue; }
+		if (!quad.doubleSided && quad.normalA.Dot(ray.dir) >= 0 && quad.normalB.Dot(ray.dir) >= 0) { continue; }
+
+		float dist = 0.0f;
+		stats.triangleTests += quad.triangleCount;
+		if (RayIntersectTriangles(ray, visBsp.triangles[i], quad.triangleCount, dist))
+		{
+			// Early exit check: if quad hits before tmin and is not from leafB, it's blocking
+			if (quad.leaf != leafB && (dist + failsafe < tminB)) { stats.blockedEarlyOuts++; return true; }
+
+			if (dist - (quad.leaf == leafB ? failsafe : 0.0f) < hit.closestDist - (hit.closestLeaf == leafB ? failsafe : 0.0f))
+			{
+				hit.closestDist = dist;
+				hit.closestLeaf = quad.leaf;
+			}
+		}
+	}
+	return false;
+}
+
+// Walks the BSP front to back without a stack: the parent links are enough to know
+// whether a node is being entered, or left after its near or far child.
+// Returns true if the closest quad hit by the ray belongs to leafB.
+static bool TraceVisRay(const VisBSP& visBsp, const VisRay& ray, size_t leafA, size_t leafB, float tminB, float maxDist, VisBakeStats& stats)
+{
+	const float dir[3] = {ray.dir.x, ray.dir.y, ray.dir.z};
+
+	VisHit hit;
+	hit.closestLeaf = leafA;
+	uint32_t prev = VIS_NODE_NONE;
+	uint32_t curr = 0;
+	while (curr != VIS_NODE_NONE)
+	{
+		const VisNode& node = visBsp.nodes[curr];
+		uint32_t nearChild = node.left;
+		uint32_t farChild = node.right;
+		// Quads with a center lower than the split go to the right child
+		if (node.axis >= 0 && dir[node.axis] >= 0.0f) { std::swap(nearChild, farChild); }
+
+		uint32_t next = node.parent;
+		if (prev == node.parent)
+		{
+			float tmin, tmax;
+			if (RayIntersectBoundingBox(ray, node.bbox, tmin, tmax) && tmin <= maxDist)
+			{
+				if (!node.branch)
 				{
-					result.push_back(quadID);
+					if (TestVisLeaf(visBsp, node, ray, leafB, tminB, hit, stats)) { return false; }
 				}
+				else if (nearChild != VIS_NODE_NONE) { next = nearChild; }
+				else if (farChild != VIS_NODE_NONE) { next = farChild; }
 			}
 		}
+		else if (prev == nearChild && farChild != VIS_NODE_NONE) { next = farChild; }
+		prev = curr;
+		curr = next;
 	}
-
-	return result;
+	return hit.closestLeaf == leafB;
 }
 
-static std::vector<Vec3> GenerateSamplePointLeaf(const std::vector<Quadblock>& quadblocks, const BSP& leaf, float camera_raise, bool simpleVisTree)
+static void GenerateSamplePointLeaf(const std::vector<Quadblock>& quadblocks, std::span<const size_t> quadIndexes, float camera_raise, bool simpleVisTree, std::vector<Vec3>& samples)
 {
 	// For a leaf node, generate all the points for the vis ray test.
-	std::vector<Vec3> samples;
-	const std::vector<size_t>& quadIndexes = leaf.GetQuadblockIndexes();
+	samples.clear();
 	const Vec3 up = Vec3(0.0f, 1.0f, 0.0f);
 	const float dedupeThreshold = 0.5f;
 	const float dedupeThresholdSquared = dedupeThreshold * dedupeThreshold;
@@ -248,7 +538,7 @@ static std::vector<Vec3> GenerateSamplePointLeaf(const std::vector<Quadblock>& q
 
 	for (size_t quadID : quadIndexes)
 	{
-		Quadblock quad = quadblocks[quadID];
+		const Quadblock& quad = quadblocks[quadID];
 		float up_dist = 0.0f;
 		if (quad.GetFlags() & QuadFlags::GROUND)
 		{
@@ -274,15 +564,12 @@ static std::vector<Vec3> GenerateSamplePointLeaf(const std::vector<Quadblock>& q
 			}
 		}
 	}
-	return samples;
 }
 
-float GetLeafDistanceSquared(const BSP& leaf1, const BSP& leaf2)
+float GetLeafDistanceSquared(const BoundingBox& a, const BoundingBox& b)
 {
 	// Return the closest distance between the BBox of leaf1 and leaf2.
 	// Return 0.0f if they are intersecting, or one is included in the other
-	const BoundingBox& a = leaf1.GetBoundingBox();
-	const BoundingBox& b = leaf2.GetBoundingBox();
 
 	float dx = std::max({ 0.0f, b.min.x - a.max.x, a.min.x - b.max.x });
 	float dy = std::max({ 0.0f, b.min.y - a.max.y, a.min.y - b.max.y });
@@ -291,140 +578,215 @@ float GetLeafDistanceSquared(const BSP& leaf1, const BSP& leaf2)
 	return (dx * dx + dy * dy + dz * dz);
 }
 
-BitMatrix GenerateVisTree(const std::vector<Quadblock>& quadblocks, const BSP* root, bool simpleVisTree, float minDistance, float maxDistance)
+// Everything a bake needs that only depends on the BSP and the quadblocks
+struct VisTreeBake
 {
-	auto start_time = std::chrono::high_resolution_clock::now();
+	std::vector<uint32_t> leaves;
+	VisBSP visBsp;
+	std::vector<std::vector<Vec3>> raisedSamples;
+	std::vector<std::vector<Vec3>> flatSamples;
+	std::vector<uint8_t> raiseMatters;
+	float minDistance;
+	float maxDistanceSquared;
+};
 
-	const float maxDistanceSquared = maxDistance * maxDistance;
-	std::vector<const BSP*> leaves = root->GetLeaves();
-	BitMatrix vizMatrix = BitMatrix(leaves.size(), leaves.size());
+static bool IsLeafVisible(const VisTreeBake& bake, size_t leafA, size_t leafB, const std::vector<Vec3>& sampleA, const std::vector<Vec3>& sampleB, VisBakeStats& stats)
+{
+	const BoundingBox& bboxA = bake.visBsp.nodes[bake.leaves[leafA]].bbox;
+	const BoundingBox& bboxB = bake.visBsp.nodes[bake.leaves[leafB]].bbox;
+	float distBboxsquared = GetLeafDistanceSquared(bboxA, bboxB);
+	// If minDistance is positive, and bigger than distBbox
+	if (bake.minDistance > -0.0001f && bake.minDistance * bake.minDistance >= distBboxsquared) { stats.nearEarlyOuts++; return true; }
+
+	for (const Vec3& pointA : sampleA)
+	{
+		for (const Vec3& pointB : sampleB)
+		{
+			Vec3 directionVector = pointB - pointA;
+			if (directionVector.LengthSquared() > bake.maxDistanceSquared) { continue; }
+			directionVector.Normalize();
+			const VisRay ray(pointA, directionVector);
+			stats.rays++;
+
+			// Calculate distance range to leafB's bounding box
+			float tmin, tmax;
+			bool intersect = RayIntersectBoundingBox(ray, bboxB, tmin, tmax);
+			if (!intersect)
+			{
+				// Weird edge case that shouldn't happen, but still does...
+				continue;
+			}
+			if (tmin < 0.0f)
+			{
+				// We are inside the Bbox. 
+				stats.insideEarlyOuts++;
+				return true;
+			}
+
+			if (TraceVisRay(bake.visBsp, ray, leafA, leafB, tmin, tmax, stats)) { return true; }
+		}
+	}
+	return false;
+}
+
+static bool IsLeafPairVisible(const VisTreeBake& bake, size_t leafA, size_t leafB, bool symmetric, VisBakeStats& stats)
+{
+	bool visible = IsLeafVisible(bake, leafA, leafB, bake.raisedSamples[leafA], bake.flatSamples[leafB], stats);
+	// A hit from A is reused for B. A miss can only be reused if the camera raise
+	// doesn't move the samples of either leaf, otherwise B has to look back at A.
+	if (symmetric && !visible && (bake.raiseMatters[leafA] || bake.raiseMatters[leafB]))
+	{
+		visible = IsLeafVisible(bake, leafB, leafA, bake.raisedSamples[leafB], bake.flatSamples[leafA], stats);
+	}
+	return visible;
+}
 
-	const float cameraHeight = 5.0f;
-	const float failsafe = 0.5f;
+static void PrepareVisTreeBake(VisTreeBake& bake, const std::vector<Quadblock>& quadblocks, const BSP& bsp, const VisTreeSettings& settings, int threadCount)
+{
+	ScopedTimer timer("Vis/prepare");
+	bake.leaves = bsp.GetLeaves();
+	bake.minDistance = settings.minDistance;
+	bake.maxDistanceSquared = settings.maxDistance * settings.maxDistance;
 
-	const int quadCount = static_cast<int>(quadblocks.size());
-	std::vector<size_t> quadIndexesToLeaves(quadCount);
+	const std::vector<uint32_t>& leaves = bake.leaves;
+	std::vector<size_t> quadIndexesToLeaves(quadblocks.size());
 	for (size_t i = 0; i < leaves.size(); i++)
 	{
-		const std::vector<size_t>& quadIndexes = leaves[i]->GetQuadblockIndexes();
-		for (size_t index : quadIndexes) { quadIndexesToLeaves[index] = i; }
+		for (size_t index : bsp.GetQuadblockIndexes(leaves[i])) { quadIndexesToLeaves[index] = i; }
 	}
+	FlattenVisBSP(quadblocks, bsp, quadIndexesToLeaves, bake.visBsp);
+
+	// Sample points only depend on the leaf, so they're generated once: raised ones are used when the leaf is the viewer,
+	// flat ones when the leaf is the target.
+	const int leafCount = static_cast<int>(leaves.size());
+	bake.raisedSamples.resize(leaves.size());
+	bake.flatSamples.resize(leaves.size());
+	bake.raiseMatters.resize(leaves.size());
+	#pragma omp parallel for num_threads(threadCount)
+	for (int leaf = 0; leaf < leafCount; leaf++)
+	{
+		GenerateSamplePointLeaf(quadblocks, bsp.GetQuadblockIndexes(leaves[leaf]), settings.cameraHeight, settings.simple, bake.raisedSamples[leaf]);
+		GenerateSamplePointLeaf(quadblocks, bsp.GetQuadblockIndexes(leaves[leaf]), 0.0f, settings.simple, bake.flatSamples[leaf]);
+		bake.raiseMatters[leaf] = bake.raisedSamples[leaf] != bake.flatSamples[leaf];
+	}
+}
 
-	for (size_t leafA = 0; leafA < leaves.size(); leafA++)
+/*
+	Counts the rows of a bake and prints the progress from its own thread every half second,
+	so that the workers never touch stdout and the lines come out in order no matter which rows finish first.
+*/
+class VisTreeProgressPrinter
+{
+public:
+	VisTreeProgressPrinter(size_t total) : m_completed(0), m_total(total), m_running(true), m_thread([this]() { Print(); }) {}
+	~VisTreeProgressPrinter()
 	{
-		printf("Prog: %d/%d\n", static_cast<int>(leafA + 1), static_cast<int>(leaves.size()));
-		vizMatrix.Set(true, leafA, leafA);
-		const std::vector<Vec3> sampleA = GenerateSamplePointLeaf(quadblocks, *leaves[leafA], cameraHeight, simpleVisTree);
-		for (size_t leafB = 0; leafB < leaves.size(); leafB++)
 		{
-			bool foundLeafABHit = false;
-			const std::vector<Vec3> sampleB = GenerateSamplePointLeaf(quadblocks, *leaves[leafB], 0.0f, simpleVisTree);
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_running = false;
+		}
+		m_wake.notify_one();
+		m_thread.join();
+	}
+	VisTreeProgressPrinter(const VisTreeProgressPrinter&) = delete;
+	VisTreeProgressPrinter& operator=(const VisTreeProgressPrinter&) = delete;
 
-			// Pre-build sets of quadblock indices for leafA and leafB for quick lookup
-			const std::vector<size_t>& quadIndexesA = leaves[leafA]->GetQuadblockIndexes();
-			const std::vector<size_t>& quadIndexesB = leaves[leafB]->GetQuadblockIndexes();
+	void Advance() { m_completed++; }
 
-			float distBboxsquared = GetLeafDistanceSquared(*leaves[leafA], *leaves[leafB]);
-			// If minDistance is positive, and bigger than distBbox
-			if (minDistance > -0.0001f && minDistance * minDistance >= distBboxsquared)
+private:
+	void Print()
+	{
+		size_t printed = 0;
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (true)
+		{
+			const bool running = !m_wake.wait_for(lock, std::chrono::milliseconds(500), [this]() { return !m_running; });
+			const size_t completed = m_completed;
+			if (completed != printed)
 			{
-				foundLeafABHit = true;
+				printf("Prog: %zu/%zu\n", completed, m_total);
+				printed = completed;
 			}
+			if (!running) { return; }
+		}
+	}
 
-			for (const Vec3& pointA : sampleA)
-			{
-				if (foundLeafABHit) { break; }
+private:
+	std::atomic<size_t> m_completed;
+	const size_t m_total;
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	bool m_running;
+	std::thread m_thread;
+};
 
-				for (const Vec3& pointB : sampleB)
-				{
-					if (foundLeafABHit) { break; }
-					Vec3 directionVector = pointB - pointA;
-					if (directionVector.LengthSquared() > maxDistanceSquared) { continue; }
-					directionVector.Normalize();
-
-					// Calculate distance range to leafB's bounding box
-					float tmin, tmax;
-					const BoundingBox& bboxB = leaves[leafB]->GetBoundingBox();
-					bool intersect = RayIntersectBoundingBox(pointA, directionVector, bboxB, tmin, tmax);
-					if (!intersect)
-					{
-						// Weird edge case that shouldn't happen, but still does...
-						continue;
-					}
-					if (tmin < 0.0f)
-					{
-						// We are inside the Bbox. 
-						foundLeafABHit = true;
-						break;
-					}
-
-					std::vector<size_t> potentialQuads = GetPotentialQuadblockIndexes(quadblocks, root, pointA, directionVector, leaves[leafB]->GetId() , tmax);
-
-					float closestDist = std::numeric_limits<float>::max();
-					size_t closestLeaf = leafA;
-					bool foundBlockingQuad = false;
-
-					// Single loop: test quads and check for blocking simultaneously
-					for (size_t i = 0; i < potentialQuads.size(); i++)
-					{
-						if (foundBlockingQuad)
-						{
-							break;
-						}
-
-						size_t testQuadIndex = potentialQuads[i];
-						size_t quadLeaf = quadIndexesToLeaves[testQuadIndex];
-
-						float dist = 0.0f;
-						const Quadblock& testQuad = quadblocks[testQuadIndex];
-
-						if (RayIntersectQuadblockTest(pointA, directionVector, testQuad, dist))
-						{
-							// Early exit check: if quad hits before tmin and is not from leafB, it's blocking
-							if (quadLeaf != leafB && (dist + failsafe < tmin))
-							{
-								foundBlockingQuad = true;
-								break;
-							}
-
-							if (dist - (quadLeaf == leafB ? failsafe : 0.0f) < closestDist - (closestLeaf == leafB ? failsafe : 0.0f))
-							{
-								closestDist = dist;
-								closestLeaf = quadLeaf;
-							}
-						}
-					}
-
-					// If we found a blocking quad, skip to next pointB
-					if (foundBlockingQuad)
-					{
-						continue;
-					}
-
-					if (closestLeaf == leafB)
-					{
-						foundLeafABHit = true;
-					}
-				}
+/*
+	Each leafA row is independent from the others, so rows are handed out dynamically
+	to the worker threads and the result matches the serial bake bit for bit.
+	The symmetric mode only computes the upper triangle, which gets mirrored afterwards.
+	When pairs is set, only the cells flagged in it are recomputed.
+*/
+static void BakeVisTreeRows(BitMatrix& vizMatrix, const VisTreeBake& bake, const BitMatrix* pairs, bool symmetric, int threadCount)
+{
+	const int leafCount = static_cast<int>(bake.leaves.size());
+	VisBakeStats totalStats;
+	uint64_t leafPairs = 0;
+	{
+		VisTreeProgressPrinter printer(bake.leaves.size());
+		#pragma omp parallel for schedule(dynamic, 1) num_threads(threadCount)
+		for (int leafA = 0; leafA < leafCount; leafA++)
+		{
+			VisBakeStats stats;
+			uint64_t rowPairs = 0;
+			vizMatrix.Set(true, leafA, leafA);
+			const size_t firstLeafB = symmetric ? static_cast<size_t>(leafA) + 1 : 0;
+			for (size_t leafB = firstLeafB; leafB < bake.leaves.size(); leafB++)
+			{
+				if (pairs && !pairs->Get(leafA, leafB)) { continue; }
+				vizMatrix.Set(IsLeafPairVisible(bake, leafA, leafB, symmetric, stats), leafA, leafB);
+				rowPairs++;
 			}
-			if (foundLeafABHit)
+			#pragma omp critical(VisBakeStats)
 			{
-				vizMatrix.Set(true, leafA, leafB);
+				totalStats.rays += stats.rays;
+				totalStats.triangleTests += stats.triangleTests;
+				totalStats.blockedEarlyOuts += stats.blockedEarlyOuts;
+				totalStats.nearEarlyOuts += stats.nearEarlyOuts;
+				totalStats.insideEarlyOuts += stats.insideEarlyOuts;
+				leafPairs += rowPairs;
 			}
+			printer.Advance();
 		}
 	}
-	int count = 0;
-	for (size_t leafA = 0; leafA < leaves.size(); leafA++)
+	Profiler::AddCount("Vis/leaf pairs", leafPairs);
+	Profiler::AddCount("Vis/rays", totalStats.rays);
+	Profiler::AddCount("Vis/triangle tests", totalStats.triangleTests);
+	Profiler::AddCount("Vis/early-out blocked", totalStats.blockedEarlyOuts);
+	Profiler::AddCount("Vis/early-out near clip", totalStats.nearEarlyOuts);
+	Profiler::AddCount("Vis/early-out inside leaf", totalStats.insideEarlyOuts);
+
+	if (!symmetric) { return; }
+
+	for (size_t leafA = 0; leafA < bake.leaves.size(); leafA++)
 	{
-		for (size_t leafB = 0; leafB < leaves.size(); leafB++)
+		const uint64_t* row = pairs ? pairs->GetRow(leafA) : vizMatrix.GetRow(leafA);
+		for (size_t word = 0; word < vizMatrix.GetRowWords(); word++)
 		{
-			if (vizMatrix.Get(leafA, leafB))
+			uint64_t bits = row[word];
+			while (bits != 0)
 			{
-				count++;
+				const size_t leafB = (word * 64) + std::countr_zero(bits);
+				if (leafB > leafA) { vizMatrix.Set(vizMatrix.Get(leafA, leafB), leafB, leafA); }
+				bits &= bits - 1;
 			}
 		}
 	}
-	int max = static_cast<int>(leaves.size() * leaves.size());
+}
+
+static void PrintVisTreeStats(const BitMatrix& vizMatrix, const std::chrono::high_resolution_clock::time_point& start_time)
+{
+	int count = static_cast<int>(vizMatrix.Count());
+	int max = static_cast<int>(vizMatrix.GetWidth() * vizMatrix.GetHeight());
 	float ratio = 100.0f * static_cast<float>(count) / static_cast<float>(max);
 	printf("Visibility: %d/%d,  %f%%\n", count, max, ratio);
 
@@ -434,5 +796,167 @@ BitMatrix GenerateVisTree(const std::vector<Quadblock>& quadblocks, const BSP* r
 	long long secs = total_seconds % 60;
 
 	printf("Runtime %lldmin %lldsec\n", mins, secs);
+}
+
+static BoundingBox ExpandBoundingBox(const BoundingBox& bbox, float distance)
+{
+	const Vec3 offset = Vec3(distance, distance, distance);
+	return {bbox.min - offset, bbox.max + offset};
+}
+
+static BoundingBox MergeBoundingBoxes(const BoundingBox& a, const BoundingBox& b)
+{
+	return {Vec3(std::min(a.min.x, b.min.x), std::min(a.min.y, b.min.y), std::min(a.min.z, b.min.z)),
+		Vec3(std::max(a.max.x, b.max.x), std::max(a.max.y, b.max.y), std::max(a.max.z, b.max.z))};
+}
+
+static bool BoundingBoxesOverlap(const BoundingBox& a, const BoundingBox& b)
+{
+	return a.min.x <= b.max.x && b.min.x <= a.max.x && a.min.y <= b.max.y && b.min.y <= a.max.y && a.min.z <= b.max.z && b.min.z <= a.max.z;
+}
+
+static bool SegmentIntersectsBoundingBox(const Vec3& start, const Vec3& end, const BoundingBox& bbox)
+{
+	float tmin = 0.0f;
+	float tmax = 1.0f;
+	const float start3[3] = {start.x, start.y, start.z};
+	const float delta3[3] = {end.x - start.x, end.y - start.y, end.z - start.z};
+	const float min3[3] = {bbox.min.x, bbox.min.y, bbox.min.z};
+	const float max3[3] = {bbox.max.x, bbox.max.y, bbox.max.z};
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (std::abs(delta3[axis]) < 0.00001f)
+		{
+			if (start3[axis] < min3[axis] || start3[axis] > max3[axis]) { return false; }
+			continue;
+		}
+		float t0 = (min3[axis] - start3[axis]) / delta3[axis];
+		float t1 = (max3[axis] - start3[axis]) / delta3[axis];
+		if (t0 > t1) { std::swap(t0, t1); }
+		tmin = std::max(tmin, t0);
+		tmax = std::min(tmax, t1);
+		if (tmin > tmax) { return false; }
+	}
+	return true;
+}
+
+/*
+	Every segment between viewer and target lies in their convex hull, which is contained both in
+	the union of the two boxes and in the segment between their centers swept by the largest half extents.
+*/
+static bool PairCanCrossRegion(const BoundingBox& viewer, const BoundingBox& target, const BoundingBox& region)
+{
+	if (!BoundingBoxesOverlap(MergeBoundingBoxes(viewer, target), region)) { return false; }
+
+	const Vec3 viewerHalf = viewer.AxisLength() / 2.0f;
+	const Vec3 targetHalf = target.AxisLength() / 2.0f;
+	const Vec3 sweep = Vec3(std::max(viewerHalf.x, targetHalf.x), std::max(viewerHalf.y, targetHalf.y), std::max(viewerHalf.z, targetHalf.z));
+	const BoundingBox sweptRegion = {region.min - sweep, region.max + sweep};
+	return SegmentIntersectsBoundingBox(viewer.Midpoint(), target.Midpoint(), sweptRegion);
+}
+
+BitMatrix GenerateVisTree(const std::vector<Quadblock>& quadblocks, const BSP& bsp, const VisTreeSettings& settings)
+{
+	auto start_time = std::chrono::high_resolution_clock::now();
+
+	ScopedTimer timer("Vis/bake");
+	const int threadCount = settings.threadCount > 0 ? settings.threadCount : omp_get_max_threads();
+	VisTreeBake bake;
+	PrepareVisTreeBake(bake, quadblocks, bsp, settings, threadCount);
+	BitMatrix vizMatrix = BitMatrix(bake.leaves.size(), bake.leaves.size());
+	BakeVisTreeRows(vizMatrix, bake, nullptr, settings.symmetric, threadCount);
+	PrintVisTreeStats(vizMatrix, start_time);
 	return vizMatrix;
-}
\ No newline at end of file
+}
+
+/*
+	A triangle is hit up to 50% outside of its edges, which in the worst case reaches
+	1.5x its size past the quadblock bounding box. Rays may also start slightly behind a blocker.
+*/
+std::vector<BoundingBox> ComputeVisLeafInfluence(const std::vector<Quadblock>& quadblocks, const BSP& bsp)
+{
+	std::vector<BoundingBox> leafInfluence;
+	leafInfluence.reserve(bsp.GetLeaves().size());
+	for (uint32_t leaf : bsp.GetLeaves())
+	{
+		BoundingBox influence = bsp.GetNode(leaf).bbox;
+		for (size_t index : bsp.GetQuadblockIndexes(leaf))
+		{
+			const BoundingBox& bbox = quadblocks[index].GetBoundingBox();
+			const Vec3 axisLength = bbox.AxisLength();
+			const float reach = (1.0f + TRI_BARYCENTRIC_TOLERANCE) * std::max({axisLength.x, axisLength.y, axisLength.z}) + TRI_FAILSAFE;
+			influence = MergeBoundingBoxes(influence, ExpandBoundingBox(bbox, reach));
+		}
+		leafInfluence.push_back(influence);
+	}
+	return leafInfluence;
+}
+
+bool UpdateVisTree(BitMatrix& visMatrix, const std::vector<Quadblock>& quadblocks, const BSP& bsp, const std::vector<size_t>& changedLeaves, std::vector<BoundingBox>& leafInfluence, const VisTreeSettings& settings)
+{
+	auto start_time = std::chrono::high_resolution_clock::now();
+
+	ScopedTimer timer("Vis/update");
+	const int threadCount = settings.threadCount > 0 ? settings.threadCount : omp_get_max_threads();
+	VisTreeBake bake;
+	PrepareVisTreeBake(bake, quadblocks, bsp, settings, threadCount);
+
+	const std::vector<uint32_t>& leaves = bake.leaves;
+	if (visMatrix.GetWidth() != leaves.size() || visMatrix.GetHeight() != leaves.size() || leafInfluence.size() != leaves.size()) { return false; }
+
+	// Space the changed leaves can block, both before and after the edit
+	const std::vector<BoundingBox> currentInfluence = ComputeVisLeafInfluence(quadblocks, bsp);
+	std::vector<BoundingBox> changedRegions;
+	std::vector<uint8_t> changed(leaves.size(), 0);
+	for (size_t leaf : changedLeaves)
+	{
+		changed[leaf] = 1;
+		changedRegions.push_back(MergeBoundingBoxes(leafInfluence[leaf], currentInfluence[leaf]));
+	}
+
+	// Rays from A to B start at A's (raised) samples and stop at the far side of B,
+	// so a pair needs to be recomputed if the space between them meets one of the changed regions.
+	const int leafCount = static_cast<int>(leaves.size());
+	BitMatrix pairs(leaves.size(), leaves.size());
+	#pragma omp parallel for schedule(dynamic, 16) num_threads(threadCount)
+	for (int leafA = 0; leafA < leafCount; leafA++)
+	{
+		BoundingBox viewer = bsp.GetNode(leaves[leafA]).bbox;
+		viewer.max.y += settings.cameraHeight;
+		for (size_t leafB = 0; leafB < leaves.size(); leafB++)
+		{
+			bool dirty = changed[leafA] || changed[leafB];
+			if (!dirty)
+			{
+				const BoundingBox& target = bsp.GetNode(leaves[leafB]).bbox;
+				for (const BoundingBox& region : changedRegions)
+				{
+					if (PairCanCrossRegion(viewer, target, region)) { dirty = true; break; }
+				}
+			}
+			if (dirty) { pairs.Set(true, leafA, leafB); }
+		}
+	}
+	// The symmetric bake only looks at the upper triangle and traces both ways from there,
+	// so a pair is dirty if an edit can block the rays in either direction.
+	if (settings.symmetric)
+	{
+		for (size_t leafA = 0; leafA < leaves.size(); leafA++)
+		{
+			for (size_t leafB = leafA + 1; leafB < leaves.size(); leafB++)
+			{
+				if (pairs.Get(leafA, leafB) || pairs.Get(leafB, leafA))
+				{
+					pairs.Set(true, leafA, leafB);
+					pairs.Set(true, leafB, leafA);
+				}
+			}
+		}
+	}
+	printf("Vis tree update: %d/%d pairs\n", static_cast<int>(pairs.Count()), leafCount * leafCount);
+
+	BakeVisTreeRows(visMatrix, bake, &pairs, settings.symmetric, threadCount);
+	for (size_t leaf : changedLeaves) { leafInfluence[leaf] = currentInfluence[leaf]; }
+	PrintVisTreeStats(visMatrix, start_time);
+	return true;
+}
@@ -5,24 +5,54 @@
 #include "geo.h"
 
 #include <vector>
+#include <cstdint>
 
+/*
+	Each x owns a row of height bits, packed in 64-bit words. Rows never share a word,
+	so different threads can write to different rows at the same time.
+*/
 class BitMatrix
 {
 public:
 	BitMatrix() {};
-	BitMatrix(size_t width, size_t height) : m_width(width), m_height(height), m_data(width * height) {}
+	BitMatrix(size_t width, size_t height) : m_width(width), m_height(height), m_rowWords((height + 63) / 64), m_data(width * m_rowWords, 0) {}
 
 	bool Get(size_t x, size_t y) const;
 	size_t GetWidth() const;
 	size_t GetHeight() const;
+	size_t GetRowWords() const;
+	const uint64_t* GetRow(size_t x) const;
+	void GetPSXRow(size_t x, uint8_t* dst) const;
 	void Set(bool value, size_t x, size_t y);
+	void SetRow(size_t x, const uint64_t* words);
+	void OrRow(size_t x, const BitMatrix& other, size_t otherX);
+	void AndRow(size_t x, const BitMatrix& other, size_t otherX);
+	void ClearRow(size_t x);
+	size_t CountRow(size_t x) const;
+	size_t Count() const;
 	bool IsEmpty() const;
 	void Clear();
 
 private:
-	size_t m_width;
-	size_t m_height;
-	std::vector<bool> m_data;
+	size_t m_width = 0;
+	size_t m_height = 0;
+	size_t m_rowWords = 0;
+	std::vector<uint64_t> m_data;
 };
 
-BitMatrix GenerateVisTree(const std::vector<Quadblock>& quadblocks, const BSP* root, bool simpleVisTree, float minDistance, float maxDistance);
+struct VisTreeSettings
+{
+	bool simple = false;
+	bool symmetric = false; // tests each pair of leaves once and assumes the visibility is mutual
+	int threadCount = 0; // 0 uses every available core
+	float minDistance = -1.0f;
+	float maxDistance = 1000.0f;
+	float cameraHeight = 5.0f; // raise applied to the ground samples of the viewing leaf
+};
+
+BitMatrix GenerateVisTree(const std::vector<Quadblock>& quadblocks, const BSP& bsp, const VisTreeSettings& settings);
+// Space in which the quadblocks of each leaf can block a vis ray, in matrix order.
+std::vector<BoundingBox> ComputeVisLeafInfluence(const std::vector<Quadblock>& quadblocks, const BSP& bsp);
+// Recomputes the cells of visMatrix whose rays can cross one of the changed leaves (matrix indexes).
+// leafInfluence holds the influence from the last bake, and is updated on success.
+bool UpdateVisTree(BitMatrix& visMatrix, const std::vector<Quadblock>& quadblocks, const BSP& bsp, const std::vector<size_t>& changedLeaves, std::vector<BoundingBox>& leafInfluence, const VisTreeSettings& settings);